@@ -0,0 +1,2083 @@
+/*
+ *  cam_chardev.c - the input (write) and output (read) character devices
+ *
+ *  One driver for any number of instances. An instance is a group of
+ *  cameras with all of its state in a struct cam_instance, so camera
+ *  groups on the same host never share buffers or locks. Minor n of
+ *  either major is instance n, minor CTL_MINOR of the write major is the
+ *  control node that creates and destroys instances, and the minors from
+ *  STREAM_MINOR_BASE of the read major are the YUV4MPEG2 camera streams.
+ *
+ *  A camera's buffer is allocated by its first write. Under memory
+ *  pressure a shrinker frees the buffers of cameras nobody touched for
+ *  idle_secs, and of every camera of an instance nobody reads; the next
+ *  write allocates the buffer again. The buffer is physically contiguous
+ *  when there is memory for it, and on the node of the CPU that writes the
+ *  camera (or numa_node), so the copies are local and need few TLB entries.
+ *
+ *  A writer may also hand in its frames pinned (IOCTL_WRITE_PINNED): the
+ *  camera keeps a reference to the writer's pages instead of a copy, and
+ *  the frame is only copied if a reader takes it, so frames of cameras
+ *  nobody watches are never copied at all.
+ */
+#include <linux/kernel.h>	/* We're doing kernel work */
+#include <linux/module.h>	/* Specifically, a module */
+#include <linux/moduleparam.h>
+#include <linux/fs.h>
+#include <linux/ktime.h>	/* ktime_get_ns */
+#include <linux/wait.h>		/* wait queues */
+#include <linux/jiffies.h>	/* msecs_to_jiffies */
+#include <linux/mutex.h>
+#include <linux/slab.h>		/* kzalloc */
+#include <linux/vmalloc.h>
+#include <linux/mm.h>		/* pin_user_pages_fast */
+#include <linux/topology.h>	/* numa_node_id */
+#include <linux/uio.h>		/* iov_iter */
+#include <linux/shrinker.h>
+#include <linux/rwsem.h>
+#include <linux/version.h>
+#include <asm/uaccess.h>	/* for get_user and put_user */
+#include "cam_internal.h"
+#define WRITE_DEVICE_NAME "write_char_dev"
+#define READ_DEVICE_NAME "read_char_dev"
+
+MODULE_LICENSE("GPL");
+
+/*
+ * Instances created at load time, and their limits
+ */
+static int instances = 1;
+module_param(instances, int, 0444);
+MODULE_PARM_DESC(instances, "instances to create at load time (default 1)");
+
+static int cams = CAM_NUM;
+module_param(cams, int, 0444);
+MODULE_PARM_DESC(cams, "cameras of the instances created at load time");
+
+static int cam_len = CAM_LEN;
+module_param(cam_len, int, 0444);
+MODULE_PARM_DESC(cam_len, "bytes per camera of the instances created at load time");
+
+static int idle_secs = 60;
+module_param(idle_secs, int, 0644);
+MODULE_PARM_DESC(idle_secs, "seconds without a write or read before the shrinker may free a camera (default 60)");
+
+static int numa_node = NUMA_NO_NODE;
+module_param(numa_node, int, 0644);
+MODULE_PARM_DESC(numa_node, "NUMA node of the camera buffers (default -1, the node of the writer)");
+
+static bool contig_bufs = true;
+module_param(contig_bufs, bool, 0644);
+MODULE_PARM_DESC(contig_bufs, "physically contiguous camera buffers when there is memory for them (default 1)");
+
+/*
+ * The instances by minor number, instances_lock protects the table
+ * and the open counts (so an instance isn't destroyed while open)
+ */
+static struct cam_instance *instance[MAX_INSTANCES];
+static DEFINE_MUTEX(instances_lock);
+
+/*
+ * The buffer of camera n, NULL if it wasn't written yet or was reclaimed
+ */
+static inline char *camera(struct cam_instance *inst, int n) {
+
+	return inst->cam_buf[n];
+}
+
+/*
+ * A camera buffer on numa_node, or on the node of this CPU (the writer's).
+ * With contig_bufs it comes from the page allocator, in the direct map
+ * that the kernel maps with large pages, and only if that fails from
+ * vmalloc. Either way kvfree frees it.
+ */
+static char *camera_buf_alloc(size_t len, int *node) {
+
+	int nid = numa_node;
+	char *buf;
+
+	if (nid < 0 || nid >= MAX_NUMNODES || !node_online(nid))
+		nid = numa_node_id();
+	buf = contig_bufs ? kvzalloc_node(len, GFP_KERNEL, nid) : vzalloc_node(len, nid);
+	if (!buf)
+		return NULL;
+	// the node we got, not the one we asked for
+	*node = page_to_nid(is_vmalloc_addr(buf) ? vmalloc_to_page(buf) : virt_to_page(buf));
+	return buf;
+}
+
+/*
+ * The buffer of camera n for a write, allocated if the camera has none.
+ * Called with buf_sem held for reading, so the shrinker can't take it.
+ */
+static char *camera_alloc(struct cam_instance *inst, int n) {
+
+	char *buf = camera(inst, n);
+	int node;
+
+	if (buf)
+		return buf;
+	buf = camera_buf_alloc(inst->cam_len, &node);
+	if (!buf)
+		return NULL;
+
+	spin_lock(&inst->lock);
+	// another thread of the writer may have been first
+	if (inst->cam_buf[n]) {
+		spin_unlock(&inst->lock);
+		kvfree(buf);
+		return camera(inst, n);
+	}
+	inst->cam_buf[n] = buf;
+	inst->cam_node[n] = node;
+	inst->last_access[n] = jiffies;
+	if (test_and_clear_bit(n, &inst->reclaimed_cams))
+		inst->reallocs[n]++;
+	spin_unlock(&inst->lock);
+#ifdef DEBUG
+	printk(KERN_INFO "instance %d: camera %d on node %d%s\n", inst->id, n, node,
+			is_vmalloc_addr(buf) ? "" : ", contiguous");
+#endif
+	return buf;
+}
+
+/*
+ * ============================ pinned frames ============================
+ */
+
+// pin_user_pages came with 5.6, a page reference did the same before
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 6, 0)
+#define pin_user_pages_fast get_user_pages_fast
+static void unpin_user_pages(struct page **pages, unsigned long npages) {
+
+	while (npages--)
+		put_page(pages[npages]);
+}
+#endif
+// and get_user_pages_fast only took a write flag before 5.2
+#ifndef FOLL_LONGTERM
+#define FOLL_LONGTERM 0
+#endif
+
+/*
+ * Pin and map the pages of the serialized frame of size bytes at ubuf
+ */
+static struct pinned_buf *pin_frame(unsigned long ubuf, size_t size) {
+
+	unsigned long start = ubuf & PAGE_MASK;
+	size_t off = ubuf - start;
+	struct pinned_buf *p;
+	int got, ret = -ENOMEM;
+
+	p = kzalloc(sizeof(*p), GFP_KERNEL);
+	if (!p)
+		return ERR_PTR(-ENOMEM);
+	p->npages = DIV_ROUND_UP(off + size, PAGE_SIZE);
+	p->pages = kvmalloc_array(p->npages, sizeof(struct page *), GFP_KERNEL);
+	if (!p->pages)
+		goto fail;
+
+	/*
+	 * the module only reads the frame, but keeps it until the camera's
+	 * next frame - maybe for good, so not in CMA or movable memory
+	 */
+	got = pin_user_pages_fast(start, p->npages, FOLL_LONGTERM, p->pages);
+	if (got != p->npages) {
+		if (got > 0)
+			unpin_user_pages(p->pages, got);
+		ret = got < 0 ? got : -EFAULT;
+		goto fail;
+	}
+	p->map = vmap(p->pages, p->npages, VM_MAP, PAGE_KERNEL_RO);
+	if (!p->map) {
+		unpin_user_pages(p->pages, p->npages);
+		goto fail;
+	}
+
+	p->node = page_to_nid(p->pages[0]);
+	p->frame = p->map + off + sizeof(size_t) + sizeof(int);
+	p->len = size - sizeof(size_t) - sizeof(int);
+	memcpy(&p->times, p->frame, sizeof(p->times));
+	atomic_set(&p->refs, 1);
+	return p;
+
+fail:
+	kvfree(p->pages);
+	kfree(p);
+	return ERR_PTR(ret);
+}
+
+static void free_pinned(struct pinned_buf *p) {
+
+	vunmap(p->map);
+	unpin_user_pages(p->pages, p->npages);
+	kvfree(p->pages);
+	kfree(p);
+}
+
+/*
+ * Drop a reference, the last one unpins the frame and gives the buffer
+ * back to the writer. Not under inst->lock, vunmap may sleep.
+ */
+static void put_pinned(struct cam_instance *inst, struct pinned_buf *p) {
+
+	if (!p || !atomic_dec_and_test(&p->refs))
+		return;
+
+	spin_lock(&inst->lock);
+	// a writer that closed doesn't want it any more
+	if (p->writer_gen == inst->writer_gen && inst->rel_head - inst->rel_tail < PIN_OUTSTANDING)
+		inst->released[inst->rel_head++ % PIN_OUTSTANDING] = p->cookie;
+	spin_unlock(&inst->lock);
+	wake_up_interruptible(&inst->release_wait);
+	free_pinned(p);
+}
+
+/*
+ * A reference to the pinned frame of camera n, for a copy outside
+ * inst->lock, NULL if the frame isn't pinned. Under inst->lock.
+ */
+static struct pinned_buf *get_pinned(struct cam_instance *inst, int n) {
+
+	struct pinned_buf *p = inst->pinned[n];
+
+	if (p)
+		atomic_inc(&p->refs);
+	return p;
+}
+
+/*
+ * Take the pinned frame off camera n, under inst->lock - put_pinned it
+ * after the unlock
+ */
+static struct pinned_buf *take_pinned(struct cam_instance *inst, int n) {
+
+	struct pinned_buf *p = inst->pinned[n];
+
+	inst->pinned[n] = NULL;
+	return p;
+}
+
+/*
+ * The frame of camera n - in the writer's pages if it is pinned, in the
+ * camera's buffer otherwise. Under inst->lock.
+ */
+static inline char *cam_frame(struct cam_instance *inst, int n) {
+
+	return inst->pinned[n] ? inst->pinned[n]->frame : camera(inst, n);
+}
+
+/*
+ * The NUMA node of that frame. Under inst->lock.
+ */
+static inline int frame_node(struct cam_instance *inst, int n) {
+
+	return inst->pinned[n] ? inst->pinned[n]->node : inst->cam_node[n];
+}
+
+/*
+ * A copy in or out of camera n by this CPU, counted if the frame is on
+ * another node. Under inst->lock, so we stay on the CPU.
+ */
+static inline void count_copy(struct cam_instance *inst, int n, int node) {
+
+	if (node != NUMA_NO_NODE && node != numa_node_id())
+		inst->cross_node[n]++;
+}
+
+static struct cam_instance *create_instance(int id, int n_cams, size_t len) {
+
+	struct cam_instance *inst;
+	int i;
+
+	if (n_cams < 1 || n_cams > CAM_NUM || len < sizeof(struct frame_times) || len > CAM_LEN)
+		return ERR_PTR(-EINVAL);
+
+	inst = kzalloc(sizeof(*inst), GFP_KERNEL);
+	if (!inst)
+		return ERR_PTR(-ENOMEM);
+
+	inst->id = id;
+	inst->cams = n_cams;
+	inst->cam_len = len;
+	inst->cur_cam = n_cams > 1 ? 1 : 0;
+	inst->cam_ptr = camera(inst, inst->cur_cam);
+	init_waitqueue_head(&inst->packet_wait);
+	init_waitqueue_head(&inst->consumed_wait);
+	init_waitqueue_head(&inst->frame_wait);
+	init_waitqueue_head(&inst->release_wait);
+	for (i = 0; i < CAM_NUM; i++)
+		mutex_init(&inst->cam_mutex[i]);
+	mutex_init(&inst->roi_mutex);
+	init_rwsem(&inst->buf_sem);
+	spin_lock_init(&inst->lock);
+
+	printk(KERN_INFO "instance %d: %d cameras of %zu bytes\n", id, n_cams, len);
+	if (id)
+		printk(KERN_INFO "mknod %s%d c %d %d; mknod %s%d c %d %d\n", DEVICE_FILE_NAME_W, id, WRITE_MAJOR_NUM, id,
+				DEVICE_FILE_NAME_R, id, READ_MAJOR_NUM, id);
+	return inst;
+}
+
+static void destroy_instance(struct cam_instance *inst) {
+
+	int i;
+
+	for (i = 0; i < CAM_NUM; i++)
+		kvfree(inst->cam_buf[i]);
+	kfree(inst);
+}
+
+/*
+ * Find the instance of the minor and count the open, under instances_lock
+ */
+static struct cam_instance *get_instance(struct inode *inode, int writer) {
+
+	unsigned int minor = iminor(inode);
+	struct cam_instance *inst;
+	int *opened;
+
+	if (minor >= MAX_INSTANCES)
+		return ERR_PTR(-ENODEV);
+
+	mutex_lock(&instances_lock);
+	inst = instance[minor];
+	if (!inst) {
+		mutex_unlock(&instances_lock);
+		return ERR_PTR(-ENODEV);
+	}
+	// We don't want to talk to two processes at the same time
+	opened = writer ? &inst->writer_open : &inst->reader_open;
+	if (*opened) {
+		mutex_unlock(&instances_lock);
+		return ERR_PTR(-EBUSY);
+	}
+	(*opened)++;
+	mutex_unlock(&instances_lock);
+	return inst;
+}
+
+static void put_instance(struct cam_instance *inst, int writer) {
+
+	mutex_lock(&instances_lock);
+	if (writer)
+		inst->writer_open--;
+	else
+		inst->reader_open--;
+	mutex_unlock(&instances_lock);
+}
+
+/*
+ * ============================ write device ============================
+ */
+
+/*
+ * This is called whenever a process attempts to open the device file
+ */
+static int write_open(struct inode *inode, struct file *file) {
+
+	struct cam_instance *inst;
+
+#ifdef DEBUG
+	printk(KERN_INFO "write_open(%p)\n", file);
+#endif
+
+	// the control node has no instance
+	if (iminor(inode) == CTL_MINOR) {
+		file->private_data = NULL;
+		try_module_get(THIS_MODULE);
+		return SUCCESS;
+	}
+
+	inst = get_instance(inode, 1);
+	if (IS_ERR(inst))
+		return PTR_ERR(inst);
+
+	file->private_data = inst;
+	inst->write_user = 1;
+	// the buffers pinned by the last writer aren't given back to this one
+	spin_lock(&inst->lock);
+	inst->writer_gen++;
+	inst->rel_head = inst->rel_tail = 0;
+	inst->pinned_out = 0;
+	spin_unlock(&inst->lock);
+	// Initialize the cameras
+	inst->cam_ptr = camera(inst, inst->cur_cam);
+	try_module_get(THIS_MODULE);
+	return SUCCESS;
+}
+
+static int write_release(struct inode *inode, struct file *file) {
+
+	int i;
+	struct pinned_buf *pinned[CAM_NUM];
+	struct cam_instance *inst = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "write_release(%p,%p)\n", inode, file);
+#endif
+
+	if (inst) {
+		// We're now ready for our next caller
+		inst->write_user = 0;
+		inst->cur_cam = inst->cams > 1 ? 1 : 0;
+		inst->motion_cams = 0;
+		inst->offline_cams = 0;
+		spin_lock(&inst->lock);
+		inst->reclaimed_cams = 0;
+		for (i = 0; i < CAM_NUM; i++) {
+			inst->written_to_cam[i] = 0;
+			inst->gop[i].len = 0;
+			inst->gop[i].gen++;
+			inst->gop[i].need_key = 0;
+			inst->gop[i].has_codec = 0;
+			inst->policy[i] = POLICY_OVERWRITE;
+			inst->pending[i] = 0;
+			inst->frames_written[i] = inst->frames_read[i] = inst->frames_dropped[i] = 0;
+			inst->reclaimed_bytes[i] = inst->reallocs[i] = 0;
+			inst->frames_pinned[i] = inst->bytes_copied[i] = 0;
+			inst->cross_node[i] = 0;
+			pinned[i] = take_pinned(inst, i);
+		}
+		spin_unlock(&inst->lock);
+		// the writer's pages are let go, reads in progress keep theirs
+		for (i = 0; i < CAM_NUM; i++)
+			put_pinned(inst, pinned[i]);
+		wake_up_interruptible(&inst->packet_wait);
+		put_instance(inst, 1);
+	}
+	module_put(THIS_MODULE);
+	return SUCCESS;
+}
+
+/*
+ * Backpressure - wait until the frame in camera n was read, or decide to
+ * overwrite it. Called with inst->lock held and returns with it held,
+ * unless it fails. POLICY_BLOCK only waits while there is a reader to wait for.
+ */
+static int wait_consumed(struct cam_instance *inst, int n) {
+
+	while (inst->pending[n]) {
+		if (inst->policy[n] == POLICY_DROP) {
+			inst->frames_dropped[n]++;
+			spin_unlock(&inst->lock);
+			return -EAGAIN;
+		}
+		if (inst->policy[n] != POLICY_BLOCK || !inst->reader_open) {
+			inst->frames_dropped[n]++;
+			break;
+		}
+		spin_unlock(&inst->lock);
+		if (wait_event_interruptible(inst->consumed_wait,
+				!inst->pending[n] || !inst->reader_open))
+			return -ERESTARTSYS;
+		spin_lock(&inst->lock);
+	}
+	return SUCCESS;
+}
+
+/*
+ * Camera n has a new frame of size bytes (serialized), under inst->lock
+ */
+static void frame_stored(struct cam_instance *inst, int n, size_t size) {
+
+	inst->size_of_buf[n] = size;
+	inst->pending[n] = 1;
+	inst->frames_written[n]++;
+	inst->frame_seq[n]++;
+	inst->written_to_cam[n] = 1;
+	inst->last_access[n] = jiffies;
+}
+
+/*
+ * This function is called when somebody tries to
+ * write into our device file.
+ */
+static ssize_t device_write(struct file *file, const char __user *buffer, size_t length, loff_t *offset) {
+
+	int cam_number;
+	ssize_t ret;
+	size_t len;
+	u64 now;
+	char *cam;
+	struct pinned_buf *old = NULL;
+	struct cam_instance *inst = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "device_write(%p,%s,%lu)", file, buffer, length);
+#endif
+	if (!inst)
+		return -EINVAL;
+	// a raw write() has no IOCTL_WRITE to check that the tape is there
+	if (length < sizeof(int))
+		return -EINVAL;
+
+	if (get_user(cam_number, (int __user *)buffer))
+		return -EFAULT;
+	if (cam_number < 0 || cam_number >= inst->cams)
+		return -EINVAL;
+	if (test_bit(cam_number, &inst->offline_cams))
+		return -ENODEV;
+
+	down_read(&inst->buf_sem);
+	if (!camera_alloc(inst, cam_number)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	// the frame in the camera wasn't read yet
+	spin_lock(&inst->lock);
+	ret = wait_consumed(inst, cam_number);
+	if (ret)
+		goto out;
+	// the source may have gone while we waited
+	if (test_bit(cam_number, &inst->offline_cams)) {
+		spin_unlock(&inst->lock);
+		ret = -ENODEV;
+		goto out;
+	}
+
+	// a pinned frame is replaced by a copied one
+	old = take_pinned(inst, cam_number);
+	inst->writing[cam_number]++;
+	spin_unlock(&inst->lock);
+
+	/*
+	 * copy without the lock (it may fault), a read of the old frame
+	 * that is already copying out finishes first
+	 */
+	mutex_lock(&inst->cam_mutex[cam_number]);
+	cam = camera(inst, cam_number);
+	len = min(length - sizeof(int), inst->cam_len);
+	ret = copy_from_user(cam, buffer + sizeof(int), len) ? -EFAULT : len;
+
+	spin_lock(&inst->lock);
+	inst->writing[cam_number]--;
+	// or offline since we checked, then the old source's frame stays out too
+	if (ret >= 0 && test_bit(cam_number, &inst->offline_cams))
+		ret = -ENODEV;
+	if (ret < 0) {
+		// half a frame is no frame
+		inst->written_to_cam[cam_number] = 0;
+		inst->pending[cam_number] = 0;
+	} else {
+		// the frame is in its camera now, stamp it for the latency stats
+		now = ktime_get_ns();
+		memcpy(cam + offsetof(struct frame_times, enqueue_ns), &now, sizeof(now));
+		// the size of what the camera holds, if the frame was cut to cam_len
+		frame_stored(inst, cam_number, sizeof(size_t) + sizeof(int) + len);
+		inst->bytes_copied[cam_number] += len;
+		count_copy(inst, cam_number, inst->cam_node[cam_number]);
+	}
+	spin_unlock(&inst->lock);
+	mutex_unlock(&inst->cam_mutex[cam_number]);
+	wake_up_interruptible(&inst->frame_wait);
+out:
+	up_read(&inst->buf_sem);
+	put_pinned(inst, old);
+	return ret;
+}
+
+/*
+ * IOCTL_WRITE_PINNED - see struct pinned_frame. The frame stays in the
+ * writer's pages, returns its size.
+ */
+static long write_pinned(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct pinned_frame req;
+	struct pinned_buf *p, *old;
+	size_t size, len;
+	int tape;
+	long ret;
+
+	if (copy_from_user(&req, (void __user *)ioctl_param, sizeof(req)))
+		return -EFAULT;
+	if (get_user(size, (size_t __user *)(unsigned long)req.buf) ||
+			get_user(tape, (int __user *)(unsigned long)(req.buf + sizeof(size_t))))
+		return -EFAULT;
+	if (size < sizeof(size_t) + sizeof(int) + sizeof(struct frame_times) ||
+			size - sizeof(size_t) - sizeof(int) > inst->cam_len)
+		return -EINVAL;
+	if (tape < 0 || tape >= inst->cams)
+		return -EINVAL;
+	if (test_bit(tape, &inst->offline_cams))
+		return -ENODEV;
+
+	// the ring of released buffers has room for every one that is out
+	spin_lock(&inst->lock);
+	if (inst->pinned_out >= PIN_OUTSTANDING) {
+		spin_unlock(&inst->lock);
+		return -ENOBUFS;
+	}
+	inst->pinned_out++;
+	spin_unlock(&inst->lock);
+
+	p = pin_frame(req.buf, size);
+	if (IS_ERR(p)) {
+		ret = PTR_ERR(p);
+		goto fail;
+	}
+	p->cookie = req.cookie;
+	p->writer_gen = inst->writer_gen;
+	len = p->len;
+
+	spin_lock(&inst->lock);
+	ret = wait_consumed(inst, tape);
+	// the source may have gone while we pinned or waited
+	if (!ret && test_bit(tape, &inst->offline_cams)) {
+		spin_unlock(&inst->lock);
+		ret = -ENODEV;
+	}
+	if (ret) {
+		// refused, the writer still has the buffer
+		free_pinned(p);
+		goto fail;
+	}
+	old = take_pinned(inst, tape);
+	inst->pinned[tape] = p;
+	p->times.enqueue_ns = ktime_get_ns();
+	frame_stored(inst, tape, size);
+	inst->frames_pinned[tape]++;
+	spin_unlock(&inst->lock);
+	wake_up_interruptible(&inst->frame_wait);
+	put_pinned(inst, old);
+	return len;
+
+fail:
+	spin_lock(&inst->lock);
+	inst->pinned_out--;
+	spin_unlock(&inst->lock);
+	return ret;
+}
+
+/*
+ * IOCTL_GET_RELEASED - see struct pinned_release, returns the count
+ */
+static long get_released(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct pinned_release rel;
+	u32 max;
+	long ret;
+
+	if (copy_from_user(&rel, (void __user *)ioctl_param, offsetof(struct pinned_release, cookies)))
+		return -EFAULT;
+	max = min_t(u32, rel.count, PIN_RELEASE_MAX);
+	ret = wait_event_interruptible_timeout(inst->release_wait, inst->rel_head != inst->rel_tail,
+			msecs_to_jiffies(rel.timeout_ms));
+	if (ret < 0)
+		return ret;
+
+	rel.count = 0;
+	spin_lock(&inst->lock);
+	while (rel.count < max && inst->rel_tail != inst->rel_head)
+		rel.cookies[rel.count++] = inst->released[inst->rel_tail++ % PIN_OUTSTANDING];
+	inst->pinned_out -= rel.count;
+	spin_unlock(&inst->lock);
+
+	if (copy_to_user((void __user *)ioctl_param, &rel,
+			offsetof(struct pinned_release, cookies) + rel.count * sizeof(u64)))
+		return -EFAULT;
+	return rel.count;
+}
+
+/*
+ * IOCTL_WRITE_PACKET - append one packet ([packet_header][payload]) to the
+ * GOP of its camera. A keyframe starts the GOP over. Returns the bytes
+ * taken, or 0 when the packet was dropped because the GOP doesn't fit
+ * in the camera (then everything is dropped until the next keyframe).
+ */
+static long write_packet(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct packet_header hdr;
+	struct gop_log *g;
+	size_t total;
+	char *dst;
+	u32 gen;
+	long ret;
+
+	if (copy_from_user(&hdr, (void __user *)ioctl_param, sizeof(hdr)))
+		return -EFAULT;
+	if (hdr.tape < 0 || hdr.tape >= inst->cams)
+		return -EINVAL;
+	if (test_bit(hdr.tape, &inst->offline_cams))
+		return -ENODEV;
+	total = sizeof(hdr) + hdr.size;
+	g = &inst->gop[hdr.tape];
+
+	down_read(&inst->buf_sem);
+	if (!camera_alloc(inst, hdr.tape)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	spin_lock(&inst->lock);
+	if (hdr.flags & PACKET_KEY) {
+		// readers copying the old GOP will see gen change and retry
+		g->len = 0;
+		g->gen++;
+		g->need_key = 0;
+	}
+	// the log we append to, cam_offline starts it over
+	gen = g->gen;
+	spin_unlock(&inst->lock);
+	if (!(hdr.flags & PACKET_KEY) && g->need_key) {
+		ret = 0;
+		goto out;
+	}
+
+	if (total > inst->cam_len - g->len) {
+		g->need_key = 1;
+		ret = 0;
+		goto out;
+	}
+
+	/*
+	 * only this writer appends, and readers never look past g->len,
+	 * so the copy from user doesn't have to hold the spinlock
+	 */
+	dst = camera(inst, hdr.tape) + g->len;
+	if (copy_from_user(dst + sizeof(hdr), (char __user *)ioctl_param + sizeof(hdr), hdr.size)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	hdr.seq = g->last_seq + 1;
+	hdr.times.enqueue_ns = ktime_get_ns();
+	memcpy(dst, &hdr, sizeof(hdr));
+
+	spin_lock(&inst->lock);
+	// the source went while we copied, the packet is in a log that is gone
+	if (test_bit(hdr.tape, &inst->offline_cams) || g->gen != gen) {
+		spin_unlock(&inst->lock);
+		ret = -ENODEV;
+		goto out;
+	}
+	g->len += total;
+	g->last_seq = hdr.seq;
+	if (hdr.flags & PACKET_KEY)
+		g->first_seq = hdr.seq;
+	inst->written_to_cam[hdr.tape] = 1;
+	inst->last_access[hdr.tape] = jiffies;
+	count_copy(inst, hdr.tape, inst->cam_node[hdr.tape]);
+	spin_unlock(&inst->lock);
+
+	wake_up_interruptible(&inst->packet_wait);
+	ret = total;
+out:
+	up_read(&inst->buf_sem);
+	return ret;
+}
+
+static long set_codec(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct codec_params *codec;
+	int tape;
+
+	if (get_user(tape, (int __user *)ioctl_param))
+		return -EFAULT;
+	if (tape < 0 || tape >= inst->cams)
+		return -EINVAL;
+	if (test_bit(tape, &inst->offline_cams))
+		return -ENODEV;
+	codec = &inst->gop[tape].codec;
+
+	spin_lock(&inst->lock);
+	inst->gop[tape].has_codec = 0;
+	spin_unlock(&inst->lock);
+	if (copy_from_user(codec, (void __user *)ioctl_param, sizeof(*codec)))
+		return -EFAULT;
+	if (codec->extradata_size > CODEC_EXTRADATA_MAX)
+		return -EINVAL;
+	spin_lock(&inst->lock);
+	inst->gop[tape].has_codec = 1;
+	spin_unlock(&inst->lock);
+	return SUCCESS;
+}
+
+/*
+ * IOCTL_CAM_OFFLINE - forget everything of the camera, so a new source
+ * starts clean and the reader doesn't show a frame of the old one
+ */
+static long cam_offline(struct cam_instance *inst, int tape) {
+
+	struct pinned_buf *old;
+
+	if (tape < 0 || tape >= inst->cams)
+		return -EINVAL;
+
+	spin_lock(&inst->lock);
+	set_bit(tape, &inst->offline_cams);
+	clear_bit(tape, &inst->motion_cams);
+	inst->written_to_cam[tape] = 0;
+	inst->pending[tape] = 0;
+	inst->gop[tape].len = 0;
+	inst->gop[tape].gen++;
+	inst->gop[tape].need_key = 0;
+	inst->gop[tape].has_codec = 0;
+	old = take_pinned(inst, tape);
+	spin_unlock(&inst->lock);
+	put_pinned(inst, old);
+
+	// nothing is coming for a blocked writer or a waiting reader
+	wake_up_interruptible(&inst->consumed_wait);
+	wake_up_interruptible(&inst->packet_wait);
+	return SUCCESS;
+}
+
+static long set_policy(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct cam_policy p;
+
+	if (copy_from_user(&p, (void __user *)ioctl_param, sizeof(p)))
+		return -EFAULT;
+	if (p.tape < 0 || p.tape >= inst->cams || p.policy > POLICY_DROP)
+		return -EINVAL;
+	spin_lock(&inst->lock);
+	inst->policy[p.tape] = p.policy;
+	spin_unlock(&inst->lock);
+	// a writer blocked under the old policy must look again
+	wake_up_interruptible(&inst->consumed_wait);
+	return SUCCESS;
+}
+
+static long get_cam_stats(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct cam_stats st;
+	int tape;
+
+	if (get_user(tape, (int __user *)ioctl_param))
+		return -EFAULT;
+	if (tape < 0 || tape >= inst->cams)
+		return -EINVAL;
+
+	memset(&st, 0, sizeof(st));
+	st.tape = tape;
+	spin_lock(&inst->lock);
+	st.policy = inst->policy[tape];
+	st.pending = inst->pending[tape];
+	st.written = inst->frames_written[tape];
+	st.read = inst->frames_read[tape];
+	st.dropped = inst->frames_dropped[tape];
+	st.resident = camera(inst, tape) != NULL;
+	st.reclaimed = inst->reclaimed_bytes[tape];
+	st.reallocs = inst->reallocs[tape];
+	st.pinned = inst->frames_pinned[tape];
+	st.copied = inst->bytes_copied[tape];
+	st.node = st.resident ? inst->cam_node[tape] : -1;
+	st.contiguous = st.resident && !is_vmalloc_addr(camera(inst, tape));
+	st.cross_node = inst->cross_node[tape];
+	spin_unlock(&inst->lock);
+
+	if (copy_to_user((void __user *)ioctl_param, &st, sizeof(st)))
+		return -EFAULT;
+	return SUCCESS;
+}
+
+/*
+ * The ioctls of the control node
+ */
+static long control_ioctl(unsigned int ioctl_num, unsigned long ioctl_param) {
+
+	int i;
+	long ret;
+	struct instance_params params;
+	struct cam_instance *inst;
+
+	switch (ioctl_num) {
+
+		case IOCTL_CREATE_INSTANCE:
+			if (copy_from_user(&params, (void __user *)ioctl_param, sizeof(params)))
+				return -EFAULT;
+			mutex_lock(&instances_lock);
+			for (i = 0; i < MAX_INSTANCES && instance[i]; i++);
+			if (i == MAX_INSTANCES) {
+				mutex_unlock(&instances_lock);
+				return -ENOSPC;
+			}
+			inst = create_instance(i, params.cams, params.cam_len);
+			if (IS_ERR(inst)) {
+				mutex_unlock(&instances_lock);
+				return PTR_ERR(inst);
+			}
+			instance[i] = inst;
+			mutex_unlock(&instances_lock);
+			params.id = i;
+			if (copy_to_user((void __user *)ioctl_param, &params, sizeof(params)))
+				return -EFAULT;
+			return i;
+
+		case IOCTL_DESTROY_INSTANCE:
+			if (ioctl_param >= MAX_INSTANCES)
+				return -EINVAL;
+			mutex_lock(&instances_lock);
+			inst = instance[ioctl_param];
+			if (!inst)
+				ret = -ENODEV;
+			else if (inst->writer_open || inst->reader_open || inst->streams)
+				ret = -EBUSY;
+			else {
+				instance[ioctl_param] = NULL;
+				destroy_instance(inst);
+				ret = SUCCESS;
+			}
+			mutex_unlock(&instances_lock);
+			return ret;
+
+		case IOCTL_GET_INSTANCES:
+			ret = 0;
+			mutex_lock(&instances_lock);
+			for (i = 0; i < MAX_INSTANCES; i++)
+				if (instance[i])
+					ret |= 1 << i;
+			mutex_unlock(&instances_lock);
+			return ret;
+	}
+	return -ENOTTY;
+}
+
+/*
+ * This function is called whenever a process tries to do an ioctl on our
+ * device file. We get two extra parameters (additional to the inode and file
+ * structures, which all device functions get): the number of the ioctl called
+ * and the parameter given to the ioctl function.
+ *
+ * If the ioctl is write or read/write (meaning output is returned to the
+ * calling process), the ioctl call returns the output of this function.
+ *
+ */
+static long write_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
+
+	size_t size;
+	struct cam_instance *inst = file->private_data;
+
+	if (!inst)
+		return control_ioctl(ioctl_num, ioctl_param);
+
+	// Switch according to the ioctl called
+	switch (ioctl_num) {
+
+		case IOCTL_WRITE:
+			/*
+			 * Receive a pointer to a frame data buf (in user space)
+			 * and set that to be the device's frame.
+			 * Get the parameter given to ioctl by the process.
+			 */
+
+			// Find the length of the camera
+			if (get_user(size, (size_t __user *)ioctl_param))
+				return -EFAULT;
+			if (size < sizeof(size_t) + sizeof(int))
+				return -EINVAL;
+			return device_write(file,(char *) (ioctl_param+sizeof(size_t)),size-sizeof(size_t),0);
+
+		case IOCTL_SET_MOTION:
+			if (ioctl_param >= inst->cams)
+				return -EINVAL;
+			set_bit(ioctl_param, &inst->motion_cams);
+			break;
+
+		case IOCTL_CLEAR_MOTION:
+			if (ioctl_param >= inst->cams)
+				return -EINVAL;
+			clear_bit(ioctl_param, &inst->motion_cams);
+			break;
+
+		case IOCTL_SET_CODEC:
+			return set_codec(inst, ioctl_param);
+
+		case IOCTL_WRITE_PACKET:
+			return write_packet(inst, ioctl_param);
+
+		case IOCTL_SET_POLICY:
+			return set_policy(inst, ioctl_param);
+
+		case IOCTL_GET_CAM_STATS:
+			return get_cam_stats(inst, ioctl_param);
+
+		case IOCTL_CAM_ONLINE:
+			if (ioctl_param >= inst->cams)
+				return -EINVAL;
+			clear_bit(ioctl_param, &inst->offline_cams);
+			break;
+
+		case IOCTL_CAM_OFFLINE:
+			if (ioctl_param >= inst->cams)
+				return -EINVAL;
+			return cam_offline(inst, ioctl_param);
+
+		case IOCTL_WRITE_PINNED:
+			return write_pinned(inst, ioctl_param);
+
+		case IOCTL_GET_RELEASED:
+			return get_released(inst, ioctl_param);
+	}
+
+	return SUCCESS;
+}
+
+/*
+ * read() of either instance node - the serialized frame of the current
+ * camera as the module keeps it, from *offset to its end (then EOF), for
+ * checking with cat. It doesn't consume the frame. A pinned frame has
+ * the times the writer gave it.
+ */
+static ssize_t cat_frame(struct file *file, char __user *buffer, size_t length, loff_t *offset) {
+
+	size_t len;
+	ssize_t ret = 0;
+	char *frame;
+	int cam;
+	struct pinned_buf *p;
+	struct cam_instance *inst = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "cat_frame(%p,%p,%lu,%lld)\n", file, buffer, length, *offset);
+#endif
+	if (!inst)
+		return 0;
+	if (*offset < 0)
+		return -EINVAL;
+
+	cam = READ_ONCE(inst->cur_cam);
+	down_read(&inst->buf_sem);
+	if (mutex_lock_interruptible(&inst->cam_mutex[cam])) {
+		up_read(&inst->buf_sem);
+		return -ERESTARTSYS;
+	}
+	if (!inst->written_to_cam[cam])
+		goto out;
+
+	// the camera holds the frame without its size and tape
+	len = min(inst->size_of_buf[cam] - sizeof(size_t) - sizeof(int), inst->cam_len);
+	if (*offset >= len)
+		goto out;
+	length = min(length, len - (size_t)*offset);
+
+	spin_lock(&inst->lock);
+	p = get_pinned(inst, cam);
+	frame = p ? p->frame : camera(inst, cam);
+	spin_unlock(&inst->lock);
+	if (frame && copy_to_user(buffer, frame + *offset, length))
+		ret = -EFAULT;
+	else if (frame) {
+		inst->last_access[cam] = jiffies;
+		*offset += length;
+		ret = length;
+	}
+	put_pinned(inst, p);
+out:
+	mutex_unlock(&inst->cam_mutex[cam]);
+	up_read(&inst->buf_sem);
+	return ret;
+}
+
+/*
+ * ============================ stream device ============================
+ */
+
+/*
+ * Where the overlay fields are in a camera - the serialized frame without
+ * its size and tape: [frame_times][format][w][h][planes][pitches x3][pixels]
+ */
+#define FRAME_W_OFF (sizeof(struct frame_times) + sizeof(u32))
+#define FRAME_H_OFF (FRAME_W_OFF + sizeof(int))
+#define FRAME_PITCHES_OFF (FRAME_H_OFF + 2 * sizeof(int))
+#define FRAME_PIXELS_OFF (FRAME_PITCHES_OFF + 3 * sizeof(u16))
+
+/*
+ * The size, pitches and plane offsets of the frame in a camera, -EIO if
+ * it isn't a YV12 frame that fits in len. The frame is YV12 - Y in w*h
+ * bytes, then V and U in (h+1)/2 rows of their own pitches (see camclient.h).
+ */
+static int frame_geometry(const char *frame, size_t len, int *w, int *h, u16 pitches[3], size_t off[3]) {
+
+	int cw, ch;
+
+	if (len < FRAME_PIXELS_OFF)
+		return -EIO;
+	memcpy(w, frame + FRAME_W_OFF, sizeof(int));
+	memcpy(h, frame + FRAME_H_OFF, sizeof(int));
+	memcpy(pitches, frame + FRAME_PITCHES_OFF, 3 * sizeof(u16));
+	cw = (*w + 1) / 2;
+	ch = (*h + 1) / 2;
+
+	if (*w <= 0 || *h <= 0 || pitches[0] != *w || pitches[1] < cw || pitches[2] < cw)
+		return -EIO;
+	off[0] = FRAME_PIXELS_OFF;
+	off[1] = off[0] + (size_t)*w * *h;
+	off[2] = off[1] + (size_t)pitches[1] * ch;
+	if (off[2] + (size_t)pitches[2] * ch > len)
+		return -EIO;
+	return SUCCESS;
+}
+
+/*
+ * What a region of interest takes of a w x h frame - clipped to the
+ * frame, from an even corner, ow x oh after the scale
+ */
+struct roi_rect {
+	int x, y, scale;
+	int ow, oh;
+};
+
+static void roi_rect(const struct cam_roi *roi, int w, int h, struct roi_rect *r) {
+
+	int rw = w, rh = h;
+
+	r->x = r->y = 0;
+	r->scale = roi->scale > 1 ? roi->scale : 1;
+	if (roi->w > 0 && roi->h > 0) {
+		r->x = min(roi->x, w - 1) & ~1;
+		r->y = min(roi->y, h - 1) & ~1;
+		rw = min(roi->w, w - r->x);
+		rh = min(roi->h, h - r->y);
+	}
+	r->ow = max(rw / r->scale, 1);
+	r->oh = max(rh / r->scale, 1);
+}
+
+static int roi_valid(const struct cam_roi *roi) {
+
+	return roi->x >= 0 && roi->y >= 0 && roi->w >= 0 && roi->h >= 0 && roi->scale <= ROI_MAX_SCALE;
+}
+
+/*
+ * w x h pixels of a plane, every scale-th of src's rows and columns
+ */
+static void copy_plane(char *dst, size_t dst_pitch, const char *src, size_t src_pitch, int w, int h, int scale) {
+
+	int row, col;
+
+	for (row = 0; row < h; row++, dst += dst_pitch, src += src_pitch * scale) {
+		if (scale == 1)
+			memcpy(dst, src, w);
+		else
+			for (col = 0; col < w; col++)
+				dst[col] = src[col * scale];
+	}
+}
+
+/*
+ * Copy the newest frame of the camera to buf as a YUV4MPEG2 frame (after
+ * the stream header if this is the first one), under the camera's mutex.
+ * Only the region of interest of the stream is copied.
+ *
+ * YUV4MPEG2 wants I420, so U goes before V and the pitch padding is left out.
+ */
+static ssize_t stream_fill(struct cam_stream *s, char *frame, size_t len) {
+
+	int w, h, cw, ch;
+	u16 pitches[3];
+	size_t off[3], y_off, v_off, u_off;
+	struct roi_rect r;
+	char *p;
+
+	if (frame_geometry(frame, len, &w, &h, pitches, off))
+		return -EIO;
+	roi_rect(&s->roi, w, h, &r);
+	cw = (r.ow + 1) / 2;
+	ch = (r.oh + 1) / 2;
+
+	y_off = off[0] + (size_t)r.y * pitches[0] + r.x;
+	v_off = off[1] + (size_t)(r.y / 2) * pitches[1] + r.x / 2;
+	u_off = off[2] + (size_t)(r.y / 2) * pitches[2] + r.x / 2;
+
+	// YUV4MPEG2 can't change the size in the middle, that's the end
+	if (s->w && (s->w != r.ow || s->h != r.oh))
+		return 0;
+
+	p = s->buf;
+	// the module doesn't know the frame rate of the video, F0:0 says so
+	if (!s->w) {
+		p += snprintf(p, Y4M_HEADER_MAX, "YUV4MPEG2 W%d H%d F0:0 Ip A1:1 C420jpeg\n", r.ow, r.oh);
+		s->w = r.ow;
+		s->h = r.oh;
+	}
+	memcpy(p, "FRAME\n", 6);
+	p += 6;
+	copy_plane(p, r.ow, frame + y_off, pitches[0], r.ow, r.oh, r.scale);
+	p += (size_t)r.ow * r.oh;
+	copy_plane(p, cw, frame + u_off, pitches[2], cw, ch, r.scale);
+	p += (size_t)cw * ch;
+	copy_plane(p, cw, frame + v_off, pitches[1], cw, ch, r.scale);
+	p += (size_t)cw * ch;
+
+	s->pos = 0;
+	s->len = p - s->buf;
+	return s->len;
+}
+
+/*
+ * Wait for a frame the stream didn't send yet and put it in buf. The copy
+ * runs without the lock, like read_frame's: the camera's mutex keeps the
+ * writer out and buf_sem the shrinker, a pinned frame is referenced.
+ */
+static ssize_t stream_next(struct cam_stream *s, int nonblock) {
+
+	struct cam_instance *inst = s->inst;
+	struct pinned_buf *p;
+	char *frame;
+	size_t len;
+	int node;
+	ssize_t ret;
+
+	for (;;) {
+		down_read(&inst->buf_sem);
+		if (mutex_lock_interruptible(&inst->cam_mutex[s->cam])) {
+			up_read(&inst->buf_sem);
+			return -ERESTARTSYS;
+		}
+		spin_lock(&inst->lock);
+		if (inst->written_to_cam[s->cam] && inst->frame_seq[s->cam] != s->seq &&
+				!inst->writing[s->cam])
+			break;
+		spin_unlock(&inst->lock);
+		mutex_unlock(&inst->cam_mutex[s->cam]);
+		up_read(&inst->buf_sem);
+		if (nonblock)
+			return -EAGAIN;
+		if (wait_event_interruptible(inst->frame_wait,
+				inst->written_to_cam[s->cam] && inst->frame_seq[s->cam] != s->seq &&
+				!inst->writing[s->cam]))
+			return -ERESTARTSYS;
+	}
+
+	s->seq = inst->frame_seq[s->cam];
+	inst->last_access[s->cam] = jiffies;
+	len = min(inst->size_of_buf[s->cam] - sizeof(size_t) - sizeof(int), inst->cam_len);
+	p = get_pinned(inst, s->cam);
+	frame = p ? p->frame : camera(inst, s->cam);
+	node = frame_node(inst, s->cam);
+	spin_unlock(&inst->lock);
+
+	ret = stream_fill(s, frame, len);
+	put_pinned(inst, p);
+
+	if (ret > 0) {
+		spin_lock(&inst->lock);
+		inst->bytes_copied[s->cam] += ret;
+		count_copy(inst, s->cam, node);
+		spin_unlock(&inst->lock);
+	}
+	mutex_unlock(&inst->cam_mutex[s->cam]);
+	up_read(&inst->buf_sem);
+	return ret;
+}
+
+/*
+ * read() of a stream - the rest of the header or frame in buf, so a read
+ * never spans two frames and a short buffer gets a short read
+ */
+static ssize_t stream_read_iter(struct kiocb *iocb, struct iov_iter *to) {
+
+	struct cam_stream *s = iocb->ki_filp->private_data;
+	size_t n;
+	ssize_t ret;
+
+	if (!iov_iter_count(to))
+		return 0;
+	if (s->pos == s->len) {
+		ret = stream_next(s, iocb->ki_filp->f_flags & O_NONBLOCK);
+		if (ret <= 0)
+			return ret;
+	}
+
+	n = copy_to_iter(s->buf + s->pos, s->len - s->pos, to);
+	if (!n)
+		return -EFAULT;
+	s->pos += n;
+	iocb->ki_pos += n;
+	return n;
+}
+
+/*
+ * IOCTL_SET_ROI on a stream - before its first frame, the header has the size
+ */
+static long stream_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
+
+	struct cam_stream *s = file->private_data;
+	struct cam_roi roi;
+
+	switch (ioctl_num) {
+
+		case IOCTL_SET_ROI:
+			if (copy_from_user(&roi, (void __user *)ioctl_param, sizeof(roi)))
+				return -EFAULT;
+			if (!roi_valid(&roi))
+				return -EINVAL;
+			if (s->w)
+				return -EBUSY;
+			s->roi = roi;
+			return SUCCESS;
+	}
+	return -ENOTTY;
+}
+
+static int stream_release(struct inode *inode, struct file *file) {
+
+	struct cam_stream *s = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "stream_release(%p,%p)\n", inode, file);
+#endif
+	mutex_lock(&instances_lock);
+	s->inst->streams--;
+	mutex_unlock(&instances_lock);
+	vfree(s->buf);
+	kfree(s);
+	module_put(THIS_MODULE);
+	return SUCCESS;
+}
+
+struct file_operations stream_fops = {
+
+	.read_iter = stream_read_iter,
+	.unlocked_ioctl = stream_ioctl,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read = copy_splice_read,
+#else
+	.splice_read = generic_file_splice_read,
+#endif
+	.release = stream_release,
+};
+
+/*
+ * Opened through the read major, the stream gets its own file operations
+ */
+static int stream_open(struct inode *inode, struct file *file) {
+
+	unsigned int n = iminor(inode) - STREAM_MINOR_BASE;
+	struct cam_instance *inst;
+	struct cam_stream *s;
+
+#ifdef DEBUG
+	printk(KERN_INFO "stream_open(%p)\n", file);
+#endif
+
+	if (n / CAM_NUM >= MAX_INSTANCES)
+		return -ENODEV;
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
+
+	mutex_lock(&instances_lock);
+	inst = instance[n / CAM_NUM];
+	if (!inst || n % CAM_NUM >= inst->cams) {
+		mutex_unlock(&instances_lock);
+		kfree(s);
+		return -ENODEV;
+	}
+	inst->streams++;
+	mutex_unlock(&instances_lock);
+
+	s->inst = inst;
+	s->cam = n % CAM_NUM;
+	s->buf = vmalloc(inst->cam_len + Y4M_HEADER_MAX);
+	if (!s->buf) {
+		mutex_lock(&instances_lock);
+		inst->streams--;
+		mutex_unlock(&instances_lock);
+		kfree(s);
+		return -ENOMEM;
+	}
+	// the frame that is already there is the first one we send
+	s->seq = inst->frame_seq[s->cam] - 1;
+
+	file->private_data = s;
+	replace_fops(file, &stream_fops);
+	try_module_get(THIS_MODULE);
+	return nonseekable_open(inode, file);
+}
+
+/*
+ * ============================ read device ============================
+ */
+
+static int read_open(struct inode *inode, struct file *file) {
+
+	struct cam_instance *inst;
+
+#ifdef DEBUG
+	printk(KERN_INFO "read_open(%p)\n", file);
+#endif
+
+	if (iminor(inode) >= STREAM_MINOR_BASE)
+		return stream_open(inode, file);
+
+	inst = get_instance(inode, 0);
+	if (IS_ERR(inst))
+		return PTR_ERR(inst);
+
+	file->private_data = inst;
+	// Initialize the message
+	inst->cam_ptr = camera(inst, inst->cur_cam);
+	try_module_get(THIS_MODULE);
+	return SUCCESS;
+}
+
+static int read_release(struct inode *inode, struct file *file) {
+
+	struct cam_instance *inst = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "read_release(%p,%p)\n", inode, file);
+#endif
+	// the region of interest was the reader's
+	inst->roi_on = 0;
+	mutex_lock(&inst->roi_mutex);
+	vfree(inst->roi_buf);
+	inst->roi_buf = NULL;
+	mutex_unlock(&inst->roi_mutex);
+	// We're now ready for our next caller
+	put_instance(inst, 0);
+	// nobody reads any more, blocked writers go back to overwriting
+	wake_up_interruptible(&inst->consumed_wait);
+	module_put(THIS_MODULE);
+	return SUCCESS;
+}
+
+/*
+ * Crop the frame in a camera to the reader's region of interest roi, into
+ * roi_buf as an I420 sized frame of that size. Called without inst->lock,
+ * under the camera's mutex and buf_sem. Returns the size of the cropped
+ * frame, or 0 if the frame isn't one we can crop or the crop wouldn't fit
+ * in roi_buf.
+ */
+static size_t roi_crop(struct cam_instance *inst, const struct cam_roi *roi, const char *frame, size_t len,
+		struct roi_rect *r) {
+
+	int w, h, cw, ch;
+	u16 pitches[3], out_pitches[3];
+	size_t off[3], plane, chroma;
+	char *dst = inst->roi_buf;
+
+	if (frame_geometry(frame, len, &w, &h, pitches, off))
+		return 0;
+	roi_rect(roi, w, h, r);
+	cw = (r->ow + 1) / 2;
+	ch = (r->oh + 1) / 2;
+	plane = (size_t)r->ow * r->oh;
+	chroma = (size_t)cw * ch;
+	// roi_buf is cam_len bytes, never write past it whatever the frame says
+	if (FRAME_PIXELS_OFF + plane + 2 * chroma > inst->cam_len)
+		return 0;
+
+	// the times, format and planes as they are, the size and pitches of the crop
+	memcpy(dst, frame, FRAME_PITCHES_OFF);
+	memcpy(dst + FRAME_W_OFF, &r->ow, sizeof(int));
+	memcpy(dst + FRAME_H_OFF, &r->oh, sizeof(int));
+	out_pitches[0] = r->ow;
+	out_pitches[1] = out_pitches[2] = cw;
+	memcpy(dst + FRAME_PITCHES_OFF, out_pitches, sizeof(out_pitches));
+
+	copy_plane(dst + FRAME_PIXELS_OFF, r->ow,
+			frame + off[0] + (size_t)r->y * pitches[0] + r->x, pitches[0], r->ow, r->oh, r->scale);
+	copy_plane(dst + FRAME_PIXELS_OFF + plane, cw,
+			frame + off[1] + (size_t)(r->y / 2) * pitches[1] + r->x / 2, pitches[1], cw, ch, r->scale);
+	copy_plane(dst + FRAME_PIXELS_OFF + plane + chroma, cw,
+			frame + off[2] + (size_t)(r->y / 2) * pitches[2] + r->x / 2, pitches[2], cw, ch, r->scale);
+	return FRAME_PIXELS_OFF + plane + 2 * chroma;
+}
+
+/*
+ * IOCTL_SET_ROI on the read device
+ */
+static long set_roi(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct cam_roi roi;
+	char *buf;
+
+	if (copy_from_user(&roi, (void __user *)ioctl_param, sizeof(roi)))
+		return -EFAULT;
+	if (!roi_valid(&roi))
+		return -EINVAL;
+
+	if (!inst->roi_buf) {
+		buf = vmalloc(inst->cam_len);
+		if (!buf)
+			return -ENOMEM;
+		spin_lock(&inst->lock);
+		if (!inst->roi_buf) {
+			inst->roi_buf = buf;
+			buf = NULL;
+		}
+		spin_unlock(&inst->lock);
+		vfree(buf);
+	}
+
+	spin_lock(&inst->lock);
+	inst->roi = roi;
+	inst->roi_on = (roi.w && roi.h) || roi.scale > 1;
+	spin_unlock(&inst->lock);
+	return SUCCESS;
+}
+
+/*
+ * IOCTL_READ - copy the frame of the current camera to the reader,
+ * it is consumed. With a region of interest only the crop is copied.
+ * A pinned frame is copied from the writer's pages. The crop and the
+ * copies run without the lock, under the camera's mutex.
+ */
+static ssize_t read_frame(struct file *file, char __user *buffer, size_t length, loff_t *offset) {
+
+	int bytes_read = 0, cam;
+	u64 now;
+	size_t roi_size = 0, n = 0, len;
+	struct roi_rect r;
+	struct cam_roi roi;
+	int roi_on;
+	struct frame_times times;
+	struct pinned_buf *p;
+	char *frame;
+	struct cam_instance *inst = file->private_data;
+
+#ifdef DEBUG
+	printk(KERN_INFO "read_frame(%p,%p,%lu)\n", file, buffer, length);
+#endif
+
+	if (length > inst->cam_len)
+		length = inst->cam_len;
+
+	// the copy to the reader runs without the lock, the mutex keeps the writer out
+	cam = READ_ONCE(inst->cur_cam);
+	down_read(&inst->buf_sem);
+	if (mutex_lock_interruptible(&inst->cam_mutex[cam])) {
+		up_read(&inst->buf_sem);
+		return -ERESTARTSYS;
+	}
+
+	spin_lock(&inst->lock);
+	// the shrinker may have taken the frame since the reader waited for it
+	if (!inst->written_to_cam[cam]) {
+		spin_unlock(&inst->lock);
+		goto out;
+	}
+	p = get_pinned(inst, cam);
+	frame = inst->cam_ptr = cam_frame(inst, cam);
+	inst->last_access[cam] = jiffies;
+	// stamp the dequeue time, it goes to the reader with the frame
+	now = ktime_get_ns();
+	if (p) {
+		p->times.dequeue_ns = now;
+		times = p->times;
+	} else
+		memcpy(frame + offsetof(struct frame_times, dequeue_ns), &now, sizeof(now));
+	roi_on = inst->roi_on;
+	roi = inst->roi;
+	len = min(inst->size_of_buf[cam] - sizeof(size_t) - sizeof(int), inst->cam_len);
+	count_copy(inst, cam, frame_node(inst, cam));
+	// the frame is consumed, a blocked writer may go on
+	if (inst->pending[cam]) {
+		inst->pending[cam] = 0;
+		inst->frames_read[cam]++;
+		wake_up_interruptible(&inst->consumed_wait);
+	}
+	spin_unlock(&inst->lock);
+
+	/*
+	 * crop and copy without the lock. A pinned frame comes straight from
+	 * the writer's pages, the times are ours.
+	 */
+	if (roi_on) {
+		// roi_buf is the instance's, the readers of other cameras use it too
+		mutex_lock(&inst->roi_mutex);
+		if (inst->roi_buf)
+			roi_size = roi_crop(inst, &roi, frame, len, &r);
+		if (roi_size) {
+			if (p)
+				memcpy(inst->roi_buf, &times, sizeof(times));
+			if (copy_to_user(buffer, inst->roi_buf, roi_size))
+				bytes_read = -EFAULT;
+			else
+				bytes_read = roi_size;
+		}
+		mutex_unlock(&inst->roi_mutex);
+	}
+	if (!roi_size) {
+		if (p) {
+			length = min(length, p->len);
+			n = min(length, sizeof(times));
+		}
+		if (copy_to_user(buffer, &times, n) ||
+				copy_to_user(buffer + n, frame + n, length - n))
+			bytes_read = -EFAULT;
+		else
+			bytes_read = length;
+	}
+	if (bytes_read > 0) {
+		spin_lock(&inst->lock);
+		inst->bytes_copied[cam] += bytes_read;
+		spin_unlock(&inst->lock);
+	}
+	put_pinned(inst, p);
+
+#ifdef DEBUG
+	printk(KERN_INFO "Read %d bytes of camera %d\n", bytes_read, cam);
+#endif
+out:
+	mutex_unlock(&inst->cam_mutex[cam]);
+	up_read(&inst->buf_sem);
+	return bytes_read;
+}
+
+/*
+ * Is there a packet the reader doesn't have yet?
+ */
+static int packet_ready(struct gop_log *g, u32 from_seq) {
+
+	return g->len && (!from_seq || (s32)(g->last_seq - from_seq) >= 0);
+}
+
+/*
+ * IOCTL_READ_PACKETS - see struct packet_read. The GOP is copied without
+ * the spinlock (copy_to_user may sleep); if the writer started a new GOP
+ * meanwhile, gen tells us and we copy again from the new keyframe. buf_sem
+ * keeps the shrinker from freeing the GOP under the copy.
+ */
+static long read_packets(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct packet_read req;
+	struct packet_header hdr;
+	struct gop_log *g;
+	size_t len, off, end, n;
+	char __user *buf;
+	char *log;
+	u32 gen;
+	u64 now;
+	long ret;
+
+	if (copy_from_user(&req, (void __user *)ioctl_param, sizeof(req)))
+		return -EFAULT;
+	if (req.tape < 0 || req.tape >= inst->cams)
+		return -EINVAL;
+	g = &inst->gop[req.tape];
+	buf = (char __user *)(unsigned long)req.buf;
+
+	ret = wait_event_interruptible_timeout(inst->packet_wait, packet_ready(g, req.from_seq), msecs_to_jiffies(req.timeout_ms));
+	if (ret < 0)
+		return ret;
+	if (ret == 0)
+		return 0;
+
+	down_read(&inst->buf_sem);
+retry:
+	spin_lock(&inst->lock);
+	gen = g->gen;
+	len = g->len;
+	log = camera(inst, req.tape);
+	inst->last_access[req.tape] = jiffies;
+	spin_unlock(&inst->lock);
+
+	/*
+	 * skip the packets the reader already has - if from_seq isn't in
+	 * the GOP any more (or is 0) we start from the keyframe
+	 */
+	off = 0;
+	while (req.from_seq && off + sizeof(hdr) <= len) {
+		memcpy(&hdr, log + off, sizeof(hdr));
+		if ((s32)(hdr.seq - req.from_seq) >= 0)
+			break;
+		off += sizeof(hdr) + hdr.size;
+	}
+
+	// as many whole packets as the buffer takes
+	end = off;
+	while (end + sizeof(hdr) <= len) {
+		memcpy(&hdr, log + end, sizeof(hdr));
+		n = sizeof(hdr) + hdr.size;
+		if (n > len - end || end - off + n > req.buf_len)
+			break;
+		end += n;
+	}
+
+	if (end == off) {
+		if (g->gen != gen)
+			goto retry;
+		ret = off < len ? -EMSGSIZE : 0;
+		goto out;
+	}
+	if (copy_to_user(buf, log + off, end - off)) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	spin_lock(&inst->lock);
+	if (g->gen != gen) {
+		spin_unlock(&inst->lock);
+		goto retry;
+	}
+	count_copy(inst, req.tape, inst->cam_node[req.tape]);
+	spin_unlock(&inst->lock);
+	up_read(&inst->buf_sem);
+
+	// stamp the dequeue time in the reader's copy of every header
+	now = ktime_get_ns();
+	for (n = 0; n < end - off; n += sizeof(hdr) + hdr.size) {
+		if (copy_from_user(&hdr, buf + n, sizeof(hdr)))
+			return -EFAULT;
+		if (put_user(now, (u64 __user *)(buf + n + offsetof(struct packet_header, times.dequeue_ns))))
+			return -EFAULT;
+	}
+	return end - off;
+
+out:
+	up_read(&inst->buf_sem);
+	return ret;
+}
+
+static long get_codec(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	int tape;
+
+	if (get_user(tape, (int __user *)ioctl_param))
+		return -EFAULT;
+	if (tape < 0 || tape >= inst->cams)
+		return -EINVAL;
+	if (!inst->gop[tape].has_codec)
+		return -ENODATA;
+	if (copy_to_user((void __user *)ioctl_param, &inst->gop[tape].codec, sizeof(struct codec_params)))
+		return -EFAULT;
+	return SUCCESS;
+}
+
+static long get_status(struct cam_instance *inst, unsigned long ioctl_param) {
+
+	struct cam_status st;
+	int i;
+
+	memset(&st, 0, sizeof(st));
+	st.cams = inst->cams;
+	st.cur_cam = inst->cur_cam;
+	st.writer = inst->write_user;
+	st.motion = inst->motion_cams;
+	st.offline = inst->offline_cams;
+	spin_lock(&inst->lock);
+	for (i = 0; i < inst->cams; i++) {
+		if (inst->written_to_cam[i])
+			st.written |= 1 << i;
+		if (inst->pending[i])
+			st.pending |= 1 << i;
+	}
+	spin_unlock(&inst->lock);
+
+	if (copy_to_user((void __user *)ioctl_param, &st, sizeof(st)))
+		return -EFAULT;
+	return SUCCESS;
+}
+
+static long read_ioctl(struct file *file, unsigned int ioctl_num, unsigned long ioctl_param) {
+
+	int i;
+	struct cam_instance *inst = file->private_data;
+
+	//Switch according to the ioctl called
+	switch (ioctl_num) {
+	case IOCTL_READ:
+		/*
+		 * Give the current message to the calling process -
+		 * the parameter we got is a pointer, fill it.
+		 */
+		// sleep, don't spin, while the camera has no frame (it may be offline)
+		do {
+			if (wait_event_interruptible(inst->frame_wait, inst->written_to_cam[inst->cur_cam]))
+				return -ERESTARTSYS;
+			i = read_frame(file, (char *)ioctl_param, inst->size_of_buf[inst->cur_cam]-sizeof(size_t), 0);
+		} while (!i);
+		if (i < 0)
+			return i;
+		break;
+
+	case IOCTL_GET_VALIDATE:
+		return inst->write_user;
+
+	case IOCTL_CHANGE_TAPE:
+		if (ioctl_param >= inst->cams)
+			return -EINVAL;
+		inst->cur_cam = (int)ioctl_param;
+		break;
+
+	case IOCTL_GET_TAPE_NUMBER:
+		return inst->cur_cam;
+
+	case IOCTL_CHECK_IF_WRITTEN:
+		if (ioctl_param >= inst->cams)
+			return 0;
+		return inst->written_to_cam[ioctl_param];
+
+	case IOCTL_GET_MOTION:
+		return inst->motion_cams;
+
+	case IOCTL_READ_PACKETS:
+		return read_packets(inst, ioctl_param);
+
+	case IOCTL_GET_CODEC:
+		return get_codec(inst, ioctl_param);
+
+	case IOCTL_GET_STATUS:
+		return get_status(inst, ioctl_param);
+
+	case IOCTL_SET_ROI:
+		return set_roi(inst, ioctl_param);
+	}
+	return SUCCESS;
+}
+
+/*
+ * ============================ shrinker ============================
+ */
+
+/*
+ * May the shrinker free camera n? Nobody reads the instance, or nobody
+ * wrote or read the camera for idle_secs. Under instances_lock and inst->lock.
+ */
+static int camera_idle(struct cam_instance *inst, int n) {
+
+	if (!camera(inst, n))
+		return 0;
+	// the frame is in the writer's pages, the buffer holds nothing
+	if (inst->pinned[n])
+		return 1;
+	if (!inst->reader_open && !inst->streams)
+		return 1;
+	return time_after(jiffies, inst->last_access[n] + (unsigned long)idle_secs * HZ);
+}
+
+/*
+ * Take the buffer of camera n and everything in it, under inst->lock.
+ * The camera looks as if it was never written, the next write allocates
+ * it again - unless its frame is pinned, that stays. Returns the buffer
+ * to free.
+ */
+static char *reclaim_camera(struct cam_instance *inst, int n) {
+
+	char *buf = camera(inst, n);
+
+	inst->cam_buf[n] = NULL;
+	inst->reclaimed_bytes[n] += inst->cam_len;
+	set_bit(n, &inst->reclaimed_cams);
+	if (inst->pinned[n])
+		return buf;
+	inst->written_to_cam[n] = 0;
+	inst->pending[n] = 0;
+	inst->size_of_buf[n] = 0;
+	// the rest of a GOP is no use without its keyframe
+	if (inst->gop[n].len)
+		inst->gop[n].need_key = 1;
+	inst->gop[n].len = 0;
+	inst->gop[n].gen++;
+	return buf;
+}
+
+static inline unsigned long camera_pages(struct cam_instance *inst) {
+
+	return PAGE_ALIGN(inst->cam_len) >> PAGE_SHIFT;
+}
+
+/*
+ * The pages the shrinker could free now. The locks are only tried, an
+ * allocation under instances_lock may be what brought us here.
+ */
+static unsigned long cam_shrink_count(struct shrinker *shrinker, struct shrink_control *sc) {
+
+	struct cam_instance *inst;
+	unsigned long pages = 0;
+	int i, n;
+
+	if (!mutex_trylock(&instances_lock))
+		return 0;
+	for (i = 0; i < MAX_INSTANCES; i++) {
+		inst = instance[i];
+		if (!inst)
+			continue;
+		spin_lock(&inst->lock);
+		for (n = 0; n < inst->cams; n++)
+			if (camera_idle(inst, n))
+				pages += camera_pages(inst);
+		spin_unlock(&inst->lock);
+	}
+	mutex_unlock(&instances_lock);
+	return pages;
+}
+
+static unsigned long cam_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc) {
+
+	struct cam_instance *inst;
+	unsigned long freed = 0;
+	char *buf;
+	int i, n;
+
+	if (!mutex_trylock(&instances_lock))
+		return SHRINK_STOP;
+	for (i = 0; i < MAX_INSTANCES && freed < sc->nr_to_scan; i++) {
+		inst = instance[i];
+		// skip an instance that is in the middle of a copy
+		if (!inst || !down_write_trylock(&inst->buf_sem))
+			continue;
+		for (n = 0; n < inst->cams && freed < sc->nr_to_scan; n++) {
+			spin_lock(&inst->lock);
+			buf = camera_idle(inst, n) ? reclaim_camera(inst, n) : NULL;
+			spin_unlock(&inst->lock);
+			if (buf) {
+				kvfree(buf);
+				freed += camera_pages(inst);
+#ifdef DEBUG
+				printk(KERN_INFO "instance %d: reclaimed camera %d\n", i, n);
+#endif
+			}
+		}
+		up_write(&inst->buf_sem);
+	}
+	mutex_unlock(&instances_lock);
+	return freed;
+}
+
+// 6.7 allocates the shrinker, before it was ours
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0)
+static struct shrinker cam_shrinker_static = {
+	.count_objects = cam_shrink_count,
+	.scan_objects = cam_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+static struct shrinker *cam_shrinker;
+
+static int register_cam_shrinker(void) {
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	cam_shrinker = shrinker_alloc(0, "cam_chardev");
+	if (!cam_shrinker)
+		return -ENOMEM;
+	cam_shrinker->count_objects = cam_shrink_count;
+	cam_shrinker->scan_objects = cam_shrink_scan;
+	shrinker_register(cam_shrinker);
+	return SUCCESS;
+#else
+	int ret;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	ret = register_shrinker(&cam_shrinker_static, "cam_chardev");
+#else
+	ret = register_shrinker(&cam_shrinker_static);
+#endif
+	if (!ret)
+		cam_shrinker = &cam_shrinker_static;
+	return ret;
+#endif
+}
+
+static void unregister_cam_shrinker(void) {
+
+	if (!cam_shrinker)
+		return;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	shrinker_free(cam_shrinker);
+#else
+	unregister_shrinker(cam_shrinker);
+#endif
+	cam_shrinker = NULL;
+}
+
+/* Module Declarations */
+
+/*
+ * These structures will hold the functions to be called
+ * when a process does something to the devices we
+ * created. Since a pointer to them is kept in
+ * the devices table, they can't be local to
+ * init_module. NULL is for unimplemented functions.
+ */
+struct file_operations write_fops = {
+
+	.write = device_write,
+	.read = cat_frame, // for cat
+	.unlocked_ioctl = write_ioctl,
+	.open = write_open,
+	.release = write_release,
+};
+
+struct file_operations read_fops = {
+
+	.read = cat_frame,
+	.unlocked_ioctl = read_ioctl,
+	.open = read_open,
+	.release = read_release,
+};
+
+static void destroy_all(void) {
+
+	int i;
+
+	for (i = 0; i < MAX_INSTANCES; i++)
+		if (instance[i]) {
+			destroy_instance(instance[i]);
+			instance[i] = NULL;
+		}
+}
+
+/*
+ * Initialize the module - Register the character devices
+ */
+int init_module() {
+
+	int i, ret_val;
+	struct cam_instance *inst;
+
+	if (instances < 0 || instances > MAX_INSTANCES) {
+		printk(KERN_ALERT "instances must be 0-%d\n", MAX_INSTANCES);
+		return -EINVAL;
+	}
+	for (i = 0; i < instances; i++) {
+		inst = create_instance(i, cams, cam_len);
+		if (IS_ERR(inst)) {
+			destroy_all();
+			return PTR_ERR(inst);
+		}
+		instance[i] = inst;
+	}
+
+	// without it the buffers just stay, not worth failing the load for
+	if (register_cam_shrinker())
+		printk(KERN_WARNING "Failed registering the shrinker, camera buffers won't be reclaimed\n");
+
+	// Register the character devices (atleast try)
+	ret_val = register_chrdev(WRITE_MAJOR_NUM, WRITE_DEVICE_NAME, &write_fops);
+	if (ret_val < 0) {
+		printk(KERN_ALERT "Failed registering the write char device with %d\n", ret_val);
+		unregister_cam_shrinker();
+		destroy_all();
+		return ret_val;
+	}
+	ret_val = register_chrdev(READ_MAJOR_NUM, READ_DEVICE_NAME, &read_fops);
+	if (ret_val < 0) {
+		printk(KERN_ALERT "Failed registering the read char device with %d\n", ret_val);
+		unregister_chrdev(WRITE_MAJOR_NUM, WRITE_DEVICE_NAME);
+		unregister_cam_shrinker();
+		destroy_all();
+		return ret_val;
+	}
+
+	printk(KERN_INFO "================ Registeration is a success ================\n");
+	printk(KERN_INFO "The major device numbers are %d (write) and %d (read).\n", WRITE_MAJOR_NUM, READ_MAJOR_NUM);
+	printk(KERN_INFO "If you want to talk to the device driver,\n");
+	printk(KERN_INFO "you'll have to create the device files. \n");
+	printk(KERN_INFO "We suggest you use:\n");
+	printk(KERN_INFO "mknod %s c %d 0\n", DEVICE_FILE_NAME_W, WRITE_MAJOR_NUM);
+	printk(KERN_INFO "mknod %s c %d 0\n", DEVICE_FILE_NAME_R, READ_MAJOR_NUM);
+	printk(KERN_INFO "mknod %s c %d %d\n", DEVICE_FILE_NAME_CTL, WRITE_MAJOR_NUM, CTL_MINOR);
+	printk(KERN_INFO "mknod %s0_<camera> c %d <%d + camera> for the YUV4MPEG2 streams\n", DEVICE_FILE_NAME_STREAM, READ_MAJOR_NUM, STREAM_MINOR_BASE);
+	printk(KERN_INFO "The device file names are important, because\n");
+	printk(KERN_INFO "the ioctl programs assume that's the files you'll use.\n");
+
+	return 0;
+}
+
+/*
+ * Cleanup - unregister the appropriate files from /proc
+ */
+void cleanup_module() {
+
+	printk(KERN_INFO "======== Unregistering %s and %s ========\n", WRITE_DEVICE_NAME, READ_DEVICE_NAME);
+	unregister_chrdev(READ_MAJOR_NUM, READ_DEVICE_NAME);
+	unregister_chrdev(WRITE_MAJOR_NUM, WRITE_DEVICE_NAME);
+	unregister_cam_shrinker();
+	destroy_all();
+}
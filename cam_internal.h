@@ -0,0 +1,137 @@
+/*
+ *  cam_internal.h - the state of the module (kernel side only), the ABI
+ *  shared with user space is in chardev.h
+ */
+#ifndef CAM_INTERNAL_H
+#define CAM_INTERNAL_H
+
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include "chardev.h"
+
+/*
+ * The GOP of a camera in passthrough mode, the packets
+ * themselves are in cam_buf[tape]
+ */
+struct gop_log {
+	size_t len;		/* bytes of packets in the camera */
+	u32 first_seq;		/* the keyframe that starts the log */
+	u32 last_seq;		/* the newest packet */
+	u32 gen;		/* bumped whenever the log starts over */
+	int need_key;		/* the GOP didn't fit, drop until the next keyframe */
+	int has_codec;
+	struct codec_params codec;
+};
+
+/*
+ * A frame handed in with IOCTL_WRITE_PINNED. The pages
+ * are mapped read only, so the stamps of the module go to times.
+ */
+struct pinned_buf {
+	struct page **pages;
+	int npages;
+	char *map;			/* vmap of the pages */
+	char *frame;			/* the [frame...] part, in map */
+	size_t len;			/* of the frame */
+	struct frame_times times;
+	u64 cookie;
+	int node;			/* of the first page */
+	u32 writer_gen;			/* of the writer that pinned it */
+	atomic_t refs;			/* the camera's, and every copy in progress */
+};
+
+/*
+ * All the state of one instance
+ */
+struct cam_instance {
+	int id;
+	int cams;			/* limits of this instance */
+	size_t cam_len;
+
+	char *cam_buf[CAM_NUM];		/* cam_len bytes each, NULL until written or once reclaimed */
+	char *cam_ptr;			/* used for seeking */
+	int cur_cam;			/* the camera the reader reads */
+	size_t size_of_buf[CAM_NUM];	/* size of the last serialized buf of every camera */
+	int written_to_cam[CAM_NUM];
+	unsigned long motion_cams;	/* bit n is set while camera n has motion */
+	unsigned long offline_cams;	/* bit n is set while camera n has no source */
+	int write_user;			/* a write_user has the writer open */
+
+	struct gop_log gop[CAM_NUM];
+	wait_queue_head_t packet_wait;
+
+	int policy[CAM_NUM];		/* POLICY_* */
+	int pending[CAM_NUM];		/* the frame in the camera wasn't read yet */
+	u64 frames_written[CAM_NUM], frames_read[CAM_NUM], frames_dropped[CAM_NUM];
+	wait_queue_head_t consumed_wait;	/* POLICY_BLOCK writers wait here */
+
+	u32 frame_seq[CAM_NUM];		/* bumped by every frame, never reset */
+	wait_queue_head_t frame_wait;	/* streams wait here for a new frame */
+
+	/*
+	 * Copies of a frame to or from user space run without inst->lock,
+	 * under cam_mutex[n]. While the writer copies in, writing[n] tells
+	 * those that read the camera under the lock to wait.
+	 */
+	struct mutex cam_mutex[CAM_NUM];
+	int writing[CAM_NUM];
+
+	/*
+	 * Memory pressure - the shrinker frees the buffers of idle cameras.
+	 * Whoever uses a buffer outside inst->lock holds buf_sem for reading,
+	 * the shrinker only takes it with a trylock.
+	 */
+	struct rw_semaphore buf_sem;
+	unsigned long last_access[CAM_NUM];	/* jiffies of the last write or read */
+	unsigned long reclaimed_cams;	/* bit n is set while camera n's buffer is reclaimed */
+	u64 reclaimed_bytes[CAM_NUM], reallocs[CAM_NUM];
+
+	/*
+	 * NUMA - the node a camera's buffer was allocated on, and the copies
+	 * in or out of a camera by a CPU of another node
+	 */
+	int cam_node[CAM_NUM];
+	u64 cross_node[CAM_NUM];
+
+	/*
+	 * Pinned frames - a camera's frame is in pinned[n] instead of its
+	 * buffer when the writer handed it in pinned. Released buffers wait
+	 * in a ring for the writer to get them back.
+	 */
+	struct pinned_buf *pinned[CAM_NUM];
+	u64 released[PIN_OUTSTANDING];
+	unsigned int rel_head, rel_tail;
+	int pinned_out;			/* pinned and not given back yet */
+	u32 writer_gen;			/* bumped by every open of the writer */
+	wait_queue_head_t release_wait;
+	u64 frames_pinned[CAM_NUM], bytes_copied[CAM_NUM];
+
+	struct cam_roi roi;		/* of the reader, when roi_on */
+	int roi_on;
+	char *roi_buf;			/* the cropped frame, cam_len bytes */
+	struct mutex roi_mutex;		/* held while roi_buf is filled and copied out */
+
+	spinlock_t lock;
+	int writer_open, reader_open, streams;
+};
+
+/*
+ * An open stream. buf holds the part of the stream
+ * being read, the YUV4MPEG2 header and/or one frame.
+ */
+#define Y4M_HEADER_MAX 64
+
+struct cam_stream {
+	struct cam_instance *inst;
+	int cam;
+	int w, h;			/* of the stream header, 0 before it */
+	u32 seq;			/* frame_seq of the frame in buf */
+	struct cam_roi roi;		/* all zero = the whole frame */
+	char *buf;			/* cam_len + Y4M_HEADER_MAX bytes */
+	size_t len, pos;
+};
+
+#endif
@@ -3,7 +3,8 @@
  *
  *  The declarations here have to be in a header file, because
  *  they need to be known both to the kernel module
- *  (in chardev.c) and the process calling ioctl (read_user.c & write_user.c)
+ *  (in cam_chardev.c) and the process calling ioctl (read_user.c & write_user.c).
+ *  The module's own state is in cam_internal.h.
  */
 #ifndef CHARDEV_H
 #define CHARDEV_H
@@ -13,7 +14,7 @@
 #define SUCCESS 0
 
 #include <linux/ioctl.h>
-#include <linux/spinlock.h>
+#include <linux/types.h>
 
 /* 
  * The major device number. We can't rely on dynamic 
@@ -87,11 +88,222 @@
 #define IOCTL_CHECK_IF_WRITTEN _IOR(READ_MAJOR_NUM,5,int)
 
 
+/*
+ * write_user tells us when motion starts and stops on a camera,
+ * the parameter is the camera number, 0-9.
+ */
+#define IOCTL_SET_MOTION _IOR(WRITE_MAJOR_NUM, 6, int)
+#define IOCTL_CLEAR_MOTION _IOR(WRITE_MAJOR_NUM, 7, int)
+
+/*
+ * get a bitmask of the cameras with motion right now (bit n = camera n)
+ */
+#define IOCTL_GET_MOTION _IO(READ_MAJOR_NUM, 6)
+
+/*
+ * Timestamps that travel with every frame, all CLOCK_MONOTONIC
+ * nanoseconds (the same clock as ktime_get_ns() in the kernel).
+ * They sit right after the camera number in the serialized buf,
+ * so they are the first thing in the camera and in the reader's buf.
+ */
+struct frame_times {
+	__u64 decode_ns;	/* write_user: decoding of the frame started */
+	__u64 capture_ns;	/* write_user: the frame is decoded */
+	__u64 enqueue_ns;	/* kernel: the frame is stored in its camera */
+	__u64 dequeue_ns;	/* kernel: the frame is handed to the reader */
+};
+
+/*
+ * Encoded passthrough - write_user sends the demuxed packets instead of
+ * decoded frames, and the reader decodes only the camera it shows.
+ * In this mode every camera keeps the packets since its last keyframe
+ * (a GOP), one after the other: [packet_header][payload][packet_header]...
+ */
+#define PACKET_KEY 1
+
+struct packet_header {
+	__u32 size;		/* payload bytes after this header */
+	__s32 tape;
+	__u32 flags;		/* PACKET_KEY */
+	__u32 seq;		/* set by the kernel, counts the packets of the camera */
+	__s64 pts, dts;		/* in the stream time base */
+	struct frame_times times;
+};
+
+/*
+ * What the reader needs to open a decoder, set once per camera
+ */
+#define CODEC_EXTRADATA_MAX 4096
+
+struct codec_params {
+	__s32 tape;
+	__u32 codec_id;		/* enum AVCodecID */
+	__s32 width, height;
+	__s32 pix_fmt;		/* enum PixelFormat */
+	__s32 time_base_num, time_base_den;
+	__u32 extradata_size;
+	__u8  extradata[CODEC_EXTRADATA_MAX];
+};
+
+/*
+ * IOCTL_READ_PACKETS - fills buf with whole packets of 'tape', starting at
+ * packet from_seq, or at the last keyframe when from_seq is 0 or was already
+ * dropped. Waits up to timeout_ms for a new packet, returns the bytes copied.
+ */
+struct packet_read {
+	__s32 tape;
+	__u32 from_seq;
+	__u32 buf_len;
+	__u32 timeout_ms;
+	__u64 buf;		/* user pointer */
+};
+
+#define IOCTL_SET_CODEC _IOR(WRITE_MAJOR_NUM, 8, char *)
+#define IOCTL_WRITE_PACKET _IOR(WRITE_MAJOR_NUM, 9, char *)
+#define IOCTL_READ_PACKETS _IOWR(READ_MAJOR_NUM, 7, char *)
+#define IOCTL_GET_CODEC _IOWR(READ_MAJOR_NUM, 8, char *)
+
+/*
+ * IOCTL_GET_STATUS - all the reader polls about the cameras, in one call
+ */
+struct cam_status {
+	__u32 cams;		/* cameras of the instance */
+	__s32 cur_cam;		/* the camera the reader reads */
+	__u32 writer;		/* a write_user has the writer open */
+	__u32 written;		/* bit n = camera n has a frame */
+	__u32 motion;		/* bit n = camera n has motion */
+	__u32 pending;		/* bit n = the frame of camera n wasn't read yet */
+	__u32 offline;		/* bit n = camera n has no source */
+};
+
+#define IOCTL_GET_STATUS _IOR(READ_MAJOR_NUM, 9, char *)
+
+/*
+ * Backpressure - what IOCTL_WRITE does when the frame in the camera
+ * wasn't read yet, set per camera with IOCTL_SET_POLICY
+ */
+#define POLICY_OVERWRITE 0	/* the new frame replaces it (default, live viewers) */
+#define POLICY_BLOCK 1		/* the writer waits until it is read (recording) */
+#define POLICY_DROP 2		/* the write fails with -EAGAIN, the writer skips the frame */
+
+struct cam_policy {
+	__s32 tape;
+	__u32 policy;
+};
+
+/*
+ * IOCTL_GET_CAM_STATS - tape in, the rest out
+ */
+struct cam_stats {
+	__s32 tape;
+	__u32 policy;
+	__u32 pending;		/* the frame in the camera wasn't read yet */
+	__u32 resident;		/* the camera has its buffer */
+	__u64 written, read;	/* frames */
+	__u64 dropped;		/* overwritten unread, or refused with -EAGAIN */
+	__u64 reclaimed;	/* bytes the shrinker took back under memory pressure */
+	__u64 reallocs;		/* writes that had to allocate the buffer again */
+	__u64 pinned;		/* frames handed in with IOCTL_WRITE_PINNED */
+	__u64 copied;		/* bytes of frames the module copied, in and out */
+	__s32 node;		/* NUMA node of the buffer, -1 without one */
+	__u32 contiguous;	/* the buffer is physically contiguous */
+	__u64 cross_node;	/* copies in or out by a CPU of another node */
+};
+
+#define IOCTL_SET_POLICY _IOR(WRITE_MAJOR_NUM, 13, char *)
+#define IOCTL_GET_CAM_STATS _IOWR(WRITE_MAJOR_NUM, 14, char *)
+
+/*
+ * Region of interest - the reader (or a stream, on its own file) gets only
+ * this rectangle of every frame, every scale-th pixel of it, as a frame of
+ * that smaller size. x and y are rounded down to even (the chroma is half
+ * size) and the rectangle is clipped to the frame. w or h 0 is the whole
+ * frame, so { 0, 0, 0, 0, 1 } turns it off. Set on the read device, it
+ * lasts until the reader closes.
+ */
+#define ROI_MAX_SCALE 16
+
+struct cam_roi {
+	__s32 x, y, w, h;
+	__u32 scale;		/* 1 = every pixel, 2 = every other... */
+};
+
+#define IOCTL_SET_ROI _IOR(READ_MAJOR_NUM, 10, char *)
+
+/*
+ * Hot-plug - a camera without a source is offline: its frame and GOP are
+ * gone, it isn't written, and writes to it fail with -ENODEV until it is
+ * online again. The parameter is the camera number, every camera is online
+ * when the writer opens.
+ */
+#define IOCTL_CAM_ONLINE _IOR(WRITE_MAJOR_NUM, 15, int)
+#define IOCTL_CAM_OFFLINE _IOR(WRITE_MAJOR_NUM, 16, int)
+
+/*
+ * Pinned frames - instead of IOCTL_WRITE the writer may hand in its buffer
+ * (a serialized frame, [size_t size][int tape][frame...]) with
+ * IOCTL_WRITE_PINNED. The module pins its pages and copies nothing; a
+ * frame is copied only when it is read, from the writer's pages straight
+ * to the reader's. The buffer is the module's until it is released - it
+ * was replaced by a newer frame of the camera and nobody is copying it -
+ * and the writer must not touch it before. IOCTL_GET_RELEASED gives the
+ * cookies of the released buffers, waiting up to timeout_ms for one.
+ * A writer with PIN_OUTSTANDING buffers it didn't get back gets -ENOBUFS.
+ */
+#define PIN_OUTSTANDING 64
+#define PIN_RELEASE_MAX 32
+
+struct pinned_frame {
+	__u64 buf;		/* user pointer to the serialized frame */
+	__u64 cookie;		/* the writer's, given back on release */
+};
+
+struct pinned_release {
+	__u32 timeout_ms;	/* in */
+	__u32 count;		/* in: cookies wanted, out: filled */
+	__u64 cookies[PIN_RELEASE_MAX];
+};
+
+#define IOCTL_WRITE_PINNED _IOR(WRITE_MAJOR_NUM, 17, char *)
+#define IOCTL_GET_RELEASED _IOWR(WRITE_MAJOR_NUM, 18, char *)
+
+/*
+ * Instances - independent groups of cameras (e.g. one per building), each
+ * with its own device nodes, buffers and lock. Instance n is minor n of
+ * both majors, instance 0 is the usual /dev/write_char_dev & /dev/read_char_dev.
+ * Instances are created by the 'instances' module parameter or with
+ * IOCTL_CREATE_INSTANCE on the control node (minor CTL_MINOR of WRITE_MAJOR_NUM).
+ */
+#define MAX_INSTANCES 16
+#define CTL_MINOR 255
+
+struct instance_params {
+	__s32 id;		/* out: the new instance */
+	__s32 cams;		/* cameras, 1 to CAM_NUM */
+	__u32 cam_len;		/* bytes per camera, up to CAM_LEN */
+};
+
+#define IOCTL_CREATE_INSTANCE _IOWR(WRITE_MAJOR_NUM, 10, char *)
+#define IOCTL_DESTROY_INSTANCE _IOR(WRITE_MAJOR_NUM, 11, int)
+#define IOCTL_GET_INSTANCES _IO(WRITE_MAJOR_NUM, 12)	/* bitmask of instances */
+
+/*
+ * Streams - camera c of instance i is also minor STREAM_MINOR(i, c) of
+ * READ_MAJOR_NUM. read() there gives a YUV4MPEG2 stream of the camera
+ * (the header, then "FRAME\n" and the I420 planes of every new frame),
+ * so 'ffmpeg -f yuv4mpegpipe -i /dev/cam_stream0_1' needs no client.
+ * Any number of streams may be open, they don't take frames from the reader.
+ */
+#define STREAM_MINOR_BASE 64
+#define STREAM_MINOR(inst, cam) (STREAM_MINOR_BASE + (inst) * CAM_NUM + (cam))
+
 /* 
  * The name of the device file 
  */
 #define DEVICE_FILE_NAME_R "/dev/read_char_dev"
 #define DEVICE_FILE_NAME_W "/dev/write_char_dev"
+#define DEVICE_FILE_NAME_CTL "/dev/smarthome_ctl"
+#define DEVICE_FILE_NAME_STREAM "/dev/cam_stream"	/* <instance>_<camera> */
 
 /*
  * 10 cameras of 1.5MB each
@@ -0,0 +1,249 @@
+/*
+ *  bench_transport.c - compare the frame transport backends head to head
+ *
+ *  Writer threads push synthetic frames for N cameras, while a reader
+ *  thread keeps reading the selected camera, exactly like write_user and
+ *  read_user do, but with no decoding and no display in the way.
+ *
+ *  Readers may use another transport than the writers, e.g. shm writers
+ *  and -T net readers through a relay.out, to benchmark the relay.
+ *
+ *  With -f the writers loop over the real frames of a write_user frame
+ *  cache (see frame_cache.h) instead of synthetic ones, still decode free.
+ *
+ *  Usage: bench_transport.out [-t chardev|shm] [-T reader transport] [-n readers]
+ *			       [-c cams] [-s bytes] [-d seconds] [-r fps] [-f cache file]
+ */
+
+#include "../chardev.h"
+#include "transport.h"
+#include "latency.h"
+#include "frame_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>		/* getopt */
+#include <time.h>
+#include <pthread.h>
+
+typedef struct BenchCam {
+
+	Transport   *transport;
+	int          tape;
+	size_t       frame_size;
+	int          fps;
+	long         frames;
+	const char  *cache_file;
+
+} BenchCam;
+
+typedef struct BenchReader {
+
+	Transport    *transport;
+	pthread_t     thread;
+	int           cams, tape, hop;
+	long          reads;
+	LatencyStats *latency;
+
+} BenchReader;
+
+static volatile int quit = 0, stop_reading = 0;
+
+static LatencyStats latency;
+
+static void* bench_writer(void* arg) {
+
+	BenchCam *cam = arg;
+	size_t size = sizeof(size_t) + sizeof(int) + cam->frame_size;
+	char *buf = malloc(size), *frame = buf;
+	struct frame_times times = {0};
+	uint64_t next = latency_now_ns();
+	uint32_t i = 0;
+	FrameCache fc;
+
+	memset(buf, cam->tape, size);
+	memcpy(buf, &size, sizeof(size_t));
+	memcpy(buf + sizeof(size_t), &cam->tape, sizeof(int));
+
+	// every camera maps the cache privately, the tape is patched in place
+	memset(&fc, 0, sizeof(fc));
+	if (cam->cache_file && frame_cache_map(&fc, cam->cache_file) < 0) {
+		fprintf(stderr, "can't map frame cache %s\n", cam->cache_file);
+		free(buf);
+		return NULL;
+	}
+
+	while (!quit) {
+		if (cam->cache_file) {
+			frame = frame_cache_frame(&fc, i, NULL);
+			i = (i + 1) % frame_cache_frames(&fc);
+			memcpy(frame + sizeof(size_t), &cam->tape, sizeof(int));
+		}
+		// nothing to decode, the frame is "captured" right now
+		times.decode_ns = times.capture_ns = latency_now_ns();
+		memcpy(frame + sizeof(size_t) + sizeof(int), &times, sizeof(struct frame_times));
+		if (transport_write_frame(cam->transport, frame) < 0) {
+			fprintf(stderr, "write_frame failed on tape %d\n", cam->tape);
+			break;
+		}
+		cam->frames++;
+
+		if (cam->fps) {
+			struct timespec ts;
+			next += 1000000000 / cam->fps;
+			ts.tv_sec = next / 1000000000;
+			ts.tv_nsec = next % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+		}
+	}
+	if (cam->cache_file)
+		frame_cache_close(&fc);
+	free(buf);
+	return NULL;
+}
+
+/*
+ * A reader - a single one hops over all the cameras like a user pressing
+ * 1-0, with many readers (e.g. viewers of a relay) each one watches one camera
+ */
+static void* bench_reader(void* arg) {
+
+	BenchReader *r = arg;
+	char *buf = malloc(CAM_LEN + sizeof(size_t));
+	int tape = r->hop ? 0 : r->tape;
+	uint64_t fetched;
+	struct frame_times times;
+
+	// wait for the first frame, as read_user does
+	while (!transport_check_if_written(r->transport, tape) && !stop_reading)
+		usleep(1000);
+	transport_change_tape(r->transport, tape);
+
+	while (!stop_reading) {
+		if (transport_read_frame(r->transport, buf) < 0) {
+			fprintf(stderr, "read_frame failed\n");
+			break;
+		}
+		fetched = latency_now_ns();
+		// every backend hands out [frame...], which starts with the frame times
+		memcpy(&times, buf, sizeof(struct frame_times));
+		latency_record(r->latency, tape, &times, fetched, fetched);
+		r->reads++;
+		if (r->hop) {
+			tape = r->reads % r->cams;
+			transport_change_tape(r->transport, tape);
+		}
+	}
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char* argv[]) {
+
+	int i, opt, cams = CAM_NUM, seconds = 5, fps = 0, readers = 1;
+	size_t frame_size = 640 * 360 * 3 / 2;
+	char *backend = NULL, *reader_backend = NULL, *cache_file = NULL;
+	const char *reader_name = "-";
+	FrameCache fc;
+	long reads = 0, writes = 0;
+	Transport *writer;
+	BenchCam cam[CAM_NUM];
+	BenchReader *reader;
+	pthread_t thread[CAM_NUM];
+
+	while ((opt = getopt(argc, argv, "t:T:n:c:s:d:r:f:")) != -1) {
+		switch (opt) {
+		case 't': backend = optarg; break;
+		case 'T': reader_backend = optarg; break;
+		case 'n': readers = atoi(optarg); break;
+		case 'c': cams = atoi(optarg); break;
+		case 's': frame_size = strtoul(optarg, NULL, 10); break;
+		case 'd': seconds = atoi(optarg); break;
+		case 'r': fps = atoi(optarg); break;
+		case 'f': cache_file = optarg; break;
+		default:
+			fprintf(stderr, "Usage: %s [-t chardev|shm] [-T reader transport] [-n readers] "
+					"[-c cams] [-s bytes] [-d seconds] [-r fps] [-f cache file]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (cache_file) {
+		// the frames of the cache decide the size
+		memset(&fc, 0, sizeof(fc));
+		if (frame_cache_map(&fc, cache_file) < 0) {
+			fprintf(stderr, "%s is not a frame cache\n", cache_file);
+			exit(1);
+		}
+		frame_size = fc.hdr.frame_size - sizeof(size_t) - sizeof(int);
+		frame_cache_close(&fc);
+	}
+	if (cams < 1 || cams > CAM_NUM || frame_size < sizeof(struct frame_times) || frame_size > CAM_LEN - sizeof(int)) {
+		fprintf(stderr, "cams must be 1-%d and frame size %zu-%zu\n", CAM_NUM, sizeof(struct frame_times), CAM_LEN - sizeof(int));
+		exit(1);
+	}
+	if (readers < 0) {
+		fprintf(stderr, "readers must be 0 or more\n");
+		exit(1);
+	}
+	if (!reader_backend)
+		reader_backend = backend;
+
+	writer = transport_open(backend, TRANSPORT_WRITER);
+	if (!writer)
+		exit(-1);
+
+	reader = calloc(readers + 1, sizeof(BenchReader));
+	for (i = 0; i < readers; i++) {
+		reader[i].transport = transport_open(reader_backend, TRANSPORT_READER);
+		reader[i].latency = calloc(1, sizeof(LatencyStats));
+		if (!reader[i].transport || !reader[i].latency)
+			exit(-1);
+		reader[i].cams = cams;
+		reader[i].tape = i % cams;
+		reader[i].hop = readers == 1;
+		reader_name = reader[i].transport->ops->name;
+	}
+
+	for (i = 0; i < cams; i++) {
+		cam[i] = (BenchCam){ writer, i, frame_size, fps, 0, cache_file };
+		if (pthread_create(&thread[i], NULL, bench_writer, &cam[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(-1);
+		}
+	}
+	for (i = 0; i < readers; i++)
+		if (pthread_create(&reader[i].thread, NULL, bench_reader, &reader[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(-1);
+		}
+
+	sleep(seconds);
+
+	// the readers first, so none of them waits for a frame that never comes
+	stop_reading = 1;
+	for (i = 0; i < readers; i++) {
+		pthread_join(reader[i].thread, NULL);
+		reads += reader[i].reads;
+		latency_merge(&latency, reader[i].latency);
+		transport_close(reader[i].transport);
+		free(reader[i].latency);
+	}
+	quit = 1;
+	for (i = 0; i < cams; i++) {
+		pthread_join(thread[i], NULL);
+		writes += cam[i].frames;
+	}
+
+	printf("backend %s -> %s: %d cameras, %zu bytes/frame, %d readers, %d s\n", writer->ops->name,
+			reader_name, cams, frame_size, readers, seconds);
+	printf("  writes: %ld (%.1f frames/s, %.1f MB/s)\n", writes, (double)writes / seconds,
+			(double)writes * frame_size / seconds / 1e6);
+	printf("  reads:  %ld (%.1f frames/s)\n", reads, (double)reads / seconds);
+	latency_dump(&latency, stdout);
+
+	free(reader);
+	transport_close(writer);
+	return 0;
+}
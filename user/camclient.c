@@ -0,0 +1,264 @@
+/*
+ *  camclient.c - the client library of the cameras
+ */
+
+#include "camclient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+CamClient *cam_open(const char *backend, int role) {
+
+	CamClient *c = calloc(1, sizeof(CamClient));
+
+	if (!c)
+		return NULL;
+	c->transport = transport_open(backend, role);
+	if (!c->transport) {
+		free(c);
+		return NULL;
+	}
+	pthread_mutex_init(&c->pool.lock, NULL);
+	return c;
+}
+
+void cam_close(CamClient *c) {
+
+	CamFrame *f;
+
+	// the transport lets go of the pinned frames first
+	transport_close(c->transport);
+	while ((f = c->pool.all)) {
+		c->pool.all = f->all_next;
+		free(f->buf);
+		free(f);
+	}
+	pthread_mutex_destroy(&c->pool.lock);
+	free(c);
+}
+
+int cam_set_pinned(CamClient *c, int on) {
+
+	uint64_t cookie;
+	int ret_val;
+
+	if (on) {
+		// nothing is pinned yet, this only asks if the transport can
+		ret_val = transport_get_released(c->transport, &cookie, 1, 0);
+		if (ret_val < 0)
+			return ret_val;
+	}
+	c->pinned = on;
+	return SUCCESS;
+}
+
+size_t cam_frame_size(int w, int h) {
+
+	return CAM_FRAME_PIXELS_OFF + (size_t)w * h + 2 * (size_t)((w + 1) / 2) * ((h + 1) / 2);
+}
+
+/*
+ * A free frame of the pool with at least 'size' bytes of buffer
+ */
+static CamFrame *pool_get(CamPool *pool, size_t size) {
+
+	CamFrame *f;
+	char *buf;
+
+	pthread_mutex_lock(&pool->lock);
+	f = pool->free;
+	if (f)
+		pool->free = f->next;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (!f) {
+		f = calloc(1, sizeof(CamFrame));
+		if (!f)
+			return NULL;
+		f->pool = pool;
+		__atomic_fetch_add(&pool->frames, 1, __ATOMIC_RELAXED);
+		pthread_mutex_lock(&pool->lock);
+		f->all_next = pool->all;
+		pool->all = f;
+		pthread_mutex_unlock(&pool->lock);
+	}
+	if (f->cap < size) {
+		buf = realloc(f->buf, size);
+		if (!buf) {
+			cam_release(f);
+			return NULL;
+		}
+		f->buf = buf;
+		f->cap = size;
+	}
+	return f;
+}
+
+void cam_release(CamFrame *f) {
+
+	CamPool *pool = f->pool;
+
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	f->next = pool->free;
+	pool->free = f;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Point the pixels into the buffer, the planes one after the other
+ */
+static void set_pixels(CamFrame *f) {
+
+	f->pixels[0] = (uint8_t *)f->buf + CAM_FRAME_PIXELS_OFF;
+	f->pixels[1] = f->pixels[0] + (size_t)f->w * f->h;
+	f->pixels[2] = f->pixels[1] + (size_t)f->pitches[1] * ((f->h + 1) / 2);
+}
+
+/*
+ * Give the frames the transport released back to the pool, the cookie
+ * of a pinned frame is its handle (0 for a frame of no pool)
+ */
+static void pool_collect(CamClient *c, int timeout_ms) {
+
+	uint64_t cookies[PIN_RELEASE_MAX];
+	int i, n;
+
+	n = transport_get_released(c->transport, cookies, PIN_RELEASE_MAX, timeout_ms);
+	for (i = 0; i < n; i++)
+		if (cookies[i])
+			cam_release((CamFrame *)(uintptr_t)cookies[i]);
+}
+
+CamFrame *cam_acquire(CamClient *c, int tape, int w, int h) {
+
+	CamFrame *f;
+	int planes = 3;
+
+	if (w <= 0 || h <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (cam_frame_size(w, h) > CAM_FRAME_TIMES_OFF + CAM_LEN) {
+		errno = E2BIG;
+		return NULL;
+	}
+	if (c->pinned)
+		pool_collect(c, 0);
+	f = pool_get(&c->pool, cam_frame_size(w, h));
+	if (!f)
+		return NULL;
+
+	f->tape = tape;
+	memset(&f->times, 0, sizeof(struct frame_times));
+	f->format = CAM_FORMAT_YV12;
+	f->w = w;
+	f->h = h;
+	f->planes = planes;
+	f->pitches[0] = w;
+	f->pitches[1] = f->pitches[2] = (w + 1) / 2;
+	f->size = cam_frame_size(w, h);
+	set_pixels(f);
+
+	// all but the tape and the times, commit writes them
+	memcpy(f->buf, &f->size, sizeof(size_t));
+	memcpy(f->buf + CAM_FRAME_FORMAT_OFF, &f->format, sizeof(uint32_t));
+	memcpy(f->buf + CAM_FRAME_W_OFF, &w, sizeof(int));
+	memcpy(f->buf + CAM_FRAME_W_OFF + sizeof(int), &h, sizeof(int));
+	memcpy(f->buf + CAM_FRAME_W_OFF + 2 * sizeof(int), &planes, sizeof(int));
+	memcpy(f->buf + CAM_FRAME_PITCHES_OFF, f->pitches, sizeof(f->pitches));
+	return f;
+}
+
+int cam_commit(CamClient *c, CamFrame *f) {
+
+	int ret_val;
+
+	memcpy(f->buf + CAM_FRAME_TAPE_OFF, &f->tape, sizeof(int));
+	memcpy(f->buf + CAM_FRAME_TIMES_OFF, &f->times, sizeof(struct frame_times));
+	if (!c->pinned) {
+		ret_val = transport_write_frame(c->transport, f->buf);
+		cam_release(f);
+		return ret_val;
+	}
+
+	// the frame stays the transport's until it is released
+	ret_val = transport_write_pinned(c->transport, f->buf, f->pool ? (uintptr_t)f : 0);
+	if (ret_val == -ENOBUFS) {
+		pool_collect(c, 100);
+		ret_val = transport_write_pinned(c->transport, f->buf, f->pool ? (uintptr_t)f : 0);
+	}
+	if (ret_val < 0)
+		cam_release(f);
+	return ret_val;
+}
+
+int cam_parse(CamFrame *f, char *buf, size_t len) {
+
+	if (len < CAM_FRAME_PIXELS_OFF)
+		return FAIL;
+
+	f->pool = NULL;
+	f->cap = len;
+	f->buf = buf;
+	memcpy(&f->size, buf, sizeof(size_t));
+	memcpy(&f->tape, buf + CAM_FRAME_TAPE_OFF, sizeof(int));
+	memcpy(&f->times, buf + CAM_FRAME_TIMES_OFF, sizeof(struct frame_times));
+	memcpy(&f->format, buf + CAM_FRAME_FORMAT_OFF, sizeof(uint32_t));
+	memcpy(&f->w, buf + CAM_FRAME_W_OFF, sizeof(int));
+	memcpy(&f->h, buf + CAM_FRAME_W_OFF + sizeof(int), sizeof(int));
+	memcpy(&f->planes, buf + CAM_FRAME_W_OFF + 2 * sizeof(int), sizeof(int));
+	memcpy(f->pitches, buf + CAM_FRAME_PITCHES_OFF, sizeof(f->pitches));
+
+	if (f->w <= 0 || f->h <= 0 || f->pitches[0] != f->w ||
+			f->pitches[1] < (f->w + 1) / 2 || f->pitches[2] < (f->w + 1) / 2)
+		return FAIL;
+	f->size = CAM_FRAME_PIXELS_OFF + (size_t)f->w * f->h +
+			(size_t)(f->pitches[1] + f->pitches[2]) * ((f->h + 1) / 2);
+	if (f->size > len)
+		return FAIL;
+	set_pixels(f);
+	return SUCCESS;
+}
+
+CamFrame *cam_wait_frame(CamClient *c) {
+
+	CamFrame *f;
+	CamPool *pool;
+	int ret_val, tape;
+	size_t cap = CAM_FRAME_TIMES_OFF + CAM_LEN;
+
+	f = pool_get(&c->pool, cap);
+	if (!f)
+		return NULL;
+
+	// the transports give the frame without its size and tape
+	tape = transport_get_tape_number(c->transport);
+	ret_val = transport_read_frame(c->transport, f->buf + CAM_FRAME_TIMES_OFF);
+	if (ret_val < 0) {
+		cam_release(f);
+		errno = -ret_val;
+		return NULL;
+	}
+	// the camera was switched in between, we can't tell whose frame it is
+	if (transport_get_tape_number(c->transport) != tape) {
+		cam_release(f);
+		errno = EAGAIN;
+		return NULL;
+	}
+	memcpy(f->buf + CAM_FRAME_TAPE_OFF, &tape, sizeof(int));
+	memset(f->buf, 0, sizeof(size_t));
+
+	pool = f->pool;
+	ret_val = cam_parse(f, f->buf, f->cap);
+	f->pool = pool;
+	if (ret_val < 0) {
+		cam_release(f);
+		errno = EBADMSG;
+		return NULL;
+	}
+	return f;
+}
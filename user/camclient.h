@@ -0,0 +1,152 @@
+/*
+ *  camclient.h - the client library of the cameras
+ *
+ *  The frame protocol and the transport in one typed API, so the
+ *  applications never build or pick apart a serialized frame themselves.
+ *
+ *	writer:	f = cam_acquire(c, tape, w, h);		fill f->pixels
+ *		cam_commit(c, f);			sent, back to the pool
+ *
+ *	reader:	f = cam_wait_frame(c);			the newest frame
+ *		... f->pixels, f->times ...
+ *		cam_release(f);
+ *
+ *  A CamFrame is a handle to a buffer of the client's pool, the pixels
+ *  point into that buffer, so nothing is copied between the transport and
+ *  the caller. The handle is the caller's until commit or release, the
+ *  buffers are reused and a pool only grows to the frames in use at once.
+ *
+ *  With cam_set_pinned a writer's committed frames are handed to the
+ *  transport pinned (IOCTL_WRITE_PINNED) instead of copied, and a frame
+ *  goes back to the pool only when the transport released it, so the pool
+ *  also holds the newest frame of every camera.
+ *
+ *  The serialized frame, as the transports and the module take it:
+ *
+ *	[size_t size][int tape][frame_times][Uint32 format][int w][int h]
+ *	[int planes][Uint16 pitches x3][Y, w*h][V, cw*ch][U, cw*ch]
+ *
+ *  with cw = (w+1)/2 and ch = (h+1)/2, the chroma planes are half size in
+ *  both directions. A frame of more than CAM_LEN bytes (the frame times on)
+ *  doesn't fit in a camera.
+ */
+#ifndef CAMCLIENT_H
+#define CAMCLIENT_H
+
+#include "../chardev.h"
+#include "transport.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#define CAM_FORMAT_YV12 0x32315659	/* SDL_YV12_OVERLAY */
+
+/*
+ * Where the parts of a serialized frame are
+ */
+#define CAM_FRAME_TAPE_OFF sizeof(size_t)
+#define CAM_FRAME_TIMES_OFF (CAM_FRAME_TAPE_OFF + sizeof(int))
+#define CAM_FRAME_FORMAT_OFF (CAM_FRAME_TIMES_OFF + sizeof(struct frame_times))
+#define CAM_FRAME_W_OFF (CAM_FRAME_FORMAT_OFF + sizeof(uint32_t))
+#define CAM_FRAME_PITCHES_OFF (CAM_FRAME_W_OFF + 3 * sizeof(int))
+#define CAM_FRAME_PIXELS_OFF (CAM_FRAME_PITCHES_OFF + 3 * sizeof(uint16_t))
+
+typedef struct CamPool CamPool;
+
+typedef struct CamFrame {
+
+	int                tape;
+	struct frame_times times;
+	uint32_t           format;
+	int                w, h, planes;
+	uint16_t           pitches[3];
+	uint8_t           *pixels[3];	/* Y, V, U - into buf */
+
+	char              *buf;		/* the serialized frame */
+	size_t             size;
+
+	// the pool the buffer belongs to, NULL for a frame of cam_parse
+	CamPool           *pool;
+	size_t             cap;
+	struct CamFrame   *next;
+	struct CamFrame   *all_next;	/* every frame of the pool, free or not */
+
+} CamFrame;
+
+struct CamPool {
+
+	pthread_mutex_t    lock;
+	CamFrame          *free;
+	CamFrame          *all;
+	int                frames;	/* allocated, free or not */
+};
+
+typedef struct CamClient {
+
+	Transport         *transport;
+	CamPool            pool;
+	int                pinned;	/* commit hands the frames in pinned */
+
+} CamClient;
+
+/*
+ * Open a client on a transport (NULL = $SMARTHOME_TRANSPORT or chardev),
+ * role is TRANSPORT_WRITER or TRANSPORT_READER. NULL on failure.
+ */
+CamClient *cam_open(const char *backend, int role);
+void cam_close(CamClient *c);
+
+static inline Transport *cam_transport(CamClient *c) { return c->transport; }
+
+/*
+ * Bytes of the serialized frame of a w x h camera
+ */
+size_t cam_frame_size(int w, int h);
+
+/*
+ * Writer - a frame of camera 'tape' with its header set, the caller fills
+ * pixels (and times). commit sends it and gives it back to the pool,
+ * -EAGAIN means the POLICY_DROP backpressure dropped it. NULL with errno
+ * E2BIG if a w x h frame doesn't fit in a camera, ENOMEM if out of memory.
+ */
+CamFrame *cam_acquire(CamClient *c, int tape, int w, int h);
+int cam_commit(CamClient *c, CamFrame *f);
+
+/*
+ * Writer - commit the frames pinned, see IOCTL_WRITE_PINNED.
+ * -EOPNOTSUPP if the transport can't, then they are still copied.
+ */
+int cam_set_pinned(CamClient *c, int on);
+
+/*
+ * Reader - waits for the newest frame of the selected camera. NULL with
+ * errno EAGAIN if the camera was switched during the read (try again),
+ * EBADMSG if the frame isn't one.
+ */
+CamFrame *cam_wait_frame(CamClient *c);
+
+/*
+ * Give a frame back to its pool without sending it
+ */
+void cam_release(CamFrame *f);
+
+/*
+ * Fill f from a serialized frame the caller owns (e.g. in a frame cache),
+ * it can be committed like an acquired one. FAIL if it isn't a frame.
+ */
+int cam_parse(CamFrame *f, char *buf, size_t len);
+
+/*
+ * Everything about the cameras in one call, and the camera to read
+ */
+static inline int cam_status(CamClient *c, struct cam_status *st) { return transport_get_status(c->transport, st); }
+static inline int cam_select(CamClient *c, int tape) { return transport_change_tape(c->transport, tape); }
+
+/*
+ * Read only a rectangle of every frame, scaled down (see IOCTL_SET_ROI),
+ * the frames come as frames of that size. -EOPNOTSUPP if the transport can't.
+ */
+static inline int cam_set_roi(CamClient *c, const struct cam_roi *roi) { return transport_set_roi(c->transport, roi); }
+
+#endif
@@ -0,0 +1,250 @@
+/*
+ *  cpu_budget.c - the CPU budget of the cameras (see cpu_budget.h)
+ */
+
+#include "cpu_budget.h"
+
+#include <string.h>
+#include <time.h>
+
+#define EWMA(avg, x) ((avg) = (avg) ? 0.5 * (avg) + 0.5 * (x) : (x))
+
+static const char *prio_names[PRIO_NUM] = { "selected", "active", "idle" };
+static const char *skip_names[SKIP_NUM] = { "none", "nonref", "nonkey" };
+
+void budget_init(CpuBudget *b, int percent) {
+
+	memset(b, 0, sizeof(CpuBudget));
+	pthread_mutex_init(&b->lock, NULL);
+	b->budget = percent * 10000000.0;	// 100% = 1e9 ns per second
+}
+
+void budget_reset(CpuBudget *b, int tape) {
+
+	pthread_mutex_lock(&b->lock);
+	memset(&b->cam[tape], 0, sizeof(BudgetCam));
+	pthread_mutex_unlock(&b->lock);
+}
+
+uint64_t budget_cpu_ns(void) {
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void budget_decoded(CpuBudget *b, int tape, uint64_t cpu_ns, int finished) {
+
+	pthread_mutex_lock(&b->lock);
+	b->cam[tape].decode_ns += cpu_ns;
+	if (finished)
+		b->cam[tape].decoded++;
+	pthread_mutex_unlock(&b->lock);
+}
+
+void budget_converted(CpuBudget *b, int tape, uint64_t cpu_ns) {
+
+	pthread_mutex_lock(&b->lock);
+	b->cam[tape].convert_ns += cpu_ns;
+	b->cam[tape].converted++;
+	pthread_mutex_unlock(&b->lock);
+}
+
+int budget_admit(CpuBudget *b, int tape, uint64_t due_ns, uint64_t now_ns) {
+
+	BudgetCam *c = &b->cam[tape];
+	int admit = 1;
+
+	if (!b->budget)
+		return 1;
+
+	pthread_mutex_lock(&b->lock);
+	// a late frame would only add latency, the next one is on time
+	if (now_ns > due_ns + BUDGET_LATE_MS * 1000000ULL) {
+		c->late++;
+		admit = 0;
+	}
+	else if (c->interval_ns) {
+		if (now_ns < c->next_ns)
+			admit = 0;
+		else {
+			// one slot of catching up at most
+			if (c->next_ns + c->interval_ns < now_ns)
+				c->next_ns = now_ns - c->interval_ns;
+			c->next_ns += c->interval_ns;
+		}
+	}
+	if (!admit)
+		c->shed++;
+	pthread_mutex_unlock(&b->lock);
+	return admit;
+}
+
+int budget_skip(CpuBudget *b, int tape) {
+
+	int skip;
+
+	pthread_mutex_lock(&b->lock);
+	skip = b->cam[tape].skip;
+	pthread_mutex_unlock(&b->lock);
+	return skip;
+}
+
+/*
+ * CPU ns per second of the camera at a skip level and frame rate, a level
+ * that wasn't measured yet is taken as the current one
+ */
+static double need(BudgetCam *c, int skip, double fps) {
+
+	double decode = c->decode_at[skip] ? c->decode_at[skip] : c->decode_load;
+
+	return decode + fps * c->convert_cost;
+}
+
+static double full_fps(BudgetCam *c) {
+
+	return c->fps_at[SKIP_NONE] ? c->fps_at[SKIP_NONE] : c->fps;
+}
+
+static double min_fps(BudgetCam *c) {
+
+	return c->fps < BUDGET_MIN_FPS ? c->fps : BUDGET_MIN_FPS;
+}
+
+/*
+ * Update the estimates of the camera from the last period
+ */
+static void measure(BudgetCam *c, double sec) {
+
+	EWMA(c->fps, c->decoded / sec);
+	EWMA(c->decode_load, c->decode_ns / sec);
+	EWMA(c->converted_fps, c->converted / sec);
+	if (c->converted)
+		EWMA(c->convert_cost, (double)c->convert_ns / c->converted);
+	c->decode_at[c->skip] = c->decode_load;
+	c->fps_at[c->skip] = c->fps;
+
+	c->decode_ns = c->convert_ns = 0;
+	c->decoded = c->converted = 0;
+}
+
+void budget_plan(CpuBudget *b, int selected, uint32_t motion, uint32_t playing, uint64_t now_ns) {
+
+	int i, p;
+	double sec, rem, want, give, full, target;
+	BudgetCam *c;
+
+	pthread_mutex_lock(&b->lock);
+	if (!b->budget || !b->last_plan_ns) {
+		b->last_plan_ns = now_ns;
+		pthread_mutex_unlock(&b->lock);
+		return;
+	}
+	sec = (now_ns - b->last_plan_ns) / 1e9;
+	b->last_plan_ns = now_ns;
+	if (sec <= 0) {
+		pthread_mutex_unlock(&b->lock);
+		return;
+	}
+
+	for (i = 0; i < CAM_NUM; i++) {
+		c = &b->cam[i];
+		c->playing = !!(playing & (1 << i));
+		if (!c->playing)
+			continue;
+		measure(c, sec);
+		if (motion & (1 << i))
+			c->last_motion_ns = now_ns;
+		if (i == selected)
+			c->prio = PRIO_SELECTED;
+		else if (c->last_motion_ns && now_ns - c->last_motion_ns < BUDGET_HOLD_MS * 1000000ULL)
+			c->prio = PRIO_ACTIVE;
+		else
+			c->prio = PRIO_IDLE;
+	}
+
+	/*
+	 * First the selected camera at its full rate and everyone else at the
+	 * minimum rate (as cheap as it decodes now), by priority, then what
+	 * is left tier by tier.
+	 */
+	rem = b->budget;
+	for (p = 0; p < PRIO_NUM; p++)
+		for (i = 0; i < CAM_NUM; i++) {
+			c = &b->cam[i];
+			if (!c->playing || c->prio != p)
+				continue;
+			if (p == PRIO_SELECTED)
+				want = need(c, SKIP_NONE, full_fps(c));
+			else
+				want = need(c, c->skip, min_fps(c));
+			c->share = want < rem ? want : (rem > 0 ? rem : 0);
+			rem -= c->share;
+		}
+	for (p = PRIO_ACTIVE; p < PRIO_NUM; p++) {
+		want = 0;
+		for (i = 0; i < CAM_NUM; i++) {
+			c = &b->cam[i];
+			full = need(c, SKIP_NONE, full_fps(c));
+			if (c->playing && c->prio == p && full > c->share)
+				want += full - c->share;
+		}
+		give = want < rem ? want : (rem > 0 ? rem : 0);
+		for (i = 0; i < CAM_NUM && want > 0; i++) {
+			c = &b->cam[i];
+			full = need(c, SKIP_NONE, full_fps(c));
+			if (c->playing && c->prio == p && full > c->share)
+				c->share += (full - c->share) * give / want;
+		}
+		rem -= give;
+	}
+
+	for (i = 0; i < CAM_NUM; i++) {
+		c = &b->cam[i];
+		if (!c->playing)
+			continue;
+
+		// decoding alone is over the share - skip more of it, or less when it fits again
+		if (c->share < c->decode_load * 0.95 && c->skip < SKIP_NONKEY)
+			c->skip++;
+		else if (c->skip > SKIP_NONE && c->share > need(c, c->skip - 1, min_fps(c)) * 1.2)
+			c->skip--;
+
+		// what is left after decoding goes to converting
+		if (!c->convert_cost || !c->fps) {
+			c->target_fps = c->fps;
+			c->interval_ns = 0;	// nothing measured yet
+			continue;
+		}
+		target = (c->share - c->decode_load) / c->convert_cost;
+		if (target >= c->fps * 0.98) {
+			c->target_fps = c->fps;
+			c->interval_ns = 0;
+		}
+		else {
+			c->target_fps = target > 0.1 ? target : 0.1;
+			c->interval_ns = 1e9 / c->target_fps;
+		}
+	}
+	pthread_mutex_unlock(&b->lock);
+}
+
+void budget_dump(CpuBudget *b, FILE *out) {
+
+	int i;
+	BudgetCam *c;
+
+	pthread_mutex_lock(&b->lock);
+	fprintf(out, "budget %.0f%%\n", b->budget / 1e7);
+	for (i = 0; i < CAM_NUM; i++) {
+		c = &b->cam[i];
+		if (!c->playing)
+			continue;
+		fprintf(out, "%d %-8s fps %5.1f target %5.1f cpu %5.1f%% share %5.1f%% skip %-6s shed %lu late %lu\n",
+			i + 1, prio_names[c->prio], c->fps, c->target_fps,
+			(c->decode_load + c->converted_fps * c->convert_cost) / 1e7, c->share / 1e7,
+			skip_names[c->skip], c->shed, c->late);
+	}
+	pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,126 @@
+/*
+ *  cpu_budget.h - share a CPU budget between the cameras of write_user
+ *
+ *  Every camera thread measures what its frames cost (thread CPU time of
+ *  decoding, and of converting and sending). The budget is split by
+ *  priority: the camera the reader shows first, then the cameras with
+ *  motion in the last BUDGET_HOLD_MS, then the rest. Everyone keeps
+ *  BUDGET_MIN_FPS while the budget allows it.
+ *
+ *  A camera over its share loses frame rate, never latency: frames are
+ *  decoded on time and the ones between its target rate slots, or late,
+ *  are not converted. When even decoding doesn't fit, its decoder skips
+ *  the non reference frames, then everything but the keyframes.
+ *
+ *  budget_plan() runs every BUDGET_PERIOD_MS, the camera threads only ask
+ *  budget_admit() about every decoded frame.
+ */
+#ifndef CPU_BUDGET_H
+#define CPU_BUDGET_H
+
+#include "../chardev.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define BUDGET_PERIOD_MS 500
+#define BUDGET_HOLD_MS 5000
+#define BUDGET_MIN_FPS 1.0
+#define BUDGET_LATE_MS 100	/* a frame this late is shed */
+
+enum {
+	PRIO_SELECTED,
+	PRIO_ACTIVE,
+	PRIO_IDLE,
+	PRIO_NUM
+};
+
+/*
+ * How much of the decoding is skipped (AVDISCARD_DEFAULT/NONREF/NONKEY)
+ */
+enum {
+	SKIP_NONE,
+	SKIP_NONREF,
+	SKIP_NONKEY,
+	SKIP_NUM
+};
+
+typedef struct BudgetCam {
+
+	// from the camera thread, since the last plan
+	uint64_t  decode_ns, convert_ns;	/* thread CPU time */
+	unsigned  decoded, converted;
+
+	// the estimates, moving averages over the plans
+	double    fps;			/* decoded per second */
+	double    decode_load;		/* CPU ns per second */
+	double    decode_at[SKIP_NUM];	/* decode_load at every skip level */
+	double    fps_at[SKIP_NUM];
+	double    convert_cost;		/* CPU ns per converted frame */
+	double    converted_fps;
+
+	// the plan
+	int       playing, prio, skip;
+	double    share;		/* CPU ns per second */
+	double    target_fps;
+	uint64_t  interval_ns, next_ns;
+	uint64_t  last_motion_ns;
+
+	unsigned long shed, late;
+
+} BudgetCam;
+
+typedef struct CpuBudget {
+
+	pthread_mutex_t lock;
+	double          budget;		/* CPU ns per second, 0 = no budget */
+	uint64_t        last_plan_ns;
+	BudgetCam       cam[CAM_NUM];
+
+} CpuBudget;
+
+/*
+ * percent of one CPU, e.g. 150 is one and a half cores
+ */
+void budget_init(CpuBudget *b, int percent);
+
+/*
+ * A new source on the camera, forget what the old one cost
+ */
+void budget_reset(CpuBudget *b, int tape);
+
+/*
+ * CLOCK_THREAD_CPUTIME_ID in nanoseconds
+ */
+uint64_t budget_cpu_ns(void);
+
+/*
+ * The camera thread - the cost of a decode call (finished or not), and of
+ * converting and sending a frame
+ */
+void budget_decoded(CpuBudget *b, int tape, uint64_t cpu_ns, int finished);
+void budget_converted(CpuBudget *b, int tape, uint64_t cpu_ns);
+
+/*
+ * The camera thread - 1 to convert the frame due at due_ns, 0 to shed it
+ */
+int budget_admit(CpuBudget *b, int tape, uint64_t due_ns, uint64_t now_ns);
+
+/*
+ * The skip level the camera's decoder should have
+ */
+int budget_skip(CpuBudget *b, int tape);
+
+/*
+ * A new plan, from the camera the reader shows, the cameras with motion
+ * and the cameras that play (bitmasks)
+ */
+void budget_plan(CpuBudget *b, int selected, uint32_t motion, uint32_t playing, uint64_t now_ns);
+
+/*
+ * The current allocation, a line per playing camera
+ */
+void budget_dump(CpuBudget *b, FILE *out);
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ *  decoder.c - demux and decode setup (see decoder.h)
+ */
+
+#include "decoder.h"
+#include "../chardev.h"
+
+#include <stdio.h>
+
+int decoder_open(const char *filename, FileIO *io, AVDictionary *opts, AVFormatContext **fmt, int *stream, AVCodecContext **codec, int threads) {
+
+	int i, ret;
+	AVCodec *pCodec;
+	AVDictionary *fmt_opts = NULL, *codec_opts = NULL;
+
+	// mapped, or libavformat's own reading when it can't be
+	if(io && file_io_open(io, filename) == SUCCESS) {
+		if(!*fmt)
+			*fmt = avformat_alloc_context();
+		if(!*fmt) {
+			file_io_close(io);
+			return FAIL;
+		}
+		(*fmt)->pb = io->avio;
+		(*fmt)->flags |= AVFMT_FLAG_CUSTOM_IO;
+	}
+
+	// Open video file
+	av_dict_copy(&fmt_opts, opts, 0);
+	ret = avformat_open_input(fmt, filename, NULL, &fmt_opts);
+	av_dict_free(&fmt_opts);
+	if(ret!=0) {
+		fprintf(stderr, "can't open %s\n", filename);
+		if(io)
+			file_io_close(io);
+		return FAIL;
+	}
+
+	// Retrieve stream information
+	if(avformat_find_stream_info(*fmt, NULL)<0)
+		goto fail;
+
+	// Find the first video stream
+	*stream=-1;
+	for(i=0; i<(*fmt)->nb_streams; i++)
+		if((*fmt)->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO) {
+			*stream=i;
+			break;
+		}
+	if(*stream==-1) {
+		fprintf(stderr, "%s: no video stream\n", filename);
+		goto fail;
+	}
+
+	// Get a pointer to the codec context for the video stream
+	*codec=(*fmt)->streams[*stream]->codec;
+
+	// Find the decoder for the video stream
+	pCodec=avcodec_find_decoder((*codec)->codec_id);
+	if(pCodec==NULL) {
+		fprintf(stderr, "%s: unsupported codec!\n", filename);
+		goto fail;
+	}
+
+	// Open codec
+	(*codec)->thread_count = threads;
+	av_dict_copy(&codec_opts, opts, 0);
+	ret = avcodec_open2(*codec, pCodec, &codec_opts);
+	av_dict_free(&codec_opts);
+	if(ret<0)
+		goto fail;
+
+	return SUCCESS;
+
+fail:
+	avformat_close_input(fmt);
+	if(io)
+		file_io_close(io);
+	return FAIL;
+}
+
+void decoder_close(FileIO *io, AVFormatContext **fmt, AVCodecContext *codec) {
+
+	// Close the codec
+	avcodec_close(codec);
+
+	// Close the video file, and its mapping
+	avformat_close_input(fmt);
+	if(io)
+		file_io_close(io);
+}
+
+int has_luma_plane(enum PixelFormat pix_fmt) {
+
+	switch(pix_fmt) {
+	case PIX_FMT_YUV420P: case PIX_FMT_YUVJ420P:
+	case PIX_FMT_YUV422P: case PIX_FMT_YUVJ422P:
+	case PIX_FMT_YUV444P: case PIX_FMT_YUVJ444P:
+	case PIX_FMT_NV12:    case PIX_FMT_GRAY8:
+		return 1;
+	default:
+		return 0;
+	}
+}
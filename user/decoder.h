@@ -0,0 +1,30 @@
+/*
+ *  decoder.h - demux and decode setup of a video file
+ *
+ *  The first video stream of the file and its decoder, opened the same way
+ *  by write_user and by scan_footage.
+ */
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+#include "file_io.h"
+
+/*
+ * Open the file and the decoder of its first video stream, threads is the
+ * decoder's thread count (0 = libavcodec decides). With io (and its
+ * readahead set) the file is read through file_io. opts (may be NULL) go
+ * to both the demuxer and the decoder, each takes what it knows. *fmt may
+ * be allocated already (e.g. with an interrupt callback). FAIL with a message.
+ */
+int decoder_open(const char *filename, FileIO *io, AVDictionary *opts, AVFormatContext **fmt, int *stream, AVCodecContext **codec, int threads);
+void decoder_close(FileIO *io, AVFormatContext **fmt, AVCodecContext *codec);
+
+/*
+ * Pixel formats whose first plane is the full size 8 bit luma
+ */
+int has_luma_plane(enum PixelFormat pix_fmt);
+
+#endif
@@ -0,0 +1,233 @@
+/*
+ *  file_io.c - mmap input with a shared read-ahead (see file_io.h)
+ */
+
+#define _GNU_SOURCE		/* readahead */
+
+#include "file_io.h"
+#include "../chardev.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * The read-ahead thread and its queue, started with the first file
+ */
+static pthread_mutex_t ra_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ra_cond = PTHREAD_COND_INITIALIZER;
+static FileIO *ra_head, *ra_tail;
+static FileIO *ra_busy;
+static int ra_started;
+
+static void *readahead_thread(void *arg) {
+
+	FileIO *io;
+	size_t off, len;
+
+	pthread_mutex_lock(&ra_lock);
+	for (;;) {
+		while (!ra_head)
+			pthread_cond_wait(&ra_cond, &ra_lock);
+		io = ra_head;
+		ra_head = io->next;
+		if (!ra_head)
+			ra_tail = NULL;
+		io->queued = 0;
+		off = io->req_off;
+		len = io->req_len;
+		ra_busy = io;
+		pthread_mutex_unlock(&ra_lock);
+
+		// one large sequential read into the page cache
+		readahead(io->fd, off, len);
+
+		pthread_mutex_lock(&ra_lock);
+		io->prefetched += len;
+		ra_busy = NULL;
+		pthread_cond_broadcast(&ra_cond);
+	}
+	return NULL;
+}
+
+/*
+ * Queue [off, off+len) of the file, or add it to what is queued already
+ */
+static void ra_queue(FileIO *io, size_t off, size_t len) {
+
+	pthread_mutex_lock(&ra_lock);
+	if (io->queued && io->req_off + io->req_len == off)
+		io->req_len += len;
+	else {
+		// a seek, what was queued isn't wanted anymore
+		io->req_off = off;
+		io->req_len = len;
+		if (!io->queued) {
+			io->queued = 1;
+			io->next = NULL;
+			if (ra_tail)
+				ra_tail->next = io;
+			else
+				ra_head = io;
+			ra_tail = io;
+		}
+	}
+	pthread_cond_broadcast(&ra_cond);
+	pthread_mutex_unlock(&ra_lock);
+}
+
+/*
+ * Queue the next window once less than half of this one is left
+ */
+static void ra_want(FileIO *io) {
+
+	size_t end = io->pos + io->readahead < io->size ? io->pos + io->readahead : io->size;
+
+	if (io->pos < io->win_start || io->pos > io->win_end)
+		io->win_start = io->win_end = io->pos;
+	if (io->win_end >= end || io->win_end - io->pos > io->readahead / 2)
+		return;
+	ra_queue(io, io->win_end, end - io->win_end);
+	io->win_end = end;
+}
+
+static int io_read(void *opaque, uint8_t *buf, int size) {
+
+	FileIO *io = (FileIO *)opaque;
+	size_t n = io->size - io->pos;
+	uint64_t start;
+
+	if (!n)
+		return AVERROR_EOF;
+	if (n > (size_t)size)
+		n = size;
+
+	start = latency_now_ns();
+	memcpy(buf, io->map + io->pos, n);
+	// the control socket's list reads these while we decode
+	__atomic_fetch_add(&io->wait_ns, latency_now_ns() - start, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&io->bytes, n, __ATOMIC_RELAXED);
+	io->pos += n;
+	ra_want(io);
+	return n;
+}
+
+static int64_t io_seek(void *opaque, int64_t offset, int whence) {
+
+	FileIO *io = (FileIO *)opaque;
+
+	switch (whence & ~AVSEEK_FORCE) {
+	case AVSEEK_SIZE:
+		return io->size;
+	case SEEK_SET:
+		break;
+	case SEEK_CUR:
+		offset += io->pos;
+		break;
+	case SEEK_END:
+		offset += io->size;
+		break;
+	default:
+		return -1;
+	}
+	if (offset < 0 || offset > io->size)
+		return -1;
+	io->pos = offset;
+	ra_want(io);
+	return offset;
+}
+
+int file_io_open(FileIO *io, const char *filename) {
+
+	struct stat st;
+	uint8_t *buf;
+	pthread_t thread;
+
+	io->fd = -1;
+	io->map = NULL;
+	io->avio = NULL;
+	if (!io->readahead)
+		return FAIL;
+
+	io->fd = open(filename, O_RDONLY);
+	if (io->fd < 0)
+		return FAIL;
+	if (fstat(io->fd, &st) < 0 || !S_ISREG(st.st_mode) || !st.st_size)
+		goto fail;
+	io->size = st.st_size;
+	io->map = mmap(NULL, io->size, PROT_READ, MAP_SHARED, io->fd, 0);
+	if (io->map == MAP_FAILED) {
+		io->map = NULL;
+		goto fail;
+	}
+	madvise(io->map, io->size, MADV_SEQUENTIAL);
+	posix_fadvise(io->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	buf = av_malloc(FILE_IO_BUFFER);
+	if (!buf)
+		goto fail;
+	io->avio = avio_alloc_context(buf, FILE_IO_BUFFER, 0, io, io_read, NULL, io_seek);
+	if (!io->avio) {
+		av_free(buf);
+		goto fail;
+	}
+
+	pthread_mutex_lock(&ra_lock);
+	if (!ra_started && !pthread_create(&thread, NULL, readahead_thread, NULL))
+		ra_started = 1;
+	pthread_mutex_unlock(&ra_lock);
+
+	io->pos = io->win_start = io->win_end = 0;
+	io->queued = 0;
+	__atomic_store_n(&io->wait_ns, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&io->bytes, 0, __ATOMIC_RELAXED);
+	io->prefetched = 0;
+	ra_want(io);
+	return SUCCESS;
+
+fail:
+	if (io->map)
+		munmap(io->map, io->size);
+	io->map = NULL;
+	close(io->fd);
+	io->fd = -1;
+	return FAIL;
+}
+
+void file_io_close(FileIO *io) {
+
+	FileIO *q, *prev;
+
+	if (!io->avio)
+		return;
+
+	// out of the queue, and not in the read-ahead thread's hands
+	pthread_mutex_lock(&ra_lock);
+	if (io->queued) {
+		prev = NULL;
+		for (q = ra_head; q != io; q = q->next)
+			prev = q;
+		if (prev)
+			prev->next = io->next;
+		else
+			ra_head = io->next;
+		if (ra_tail == io)
+			ra_tail = prev;
+		io->queued = 0;
+	}
+	while (ra_busy == io)
+		pthread_cond_wait(&ra_cond, &ra_lock);
+	pthread_mutex_unlock(&ra_lock);
+
+	av_freep(&io->avio->buffer);
+	av_freep(&io->avio);
+	munmap(io->map, io->size);
+	io->map = NULL;
+	close(io->fd);
+	io->fd = -1;
+}
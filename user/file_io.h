@@ -0,0 +1,57 @@
+/*
+ *  file_io.h - mmap input with a shared read-ahead for the camera sources
+ *
+ *  libavformat reads a file in small buffers, and ten cameras on one disk
+ *  make that a storm of small reads all over it. Instead, a source file is
+ *  mapped and libavformat gets an AVIOContext that copies out of the
+ *  mapping. One read-ahead thread, shared by all the cameras, reads the
+ *  next window of every file into the page cache with large sequential
+ *  readahead() calls, one file at a time. When a camera is half way
+ *  through its window the next one is queued, so demuxing finds its
+ *  pages in memory and doesn't stall decoding.
+ *
+ *  The time a camera spends in the copy (the page faults of what the
+ *  read-ahead didn't get to yet) is its I/O wait.
+ *
+ *  Anything that can't be mapped (a pipe, a URL) falls back to libavformat.
+ */
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include <libavformat/avformat.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FILE_IO_BUFFER (256 * 1024)	/* the AVIOContext buffer */
+
+typedef struct FileIO {
+
+	size_t          readahead;	/* window, set by the caller, 0 = off */
+
+	int             fd;
+	uint8_t        *map;
+	size_t          size, pos;
+	AVIOContext    *avio;
+
+	// the window read ahead (or queued), [win_start, win_end)
+	size_t          win_start, win_end;
+
+	// a queued read-ahead, under the lock of the read-ahead thread
+	size_t          req_off, req_len;
+	int             queued;
+	struct FileIO  *next;
+
+	// wait_ns and bytes are read by other threads, atomic
+	uint64_t        wait_ns, bytes, prefetched;
+
+} FileIO;
+
+/*
+ * Map the file and make its AVIOContext, FAIL if the file can't be mapped
+ * or io->readahead is 0 (then let libavformat open it)
+ */
+int file_io_open(FileIO *io, const char *filename);
+void file_io_close(FileIO *io);
+
+#endif
@@ -0,0 +1,200 @@
+/*
+ *  frame_cache.c - a file of converted frames, so looped cameras decode once
+ */
+
+#include "../chardev.h"
+#include "frame_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>		/* basename */
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+static int write_all(int fd, const void *buf, size_t len) {
+
+	ssize_t n;
+	const char *p = buf;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FAIL;
+		p += n;
+		len -= n;
+	}
+	return SUCCESS;
+}
+
+int frame_cache_map(FrameCache *fc, const char *path) {
+
+	struct stat st;
+	FrameCacheHeader *hdr;
+	uint32_t i;
+
+	fc->map = NULL;
+	fc->fd = open(path, O_RDONLY);
+	if (fc->fd < 0 || fstat(fc->fd, &st) < 0 || st.st_size < (off_t)sizeof(FrameCacheHeader))
+		goto fail;
+
+	// private and writable, the caller patches tape and times in place
+	fc->map_len = st.st_size;
+	fc->map = mmap(NULL, fc->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fc->fd, 0);
+	if (fc->map == MAP_FAILED) {
+		fc->map = NULL;
+		goto fail;
+	}
+
+	hdr = (FrameCacheHeader *)fc->map;
+	if (hdr->magic != FRAME_CACHE_MAGIC || hdr->version != FRAME_CACHE_VERSION || !hdr->frames ||
+			hdr->index_off + (uint64_t)hdr->frames * sizeof(FrameCacheEntry) > fc->map_len ||
+			sizeof(FrameCacheHeader) + (uint64_t)hdr->frames * hdr->frame_size > hdr->index_off)
+		goto fail;
+
+	fc->hdr = *hdr;
+	fc->entries = (FrameCacheEntry *)(fc->map + hdr->index_off);
+
+	// every frame has to lie between the header and the index
+	for (i = 0; i < hdr->frames; i++)
+		if (fc->entries[i].offset < sizeof(FrameCacheHeader) ||
+				fc->entries[i].offset > hdr->index_off - hdr->frame_size)
+			goto fail;
+
+	// we go through it in order, over and over
+	madvise(fc->map, fc->map_len, MADV_SEQUENTIAL);
+	return SUCCESS;
+
+fail:
+	if (fc->map)
+		munmap(fc->map, fc->map_len);
+	if (fc->fd >= 0)
+		close(fc->fd);
+	fc->map = NULL;
+	fc->fd = -1;
+	return FAIL;
+}
+
+int frame_cache_open(FrameCache *fc, const char *dir, const char *src, int w, int h, size_t frame_size) {
+
+	struct stat st;
+	char *name;
+	size_t len;
+
+	memset(fc, 0, sizeof(FrameCache));
+	fc->fd = -1;
+
+	if (stat(src, &st) < 0)
+		return FAIL;
+
+	name = strdup(src);
+	len = strlen(dir) + strlen(src) + 64;
+	fc->path = malloc(len);
+	fc->tmp_path = malloc(len + 16);
+	if (!name || !fc->path || !fc->tmp_path) {
+		free(name);
+		frame_cache_close(fc);
+		return FAIL;
+	}
+	snprintf(fc->path, len, "%s/%s.%dx%d.yuvcache", dir, basename(name), w, h);
+	snprintf(fc->tmp_path, len + 16, "%s.XXXXXX", fc->path);
+	free(name);
+
+	if (frame_cache_map(fc, fc->path) == SUCCESS) {
+		if (fc->hdr.w == w && fc->hdr.h == h && fc->hdr.frame_size == frame_size &&
+				fc->hdr.src_size == st.st_size && fc->hdr.src_mtime == st.st_mtime)
+			return 1;
+		// made of another version of the video, build it again
+		munmap(fc->map, fc->map_len);
+		close(fc->fd);
+		fc->map = NULL;
+		fc->fd = -1;
+	}
+
+	fc->hdr.magic = FRAME_CACHE_MAGIC;
+	fc->hdr.version = FRAME_CACHE_VERSION;
+	fc->hdr.w = w;
+	fc->hdr.h = h;
+	fc->hdr.frame_size = frame_size;
+	fc->hdr.frames = 0;
+	fc->hdr.index_off = sizeof(FrameCacheHeader);
+	fc->hdr.src_size = st.st_size;
+	fc->hdr.src_mtime = st.st_mtime;
+
+	// build it aside, and only a finished cache gets the real name.
+	// Cameras looping the same video build at once, each in its own file
+	fc->fd = mkstemp(fc->tmp_path);
+	if (fc->fd < 0 || fchmod(fc->fd, 0644) < 0 ||
+			write_all(fc->fd, &fc->hdr, sizeof(FrameCacheHeader)) < 0) {
+		frame_cache_close(fc);
+		return FAIL;
+	}
+	return 0;
+}
+
+int frame_cache_append(FrameCache *fc, const char *frame, uint64_t pts_ns) {
+
+	FrameCacheEntry *index;
+
+	if (fc->hdr.frames == fc->cap) {
+		fc->cap = fc->cap ? fc->cap * 2 : 1024;
+		index = realloc(fc->index, fc->cap * sizeof(FrameCacheEntry));
+		if (!index)
+			return FAIL;
+		fc->index = index;
+	}
+
+	if (write_all(fc->fd, frame, fc->hdr.frame_size) < 0)
+		return FAIL;
+	fc->index[fc->hdr.frames].offset = fc->hdr.index_off;
+	fc->index[fc->hdr.frames].pts_ns = pts_ns;
+	fc->hdr.frames++;
+	fc->hdr.index_off += fc->hdr.frame_size;
+	return SUCCESS;
+}
+
+int frame_cache_finish(FrameCache *fc) {
+
+	if (!fc->hdr.frames ||
+			write_all(fc->fd, fc->index, fc->hdr.frames * sizeof(FrameCacheEntry)) < 0 ||
+			pwrite(fc->fd, &fc->hdr, sizeof(FrameCacheHeader), 0) != sizeof(FrameCacheHeader) ||
+			rename(fc->tmp_path, fc->path) < 0) {
+		frame_cache_close(fc);
+		return FAIL;
+	}
+
+	close(fc->fd);
+	free(fc->index);
+	fc->index = NULL;
+	fc->cap = 0;
+	return frame_cache_map(fc, fc->path);
+}
+
+char *frame_cache_frame(FrameCache *fc, uint32_t i, uint64_t *pts_ns) {
+
+	if (i >= fc->hdr.frames)
+		return NULL;
+	if (pts_ns)
+		*pts_ns = fc->entries[i].pts_ns;
+	return fc->map + fc->entries[i].offset;
+}
+
+void frame_cache_close(FrameCache *fc) {
+
+	if (fc->map)
+		munmap(fc->map, fc->map_len);
+	else if (fc->fd >= 0 && fc->tmp_path)
+		unlink(fc->tmp_path);	// never finished
+	if (fc->fd >= 0)
+		close(fc->fd);
+	free(fc->index);
+	free(fc->path);
+	free(fc->tmp_path);
+	memset(fc, 0, sizeof(FrameCache));
+	fc->fd = -1;
+}
@@ -0,0 +1,91 @@
+/*
+ *  frame_cache.h - a file of converted frames, so looped cameras decode once
+ *
+ *  The first pass over a video appends every serialized frame (exactly
+ *  what overlay_to_buf produced) to <dir>/<video name>.<w>x<h>.yuvcache,
+ *  then the file gets an index and is mapped. Later passes, and later runs,
+ *  send the frames straight from the mapping with no libavcodec or swscale.
+ *
+ *	[FrameCacheHeader][frame 0][frame 1]...[FrameCacheEntry x frames]
+ *
+ *  All frames of a camera have the same size. The mapping is private, so
+ *  the caller may patch the tape and frame times of a frame in place.
+ *  A cache is rebuilt when the video's size or mtime or the frame size
+ *  don't match any more.
+ */
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_CACHE_MAGIC 0x534d4643	/* "SMFC" */
+#define FRAME_CACHE_VERSION 2	/* 2: chroma planes of (w+1)/2 x (h+1)/2 */
+
+typedef struct FrameCacheHeader {
+
+	uint32_t magic, version;
+	int32_t  w, h;
+	uint64_t frame_size;
+	uint32_t frames;
+	uint32_t pad;
+	uint64_t index_off;
+	int64_t  src_size, src_mtime;	/* of the video it was made of */
+
+} FrameCacheHeader;
+
+typedef struct FrameCacheEntry {
+
+	uint64_t offset;
+	uint64_t pts_ns;		/* from the first frame */
+
+} FrameCacheEntry;
+
+typedef struct FrameCache {
+
+	char             *path, *tmp_path;
+	int               fd;
+	FrameCacheHeader  hdr;
+
+	// while building
+	FrameCacheEntry  *index;
+	uint32_t          cap;
+
+	// once mapped
+	char             *map;
+	size_t            map_len;
+	FrameCacheEntry  *entries;
+
+} FrameCache;
+
+/*
+ * Open the cache of video 'src' in 'dir'. Returns 1 if a valid cache was
+ * mapped, 0 if a new one is being built (append, then finish), FAIL on error.
+ */
+int frame_cache_open(FrameCache *fc, const char *dir, const char *src, int w, int h, size_t frame_size);
+
+/*
+ * Map an existing cache file as it is (e.g. for bench_transport)
+ */
+int frame_cache_map(FrameCache *fc, const char *path);
+
+int frame_cache_append(FrameCache *fc, const char *frame, uint64_t pts_ns);
+
+/*
+ * Write the index, move the file in place and map it
+ */
+int frame_cache_finish(FrameCache *fc);
+
+static inline uint32_t frame_cache_frames(const FrameCache *fc) { return fc->map ? fc->hdr.frames : 0; }
+
+/*
+ * Frame i of a mapped cache, and its timestamp
+ */
+char *frame_cache_frame(FrameCache *fc, uint32_t i, uint64_t *pts_ns);
+
+/*
+ * Unmap, or throw away a cache that wasn't finished
+ */
+void frame_cache_close(FrameCache *fc);
+
+#endif
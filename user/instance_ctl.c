@@ -0,0 +1,77 @@
+/*
+ *  instance_ctl.c - create, destroy and list the instances of the module
+ *
+ *  Usage: instance_ctl.out create [cams] [bytes per camera]
+ *	   instance_ctl.out destroy <instance>
+ *	   instance_ctl.out list
+ *
+ *  Talks to the control node (mknod /dev/smarthome_ctl c 101 255).
+ *  Use an instance with '-t chardev:<instance>' on the applications.
+ */
+
+#include "../chardev.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>		/* open */
+#include <unistd.h>		/* close */
+#include <sys/ioctl.h>		/* ioctl */
+
+void usage() {
+
+	fprintf(stderr, "Usage: .exe create [cams] [bytes per camera] | destroy <instance> | list\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+
+	int i, ret_val, file_desc;
+	struct instance_params params;
+
+	if (argc < 2)
+		usage();
+
+	file_desc = open(DEVICE_FILE_NAME_CTL, 0);
+	if (file_desc < 0) {
+		printf("Can't open device file: %s\n", DEVICE_FILE_NAME_CTL);
+		exit(-1);
+	}
+
+	if (!strcmp(argv[1], "create")) {
+		params.id = -1;
+		params.cams = argc > 2 ? atoi(argv[2]) : CAM_NUM;
+		params.cam_len = argc > 3 ? strtoul(argv[3], NULL, 10) : CAM_LEN;
+		ret_val = ioctl(file_desc, IOCTL_CREATE_INSTANCE, &params);
+		if (ret_val < 0) {
+			perror("create instance");
+			exit(-1);
+		}
+		printf("instance %d: %d cameras of %u bytes\n", params.id, params.cams, params.cam_len);
+		printf("mknod %s%d c %d %d\n", DEVICE_FILE_NAME_W, params.id, WRITE_MAJOR_NUM, params.id);
+		printf("mknod %s%d c %d %d\n", DEVICE_FILE_NAME_R, params.id, READ_MAJOR_NUM, params.id);
+		for (i = 0; i < params.cams; i++)
+			printf("mknod %s%d_%d c %d %d\n", DEVICE_FILE_NAME_STREAM, params.id, i, READ_MAJOR_NUM, STREAM_MINOR(params.id, i));
+	}
+	else if (!strcmp(argv[1], "destroy") && argc > 2) {
+		if (ioctl(file_desc, IOCTL_DESTROY_INSTANCE, atoi(argv[2])) < 0) {
+			perror("destroy instance");
+			exit(-1);
+		}
+	}
+	else if (!strcmp(argv[1], "list")) {
+		ret_val = ioctl(file_desc, IOCTL_GET_INSTANCES);
+		if (ret_val < 0) {
+			perror("list instances");
+			exit(-1);
+		}
+		for (i = 0; i < MAX_INSTANCES; i++)
+			if (ret_val & (1 << i))
+				printf("instance %d\n", i);
+	}
+	else
+		usage();
+
+	close(file_desc);
+	return 0;
+}
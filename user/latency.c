@@ -0,0 +1,134 @@
+/*
+ *  latency.c - capture-to-display latency histograms
+ */
+
+#include "latency.h"
+
+#include <string.h>
+
+static const char *stage_names[STAGE_NUM] = {
+	"decode", "submit", "kernel", "fetch", "render", "total"
+};
+
+static int hist_index(uint64_t v) {
+
+	int msb;
+
+	if (v < LATENCY_SUB)
+		return v;
+	msb = 63 - __builtin_clzll(v);
+	return (msb - LATENCY_SUB_BITS + 1) * LATENCY_SUB + ((v >> (msb - LATENCY_SUB_BITS)) & (LATENCY_SUB - 1));
+}
+
+/*
+ * the middle of the values that fall into bucket 'i'
+ */
+static uint64_t hist_value(int i) {
+
+	int shift;
+
+	if (i < LATENCY_SUB)
+		return i;
+	shift = i / LATENCY_SUB - 1;
+	return ((uint64_t)(LATENCY_SUB + i % LATENCY_SUB) << shift) + ((1ULL << shift) >> 1);
+}
+
+void hist_record(LatencyHist *h, uint64_t ns) {
+
+	h->buckets[hist_index(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+uint64_t hist_percentile(const LatencyHist *h, double p) {
+
+	int i;
+	uint64_t seen = 0, want;
+
+	if (!h->count)
+		return 0;
+	want = (uint64_t)(h->count * p / 100.0 + 0.5);
+	if (want < 1)
+		want = 1;
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= want)
+			return hist_value(i) < h->max ? hist_value(i) : h->max;
+	}
+	return h->max;
+}
+
+/*
+ * a stage that was not stamped (old writer, or a transport
+ * that doesn't stamp) or went backwards is not recorded
+ */
+static void record_stage(LatencyHist *h, uint64_t from, uint64_t to) {
+
+	if (from && to && to >= from)
+		hist_record(h, to - from);
+}
+
+void latency_record(LatencyStats *stats, int cam, const struct frame_times *times,
+		uint64_t fetched_ns, uint64_t displayed_ns) {
+
+	LatencyHist *h;
+
+	if (cam < 0 || cam >= CAM_NUM)
+		return;
+	h = stats->hist[cam];
+
+	record_stage(&h[STAGE_DECODE], times->decode_ns, times->capture_ns);
+	record_stage(&h[STAGE_SUBMIT], times->capture_ns, times->enqueue_ns);
+	record_stage(&h[STAGE_KERNEL], times->enqueue_ns, times->dequeue_ns);
+	record_stage(&h[STAGE_FETCH], times->dequeue_ns, fetched_ns);
+	record_stage(&h[STAGE_RENDER], fetched_ns, displayed_ns);
+	record_stage(&h[STAGE_TOTAL], times->capture_ns, displayed_ns);
+}
+
+void hist_merge(LatencyHist *dst, const LatencyHist *src) {
+
+	int i;
+
+	if (!src->count)
+		return;
+	for (i = 0; i < LATENCY_BUCKETS; i++)
+		dst->buckets[i] += src->buckets[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+void latency_merge(LatencyStats *dst, const LatencyStats *src) {
+
+	int cam, st;
+
+	for (cam = 0; cam < CAM_NUM; cam++)
+		for (st = 0; st < STAGE_NUM; st++)
+			hist_merge(&dst->hist[cam][st], &src->hist[cam][st]);
+}
+
+void latency_dump(const LatencyStats *stats, FILE *out) {
+
+	int cam, st;
+	const LatencyHist *h;
+
+	fprintf(out, "%-4s %-7s %10s %10s %10s %10s %10s   (usec)\n",
+			"cam", "stage", "frames", "p50", "p99", "p999", "max");
+
+	for (cam = 0; cam < CAM_NUM; cam++) {
+		if (!stats->hist[cam][STAGE_TOTAL].count && !stats->hist[cam][STAGE_KERNEL].count)
+			continue;
+		for (st = 0; st < STAGE_NUM; st++) {
+			h = &stats->hist[cam][st];
+			fprintf(out, "%-4d %-7s %10llu %10.1f %10.1f %10.1f %10.1f\n",
+					cam + 1, stage_names[st], (unsigned long long)h->count,
+					hist_percentile(h, 50) / 1e3, hist_percentile(h, 99) / 1e3,
+					hist_percentile(h, 99.9) / 1e3, h->max / 1e3);
+		}
+	}
+	fflush(out);
+}
@@ -0,0 +1,88 @@
+/*
+ *  latency.h - capture-to-display latency histograms
+ *
+ *  Every frame carries a struct frame_times (see chardev.h).
+ *  read_user adds the moment the frame was fetched and the moment
+ *  SDL_DisplayYUVOverlay returned, and we split the whole way into stages:
+ *
+ *	decode - write_user decoding the frame   (decode_ns  -> capture_ns)
+ *	submit - convert, serialize, write       (capture_ns -> enqueue_ns)
+ *	kernel - waiting in the camera buffer    (enqueue_ns -> dequeue_ns)
+ *	fetch  - copy to the reader              (dequeue_ns -> fetched)
+ *	render - deserialize and display         (fetched    -> displayed)
+ *	total  - capture to display              (capture_ns -> displayed)
+ *
+ *  In passthrough mode (-p) write_user doesn't decode, so decode is empty
+ *  and render includes decoding the packets in read_user.
+ *
+ *  The histograms are HDR style: log buckets with LATENCY_SUB_BITS bits of
+ *  linear sub buckets each, so every value is kept with ~3% precision
+ *  from nanoseconds up to hours, in a fixed amount of memory.
+ */
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "../chardev.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#define LATENCY_SUB_BITS 5
+#define LATENCY_SUB (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) * LATENCY_SUB)
+
+enum {
+	STAGE_DECODE,
+	STAGE_SUBMIT,
+	STAGE_KERNEL,
+	STAGE_FETCH,
+	STAGE_RENDER,
+	STAGE_TOTAL,
+	STAGE_NUM
+};
+
+typedef struct LatencyHist {
+
+	uint64_t count, sum, max;
+	uint64_t buckets[LATENCY_BUCKETS];
+
+} LatencyHist;
+
+typedef struct LatencyStats {
+
+	LatencyHist hist[CAM_NUM][STAGE_NUM];
+
+} LatencyStats;
+
+/*
+ * CLOCK_MONOTONIC in nanoseconds, comparable with the kernel stamps
+ */
+static inline uint64_t latency_now_ns(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void hist_record(LatencyHist *h, uint64_t ns);
+uint64_t hist_percentile(const LatencyHist *h, double p);
+void hist_merge(LatencyHist *dst, const LatencyHist *src);
+
+/*
+ * Record all the stages of one displayed frame of camera 'cam'
+ */
+void latency_record(LatencyStats *stats, int cam, const struct frame_times *times,
+		uint64_t fetched_ns, uint64_t displayed_ns);
+
+/*
+ * Add all the samples of 'src' to 'dst' (e.g. of many reader threads)
+ */
+void latency_merge(LatencyStats *dst, const LatencyStats *src);
+
+/*
+ * Print count/p50/p99/p999/max of every stage of every camera that has frames
+ */
+void latency_dump(const LatencyStats *stats, FILE *out);
+
+#endif
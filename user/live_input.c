@@ -0,0 +1,121 @@
+/*
+ *  live_input.c - live network cameras (see live_input.h)
+ */
+
+#include "live_input.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int live_is_url(const char *filename) {
+
+	static const char *schemes[] = { "rtsp://", "rtsps://", "rtmp://", "http://", "https://", "udp://", "tcp://", "srt://", NULL };
+	int i;
+
+	for (i = 0; schemes[i]; i++)
+		if (!strncmp(filename, schemes[i], strlen(schemes[i])))
+			return 1;
+	return 0;
+}
+
+static int live_interrupt(void *opaque) {
+
+	LiveInput *li = (LiveInput *)opaque;
+
+	if (li->quit && *li->quit)
+		return 1;
+	return li->deadline_ns && latency_now_ns() > li->deadline_ns;
+}
+
+AVFormatContext *live_alloc_context(LiveInput *li, volatile int *quit) {
+
+	AVFormatContext *fmt = avformat_alloc_context();
+
+	if (!fmt)
+		return NULL;
+	li->quit = quit;
+	fmt->interrupt_callback.callback = live_interrupt;
+	fmt->interrupt_callback.opaque = li;
+	// the open and the probing get a read's time too
+	live_arm(li);
+	return fmt;
+}
+
+AVDictionary *live_options(LiveInput *li) {
+
+	AVDictionary *opts = NULL;
+	char value[32];
+
+	// the demuxer - probe little, buffer nothing, reorder within the jitter budget
+	snprintf(value, sizeof(value), "%d", LIVE_PROBE_SIZE);
+	av_dict_set(&opts, "probesize", value, 0);
+	snprintf(value, sizeof(value), "%d", LIVE_ANALYZE_US);
+	av_dict_set(&opts, "analyzeduration", value, 0);
+	av_dict_set(&opts, "fflags", "nobuffer", 0);
+	snprintf(value, sizeof(value), "%d", li->jitter_ms * 1000);
+	av_dict_set(&opts, "max_delay", value, 0);
+	// a lost UDP packet costs the rest of the GOP, TCP only costs time
+	av_dict_set(&opts, "rtsp_transport", "tcp", 0);
+
+	// the decoder - output every frame as soon as it is decoded
+	av_dict_set(&opts, "flags", "low_delay", 0);
+	return opts;
+}
+
+void live_arm(LiveInput *li) {
+
+	li->deadline_ns = latency_now_ns() + LIVE_READ_TIMEOUT_MS * 1000000ULL;
+}
+
+int live_late(LiveInput *li, int64_t ts, AVRational tb, uint64_t now_ns) {
+
+	AVRational ns = {1, 1000000000};
+	int64_t lag, behind;
+
+	if (ts == AV_NOPTS_VALUE)
+		return 0;
+	lag = (int64_t)now_ns - av_rescale_q(ts, tb, ns);
+	if (!li->anchored || lag < li->anchor) {
+		li->anchor = lag;
+		li->anchored = 1;
+		return 0;
+	}
+
+	behind = lag - li->anchor;
+	// the timestamps jumped (the server started over), anchor again
+	if (behind > LIVE_RESYNC_MS * 1000000LL) {
+		li->anchor = lag;
+		return 0;
+	}
+	if (behind > li->jitter_ms * 1000000LL) {
+		li->late++;
+		return 1;
+	}
+	// follow the camera's clock drifting from ours
+	li->anchor += behind / 64;
+	return 0;
+}
+
+void live_connected(LiveInput *li, uint64_t now_ns) {
+
+	li->connected_ns = now_ns;
+	li->anchored = 0;
+}
+
+int live_lost(LiveInput *li, uint64_t now_ns) {
+
+	// a connection that held starts the backoff over
+	if (li->connected_ns && now_ns - li->connected_ns >= LIVE_STABLE_MS * 1000000ULL)
+		li->backoff_ms = 0;
+	li->connected_ns = 0;
+	li->reconnects++;
+
+	if (!li->backoff_ms)
+		li->backoff_ms = LIVE_BACKOFF_MIN_MS;
+	else if (li->backoff_ms < LIVE_BACKOFF_MAX_MS / 2)
+		li->backoff_ms *= 2;
+	else
+		li->backoff_ms = LIVE_BACKOFF_MAX_MS;
+	return li->backoff_ms;
+}
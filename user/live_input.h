@@ -0,0 +1,81 @@
+/*
+ *  live_input.h - live network cameras (RTSP, HTTP, ...) as sources
+ *
+ *  A URL is opened with low latency demuxing: a small probe, no input
+ *  buffering, a reorder buffer no longer than the camera's jitter budget,
+ *  and RTSP over TCP. A blocking read that gets nothing for
+ *  LIVE_READ_TIMEOUT_MS (or is asked to quit) is interrupted, so a dead
+ *  camera never hangs its worker.
+ *
+ *  Every packet's lag is its arrival time minus its timestamp; the
+ *  smallest lag seen is the camera's anchor. A packet more than the
+ *  jitter budget behind the anchor is late, it belongs to a backlog
+ *  (e.g. what TCP delivers at once after a hiccup). Late frames are
+ *  decoded (without the non reference frames) but not sent, so the
+ *  first frame sent after a hiccup is a current one.
+ *
+ *  A camera that is lost reconnects after a backoff that doubles from
+ *  LIVE_BACKOFF_MIN_MS up to LIVE_BACKOFF_MAX_MS, and starts over once a
+ *  connection held for LIVE_STABLE_MS.
+ */
+#ifndef LIVE_INPUT_H
+#define LIVE_INPUT_H
+
+#include <libavformat/avformat.h>
+
+#include <stdint.h>
+
+#define LIVE_READ_TIMEOUT_MS 5000
+#define LIVE_PROBE_SIZE 32768		/* bytes */
+#define LIVE_ANALYZE_US 500000
+#define LIVE_RESYNC_MS 10000		/* later than this is a jump of the timestamps */
+#define LIVE_BACKOFF_MIN_MS 250
+#define LIVE_BACKOFF_MAX_MS 30000
+#define LIVE_STABLE_MS 10000
+
+typedef struct LiveInput {
+
+	int          jitter_ms;		/* the camera's jitter budget, set by the caller */
+	volatile int *quit;		/* interrupts a blocking read */
+
+	uint64_t     deadline_ns;	/* of the read in progress */
+	int64_t      anchor;		/* the smallest lag, ns */
+	int          anchored;
+
+	uint64_t     connected_ns;	/* when the connection was made */
+	int          backoff_ms;
+
+	unsigned long late, reconnects;
+
+} LiveInput;
+
+/*
+ * Is the source a network stream and not a file?
+ */
+int live_is_url(const char *filename);
+
+/*
+ * A format context for the URL, with the interrupt callback, and the
+ * low latency options for decoder_open (free them with av_dict_free)
+ */
+AVFormatContext *live_alloc_context(LiveInput *li, volatile int *quit);
+AVDictionary *live_options(LiveInput *li);
+
+/*
+ * Give the next blocking read LIVE_READ_TIMEOUT_MS
+ */
+void live_arm(LiveInput *li);
+
+/*
+ * Is the packet with timestamp ts (in tb) behind the jitter budget?
+ */
+int live_late(LiveInput *li, int64_t ts, AVRational tb, uint64_t now_ns);
+
+/*
+ * The connection is up / was lost, live_lost returns the ms to wait
+ * before the next try
+ */
+void live_connected(LiveInput *li, uint64_t now_ns);
+int live_lost(LiveInput *li, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ *  motion.c - vectorized motion detection (see motion.h)
+ */
+
+#include "motion.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#endif
+
+static inline uint8_t avg_u8(int a, int b) {
+	return (a + b + 1) >> 1;	// rounds like _mm_avg_epu8
+}
+
+/*
+ * MOTION_SCALE x MOTION_SCALE box filter of the luma plane into m->cur
+ */
+static void downsample(Motion *m, const uint8_t *luma, int luma_pitch) {
+
+	int x, y, i;
+	const uint8_t *r0, *r1, *r2, *r3;
+	uint8_t *out;
+
+	for (y = 0; y < m->h; y++) {
+		r0 = luma + (y * MOTION_SCALE) * luma_pitch;
+		r1 = r0 + luma_pitch;
+		r2 = r1 + luma_pitch;
+		r3 = r2 + luma_pitch;
+		out = m->cur + y * m->pitch;
+		x = 0;
+
+#if defined(__SSE2__)
+		{
+			const __m128i lo8 = _mm_set1_epi16(0x00ff);
+			const __m128i lo16 = _mm_set1_epi32(0x0000ffff);
+			__m128i r, s, q;
+			int packed;
+
+			// 16 input bytes of 4 rows -> 4 output bytes
+			for (; x + 4 <= m->w; x += 4) {
+				i = x * MOTION_SCALE;
+				r = _mm_avg_epu8(
+					_mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r0 + i)), _mm_loadu_si128((const __m128i *)(r1 + i))),
+					_mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r2 + i)), _mm_loadu_si128((const __m128i *)(r3 + i))));
+				s = _mm_add_epi16(_mm_and_si128(r, lo8), _mm_srli_epi16(r, 8));
+				q = _mm_add_epi32(_mm_and_si128(s, lo16), _mm_srli_epi32(s, 16));
+				q = _mm_srli_epi32(q, 2);
+				q = _mm_packus_epi16(_mm_packs_epi32(q, q), q);
+				packed = _mm_cvtsi128_si32(q);
+				memcpy(out + x, &packed, 4);
+			}
+		}
+#endif
+		for (; x < m->w; x++) {
+			i = x * MOTION_SCALE;
+			out[x] = (avg_u8(avg_u8(r0[i], r1[i]), avg_u8(r2[i], r3[i])) +
+				avg_u8(avg_u8(r0[i+1], r1[i+1]), avg_u8(r2[i+1], r3[i+1])) +
+				avg_u8(avg_u8(r0[i+2], r1[i+2]), avg_u8(r2[i+2], r3[i+2])) +
+				avg_u8(avg_u8(r0[i+3], r1[i+3]), avg_u8(r2[i+3], r3[i+3]))) >> 2;
+		}
+	}
+}
+
+/*
+ * SAD of cur against bg, and bg += (cur - bg) / 8 on the way.
+ * The planes are padded with zeros to a multiple of 32 bytes.
+ */
+static uint64_t sad_update_scalar(uint8_t *cur, uint8_t *bg, size_t n) {
+
+	size_t i;
+	uint64_t sad = 0;
+
+	for (i = 0; i < n; i++) {
+		sad += cur[i] > bg[i] ? cur[i] - bg[i] : bg[i] - cur[i];
+		bg[i] = avg_u8(bg[i], avg_u8(bg[i], avg_u8(bg[i], cur[i])));
+	}
+	return sad;
+}
+
+#if defined(__SSE2__)
+static uint64_t sad_update_sse2(uint8_t *cur, uint8_t *bg, size_t n) {
+
+	size_t i;
+	uint64_t part[2];
+	__m128i c, b, acc = _mm_setzero_si128();
+
+	for (i = 0; i < n; i += 16) {
+		c = _mm_load_si128((const __m128i *)(cur + i));
+		b = _mm_load_si128((const __m128i *)(bg + i));
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(c, b));
+		b = _mm_avg_epu8(b, _mm_avg_epu8(b, _mm_avg_epu8(b, c)));
+		_mm_store_si128((__m128i *)(bg + i), b);
+	}
+	_mm_storeu_si128((__m128i *)part, acc);
+	return part[0] + part[1];
+}
+#endif
+
+#ifdef HAVE_AVX2_DISPATCH
+__attribute__((target("avx2")))
+static uint64_t sad_update_avx2(uint8_t *cur, uint8_t *bg, size_t n) {
+
+	size_t i;
+	uint64_t part[4];
+	__m256i c, b, acc = _mm256_setzero_si256();
+
+	for (i = 0; i < n; i += 32) {
+		c = _mm256_load_si256((const __m256i *)(cur + i));
+		b = _mm256_load_si256((const __m256i *)(bg + i));
+		acc = _mm256_add_epi64(acc, _mm256_sad_epu8(c, b));
+		b = _mm256_avg_epu8(b, _mm256_avg_epu8(b, _mm256_avg_epu8(b, c)));
+		_mm256_store_si256((__m256i *)(bg + i), b);
+	}
+	_mm256_storeu_si256((__m256i *)part, acc);
+	return part[0] + part[1] + part[2] + part[3];
+}
+#endif
+
+static uint64_t (*sad_update)(uint8_t *cur, uint8_t *bg, size_t n);
+
+static void pick_sad_update(void) {
+
+	sad_update = sad_update_scalar;
+#if defined(__SSE2__)
+	sad_update = sad_update_sse2;
+#endif
+#ifdef HAVE_AVX2_DISPATCH
+	if (__builtin_cpu_supports("avx2"))
+		sad_update = sad_update_avx2;
+#endif
+}
+
+int motion_init(Motion *m, int width, int height, double threshold, int keepalive_ms) {
+
+	memset(m, 0, sizeof(Motion));
+
+	if (!sad_update)
+		pick_sad_update();
+
+	m->w = width / MOTION_SCALE;
+	m->h = height / MOTION_SCALE;
+	m->pitch = (m->w + 31) & ~31;
+	m->threshold = threshold;
+	m->keepalive_ns = (uint64_t)keepalive_ms * 1000000;
+
+	if (posix_memalign((void **)&m->cur, 32, m->pitch * m->h) ||
+			posix_memalign((void **)&m->bg, 32, m->pitch * m->h)) {
+		motion_free(m);
+		return -1;
+	}
+	// the padding must stay zero, so it never adds to the SAD
+	memset(m->cur, 0, m->pitch * m->h);
+	memset(m->bg, 0, m->pitch * m->h);
+	return 0;
+}
+
+void motion_free(Motion *m) {
+
+	free(m->cur);
+	free(m->bg);
+	m->cur = m->bg = NULL;
+}
+
+int motion_update(Motion *m, const uint8_t *luma, int luma_pitch, uint64_t now_ns) {
+
+	int active, submit;
+	size_t n = (size_t)m->pitch * m->h;
+
+	if (!m->w || !m->h) {
+		m->score = 0;
+		return 1;
+	}
+
+	downsample(m, luma, luma_pitch);
+
+	if (!m->primed) {
+		memcpy(m->bg, m->cur, n);
+		m->primed = 1;
+		m->score = 0;
+	}
+	else
+		m->score = (double)sad_update(m->cur, m->bg, n) / ((size_t)m->w * m->h);
+
+	if (m->score >= m->threshold)
+		m->last_motion_ns = now_ns;
+
+	active = m->last_motion_ns && now_ns - m->last_motion_ns < (uint64_t)MOTION_HOLD_MS * 1000000;
+	m->changed = active != m->active;
+	m->active = active;
+
+	submit = active || !m->last_submit_ns || now_ns - m->last_submit_ns >= m->keepalive_ns;
+	if (submit)
+		m->last_submit_ns = now_ns;
+	return submit;
+}
@@ -0,0 +1,46 @@
+/*
+ *  motion.h - cheap motion detection to gate the frames of idle cameras
+ *
+ *  The luma plane is downsampled by MOTION_SCALE in both directions and
+ *  compared (sum of absolute differences) with a slowly adapting background
+ *  model. Both steps are vectorized, SSE2 everywhere on x86 and AVX2 for
+ *  the SAD when the CPU has it.
+ *
+ *  A camera with motion is submitted at full rate, an idle camera only
+ *  every keepalive. Motion stays "on" MOTION_HOLD_MS after the last
+ *  frame above the threshold, so the flag doesn't flicker.
+ */
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <stdint.h>
+
+#define MOTION_SCALE 4
+#define MOTION_HOLD_MS 2000
+
+typedef struct Motion {
+
+	int       w, h, pitch;		/* of the downsampled plane */
+	uint8_t  *cur, *bg;
+	int       primed;
+
+	double    threshold;		/* mean abs diff, in luma levels */
+	uint64_t  keepalive_ns;
+	uint64_t  last_submit_ns, last_motion_ns;
+
+	double    score;		/* of the last frame */
+	int       active;		/* motion event is on */
+	int       changed;		/* active changed on the last frame */
+
+} Motion;
+
+int motion_init(Motion *m, int width, int height, double threshold, int keepalive_ms);
+void motion_free(Motion *m);
+
+/*
+ * Score the luma plane of a new frame and update the background.
+ * Returns 1 if the frame should be submitted, 0 if it can be dropped.
+ */
+int motion_update(Motion *m, const uint8_t *luma, int luma_pitch, uint64_t now_ns);
+
+#endif
@@ -0,0 +1,242 @@
+/*
+ *  prof.c - per camera and stage profiling (see prof.h)
+ */
+
+#define _GNU_SOURCE		/* syscall */
+
+#include "prof.h"
+#include "latency.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+typedef struct ProfSlot {
+
+	uint64_t count, ns;
+	uint64_t hw[PROF_HW_NUM];
+
+} ProfSlot;
+
+/*
+ * Written by its thread only, read by the reporter
+ */
+typedef struct ProfThread {
+
+	ProfSlot           slot[CAM_NUM][PROF_NUM];
+	int                fd;		/* the perf group leader, -1 without counters */
+	int                events;	/* in the group */
+	struct ProfThread *next;
+
+} ProfThread;
+
+int prof_enabled = 0;
+
+static int prof_hw;
+static int prof_period;
+static uint64_t prof_start_ns;
+static ProfThread *threads;		/* pushed lock-free, never removed */
+static __thread ProfThread *self;
+static volatile sig_atomic_t dump_requested;
+
+static const char *stage_names[PROF_NUM] = { "demux", "decode", "motion", "convert", "cache", "submit", "fetch", "display" };
+static const uint64_t hw_config[PROF_HW_NUM] = { PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES };
+
+static void on_sigusr2(int sig) {
+	dump_requested = 1;
+}
+
+/*
+ * A counter of the calling thread, in the group of 'group' (-1 = a new group)
+ */
+static int perf_open(uint64_t config, int group) {
+
+	struct perf_event_attr attr;
+	int fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	attr.disabled = group < 0;
+	attr.exclude_hv = 1;
+
+	// the ioctls spend their time in the kernel, count it if we may
+	fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+	if (fd < 0 && errno == EACCES) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, group, 0);
+	}
+	return fd;
+}
+
+static ProfThread *prof_thread(void) {
+
+	ProfThread *t = calloc(1, sizeof(ProfThread));
+	int i, fd;
+
+	if (!t)
+		return NULL;
+	t->fd = -1;
+
+	if (__atomic_load_n(&prof_hw, __ATOMIC_RELAXED)) {
+		t->fd = perf_open(hw_config[0], -1);
+		if (t->fd < 0) {
+			// once for all the threads
+			if (__atomic_exchange_n(&prof_hw, 0, __ATOMIC_RELAXED))
+				perror("perf_event_open, no hardware counters");
+		}
+		else {
+			t->events = 1;
+			for (i = 1; i < PROF_HW_NUM; i++) {
+				fd = perf_open(hw_config[i], t->fd);
+				if (fd < 0)
+					break;	// the group is read in order, stop at the first missing
+				t->events++;
+			}
+			ioctl(t->fd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	t->next = __atomic_load_n(&threads, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&threads, &t->next, t, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+	return t;
+}
+
+void prof_mark(ProfMark *m) {
+
+	struct { uint64_t nr, v[PROF_HW_NUM]; } group;
+	int i;
+
+	if (!self)
+		self = prof_thread();
+	m->ns = latency_now_ns();
+	memset(m->hw, 0, sizeof(m->hw));
+	if (self && self->fd >= 0 && read(self->fd, &group, sizeof(group)) > 0)
+		for (i = 0; i < group.nr && i < PROF_HW_NUM; i++)
+			m->hw[i] = group.v[i];
+}
+
+void prof_add(ProfMark *m, int tape, int stage) {
+
+	ProfMark now;
+	ProfSlot *s;
+	int i;
+
+	prof_mark(&now);
+	if (self && tape >= 0 && tape < CAM_NUM) {
+		// the only writer of the slot, the stores just mustn't tear
+		s = &self->slot[tape][stage];
+		__atomic_store_n(&s->count, s->count + 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&s->ns, s->ns + (now.ns - m->ns), __ATOMIC_RELAXED);
+		for (i = 0; i < PROF_HW_NUM; i++)
+			__atomic_store_n(&s->hw[i], s->hw[i] + (now.hw[i] - m->hw[i]), __ATOMIC_RELAXED);
+	}
+	*m = now;
+}
+
+/*
+ * The slots of all the threads added up
+ */
+static void prof_sum(ProfSlot sum[CAM_NUM][PROF_NUM]) {
+
+	ProfThread *t;
+	int c, s, i;
+
+	memset(sum, 0, sizeof(ProfSlot) * CAM_NUM * PROF_NUM);
+	for (t = __atomic_load_n(&threads, __ATOMIC_ACQUIRE); t; t = t->next)
+		for (c = 0; c < CAM_NUM; c++)
+			for (s = 0; s < PROF_NUM; s++) {
+				sum[c][s].count += __atomic_load_n(&t->slot[c][s].count, __ATOMIC_RELAXED);
+				sum[c][s].ns += __atomic_load_n(&t->slot[c][s].ns, __ATOMIC_RELAXED);
+				for (i = 0; i < PROF_HW_NUM; i++)
+					sum[c][s].hw[i] += __atomic_load_n(&t->slot[c][s].hw[i], __ATOMIC_RELAXED);
+			}
+}
+
+static void prof_print(FILE *out, ProfSlot cur[CAM_NUM][PROF_NUM], ProfSlot base[CAM_NUM][PROF_NUM], uint64_t wall_ns, const char *what) {
+
+	int c, s;
+	uint64_t n, ns, cycles, instructions, misses;
+
+	fprintf(out, "profile, %s (%.1f s)\n", what, wall_ns / 1e9);
+	fprintf(out, "tape %-8s %9s %10s %10s %6s", "stage", "calls", "avg us", "total ms", "%time");
+	if (prof_hw)
+		fprintf(out, " %12s %5s %10s", "cycles/call", "IPC", "miss/call");
+	fprintf(out, "\n");
+
+	for (c = 0; c < CAM_NUM; c++)
+		for (s = 0; s < PROF_NUM; s++) {
+			n = cur[c][s].count - (base ? base[c][s].count : 0);
+			if (!n)
+				continue;
+			ns = cur[c][s].ns - (base ? base[c][s].ns : 0);
+			fprintf(out, "%4d %-8s %9llu %10.1f %10.1f %5.1f%%", c + 1, stage_names[s],
+					(unsigned long long)n, ns / 1e3 / n, ns / 1e6, wall_ns ? 100.0 * ns / wall_ns : 0);
+			if (prof_hw) {
+				cycles = cur[c][s].hw[PROF_CYCLES] - (base ? base[c][s].hw[PROF_CYCLES] : 0);
+				instructions = cur[c][s].hw[PROF_INSTRUCTIONS] - (base ? base[c][s].hw[PROF_INSTRUCTIONS] : 0);
+				misses = cur[c][s].hw[PROF_CACHE_MISSES] - (base ? base[c][s].hw[PROF_CACHE_MISSES] : 0);
+				fprintf(out, " %12.0f %5.2f %10.1f", (double)cycles / n,
+						cycles ? (double)instructions / cycles : 0, (double)misses / n);
+			}
+			fprintf(out, "\n");
+		}
+	fflush(out);
+}
+
+void prof_dump(FILE *out) {
+
+	static ProfSlot sum[CAM_NUM][PROF_NUM];
+
+	prof_sum(sum);
+	prof_print(out, sum, NULL, latency_now_ns() - prof_start_ns, "since the start");
+}
+
+/*
+ * The table of the last period, and the totals on SIGUSR2
+ */
+static void *prof_reporter(void *arg) {
+
+	static ProfSlot cur[CAM_NUM][PROF_NUM], last[CAM_NUM][PROF_NUM];
+	uint64_t now, last_ns = prof_start_ns;
+
+	for (;;) {
+		usleep(100000);
+		if (dump_requested) {
+			dump_requested = 0;
+			prof_dump(stdout);
+		}
+		now = latency_now_ns();
+		if (prof_period && now - last_ns >= prof_period * 1000000000ULL) {
+			prof_sum(cur);
+			prof_print(stdout, cur, last, now - last_ns, "the last period");
+			memcpy(last, cur, sizeof(last));
+			last_ns = now;
+		}
+	}
+	return NULL;
+}
+
+void prof_init(int period_s, int hw) {
+
+	pthread_t thread;
+
+	prof_period = period_s;
+	prof_hw = hw;
+	prof_start_ns = latency_now_ns();
+	signal(SIGUSR2, on_sigusr2);
+	if (pthread_create(&thread, NULL, prof_reporter, NULL)) {
+		fprintf(stderr, "Could not start the profiler\n");
+		return;
+	}
+	prof_enabled = 1;
+}
@@ -0,0 +1,83 @@
+/*
+ *  prof.h - where the time of the hot paths goes, per camera and stage
+ *
+ *  The camera threads time every stage of a frame with CLOCK_MONOTONIC
+ *  (and with -H also count cycles, instructions and cache misses with a
+ *  perf_event_open group of the thread). Every thread adds to its own
+ *  table, which the reporter only reads, so nothing on the hot path takes
+ *  a lock or shares a cache line with another thread.
+ *
+ *  A table of every camera and stage is printed every period, and the
+ *  totals since the start on SIGUSR2.
+ *
+ *	ProfMark m;
+ *	prof_begin(&m);
+ *	av_read_frame(...);		prof_lap(&m, tape, PROF_DEMUX);
+ *	avcodec_decode_video2(...);	prof_lap(&m, tape, PROF_DECODE);
+ *
+ *  Off (prof_enabled == 0) a stage costs a test of a global.
+ */
+#ifndef PROF_H
+#define PROF_H
+
+#include "../chardev.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum {
+	PROF_DEMUX,		/* av_read_frame */
+	PROF_DECODE,		/* avcodec_decode_video2 */
+	PROF_MOTION,		/* motion scoring */
+	PROF_CONVERT,		/* sws_scale into the frame */
+	PROF_CACHE,		/* frame_cache_append */
+	PROF_SUBMIT,		/* to the transport (the ioctl) */
+	PROF_FETCH,		/* from the transport, waiting included */
+	PROF_DISPLAY,		/* SDL_DisplayYUVOverlay */
+	PROF_NUM
+};
+
+enum {
+	PROF_CYCLES,
+	PROF_INSTRUCTIONS,
+	PROF_CACHE_MISSES,
+	PROF_HW_NUM
+};
+
+typedef struct ProfMark {
+
+	uint64_t ns;
+	uint64_t hw[PROF_HW_NUM];
+
+} ProfMark;
+
+extern int prof_enabled;
+
+/*
+ * Start profiling - a table every period_s seconds (0 = only on SIGUSR2),
+ * hw for the hardware counters. Call it before the threads start.
+ */
+void prof_init(int period_s, int hw);
+
+void prof_mark(ProfMark *m);
+void prof_add(ProfMark *m, int tape, int stage);
+
+static inline void prof_begin(ProfMark *m) {
+	if (prof_enabled)
+		prof_mark(m);
+}
+
+/*
+ * The time since m goes to the stage, and m starts the next one
+ */
+static inline void prof_lap(ProfMark *m, int tape, int stage) {
+	if (prof_enabled)
+		prof_add(m, tape, stage);
+}
+
+/*
+ * The totals since the start
+ */
+void prof_dump(FILE *out);
+
+#endif
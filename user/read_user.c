@@ -10,120 +10,347 @@ clean*  read_user.c - the process to use ioctl's to control the kernel module
 #include <SDL.h>
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
 
 #ifdef __MINGW32__
 #undef main /* Prevents SDL from overriding main() */
 #endif
 
-#include "user_chardev.h"
+#include "../chardev.h"
+#include "transport.h"
+#include "camclient.h"
+#include "latency.h"
+#include "prof.h"
 
 #include <stdio.h>
-#include <fcntl.h>		/* open */
-#include <unistd.h>		/* exit */
-#include <sys/ioctl.h>		/* ioctl */
+#include <stdint.h>
+#include <unistd.h>		/* sleep, getopt */
+#include <signal.h>
+#include <errno.h>
 #include <pthread.h>
 
 int quit = 0;
 
 /*
- * Deserializing the buf to the overlay
- */ 
-void buf_to_overlay(SDL_Overlay *bmp, char* buf) {
-
-	static int first_call = 1;
+ * encoded passthrough (-p) - write_user sends packets and we decode
+ * the selected camera only
+ */
+int passthrough = 0;
 
-	if(!bmp || !buf) {
-		perror("to_message");
-		exit(-1);
-	}
+/*
+ * the region of interest (-r x,y,w,h) and its scale (-S), the reader
+ * is given only that part of every frame
+ */
+struct cam_roi roi = { 0, 0, 0, 0, 1 };
 
-	memcpy(&bmp->format, buf, sizeof(Uint32));
-	buf += sizeof(Uint32);
+/*
+ * latency histograms, dumped on SIGUSR1 or every latency_period seconds
+ */
+LatencyStats latency;
+int latency_period = 0;
+volatile sig_atomic_t dump_latency = 0;
 
-	memcpy(&bmp->w, buf, sizeof(int));
-	buf += sizeof(int);
+void on_sigusr1(int sig) {
+	dump_latency = 1;
+}
 
-	memcpy(&bmp->h, buf, sizeof(int));
-	buf += sizeof(int);
+/*
+ * write_user flags the cameras with motion, tell the user when it changes
+ */
+void print_activity(int motion) {
 
-	memcpy(&bmp->planes, buf, sizeof(int));
-	buf += sizeof(int);
+	int i;
 
-	memcpy(&bmp->pitches[0], buf, sizeof(Uint16));
-	buf += sizeof(Uint16);
+	printf("cameras with activity:");
+	for(i = 0; i < CAM_NUM; i++)
+		if(motion & (1 << i))
+			printf(" %d", i+1);
+	printf(motion ? "\n" : " none\n");
+}
 
-	memcpy(&bmp->pitches[1], buf, sizeof(Uint16));
-	buf += sizeof(Uint16);
+/*
+ * After every displayed frame - tell about motion changes, dump the latency
+ */
+void check_status(CamClient* client, int* last_motion, uint64_t now, uint64_t* last_dump) {
 
-	memcpy(&bmp->pitches[2], buf, sizeof(Uint16));
-	buf += sizeof(Uint16);
+	struct cam_status st;
 
-	if(first_call) {
-		first_call = 0;
-		bmp->pixels[0] = (Uint8*)malloc(sizeof(Uint8)*bmp->h*bmp->w);
-		bmp->pixels[1] = (Uint8*)malloc(sizeof(Uint8)*bmp->h*bmp->w);
-		bmp->pixels[2] = (Uint8*)malloc(sizeof(Uint8)*(bmp->h-90)*bmp->w);
+	if(cam_status(client, &st) == SUCCESS && (int)st.motion != *last_motion) {
+		*last_motion = st.motion;
+		print_activity(st.motion);
 	}
-	memcpy(bmp->pixels[0], buf, sizeof(Uint8)*bmp->h*bmp->w);
-	buf += sizeof(Uint8)*bmp->h*bmp->w;
 
-	memcpy(bmp->pixels[1], buf, sizeof(Uint8)*bmp->h*bmp->w);
-	buf += sizeof(Uint8)*bmp->h*bmp->w;
-
-	memcpy(bmp->pixels[2], buf, sizeof(Uint8)*(bmp->h-90)*bmp->w);
+	if (dump_latency || (latency_period && now - *last_dump >= latency_period * 1000000000ULL)) {
+		dump_latency = 0;
+		*last_dump = now;
+		latency_dump(&latency, stdout);
+	}
 }
 
 /* 
- * Functions for the ioctl calls 
+ * Functions for the transport calls 
  */
 void ioctl_get_msg(void* arg) {
 
-	int ret_val, *file_desc = (int*)arg;
-	char* buf;
+	int tape, last_motion = 0;
+	CamClient* client = (CamClient*)arg;
+	CamFrame* f;
 	SDL_Rect rect;
+	struct cam_status st;
+	uint64_t fetched, displayed, last_dump = latency_now_ns();
+	Uint8* own_pixels[3];
+	ProfMark pm;
 	rect.x = rect.y = 0;
 
-	if (!ioctl(*file_desc, IOCTL_GET_VALIDATE)) {
+	if (cam_status(client, &st) < 0 || !st.writer) {
 		quit = 1;
 		printf("write_user app must be opened\n");
 		exit(-1);
 	}
 
-	// my_bmp, will be deserialized next
+	// the overlay shows the frames where they are, in the client's pool
 	SDL_Overlay *my_bmp = NULL;
 	my_bmp = SDL_CreateYUVOverlay(1, 1, SDL_YV12_OVERLAY, SDL_SetVideoMode(640, 360, 0, 0));
+	memcpy(own_pixels, my_bmp->pixels, sizeof(own_pixels));
 
-	buf = (char*)malloc(MAX_FRAME_SIZE);
 	while(!quit) {
-		/* 
-		 * Warning - this is dangerous because we don't tell
-		 * the kernel how far it's allowed to write, so it
-		 * might overflow the buffer. In a real production
-		 * program, we would have used two ioctls - one to tell
-		 * the kernel the buffer length and another to give
-		 * it the buffer to fill
-		 */
-		ret_val = ioctl(*file_desc, IOCTL_READ, buf);
-		if (ret_val < 0) {
-			printf("ioctl_get_msg failed: %d\n", ret_val);
+		prof_begin(&pm);
+		f = cam_wait_frame(client);
+		if (!f) {
+			if (errno == EBADMSG || errno == EAGAIN)
+				continue;	// not a frame we can show, or of which camera we don't know
+			printf("ioctl_get_msg failed: %d\n", -errno);
 			exit(-1);
 		}
-		buf_to_overlay(my_bmp, buf);
+		fetched = latency_now_ns();
+		tape = f->tape;
+		prof_lap(&pm, tape, PROF_FETCH);
+
+		my_bmp->w = f->w;
+		my_bmp->h = f->h;
+		my_bmp->pitches[0] = f->pitches[0];
+		my_bmp->pitches[1] = f->pitches[1];
+		my_bmp->pitches[2] = f->pitches[2];
+		my_bmp->pixels[0] = f->pixels[0];
+		my_bmp->pixels[1] = f->pixels[1];
+		my_bmp->pixels[2] = f->pixels[2];
 		rect.w = my_bmp->w;
 		rect.h = my_bmp->h;
 		SDL_DisplayYUVOverlay(my_bmp, &rect);
+		prof_lap(&pm, tape, PROF_DISPLAY);
+
+		displayed = latency_now_ns();
+		latency_record(&latency, tape, &f->times, fetched, displayed);
+		cam_release(f);
+		check_status(client, &last_motion, displayed, &last_dump);
 	}
 	// we need to see how we tell this process that the video is finished..
 
-	free(my_bmp->pixels[0]);
-	free(my_bmp->pixels[1]);
-	free(my_bmp->pixels[2]);
+	memcpy(my_bmp->pixels, own_pixels, sizeof(own_pixels));
+	my_bmp->w = my_bmp->h = 1;
+	SDL_FreeYUVOverlay(my_bmp);
+}
+
+/*
+ * The decoder of the selected camera in passthrough mode
+ */
+typedef struct CamDecoder {
+
+	int               tape;		/* -1 when closed */
+	AVCodecContext    *ctx;
+	AVFrame           *frame;
+	struct SwsContext *sws_ctx;
+	SDL_Overlay       *bmp;
+	uint32_t          next_seq;	/* the packet we expect next, 0 = from the keyframe */
+
+} CamDecoder;
+
+void close_decoder(CamDecoder* d) {
+
+	if(d->tape < 0)
+		return;
+	avcodec_close(d->ctx);
+	av_freep(&d->ctx->extradata);
+	av_free(d->ctx);
+	av_frame_free(&d->frame);
+	sws_freeContext(d->sws_ctx);
+	SDL_FreeYUVOverlay(d->bmp);
+	d->sws_ctx = NULL;
+	d->tape = -1;
+}
+
+/*
+ * Open a decoder for camera 'tape' with the codec write_user gave the module
+ */
+int open_decoder(Transport* transport, CamDecoder* d, int tape, SDL_Surface* screen) {
+
+	struct codec_params codec;
+	AVCodec* pCodec;
+
+	codec.tape = tape;
+	if(transport_get_codec(transport, &codec) < 0)
+		return FAIL;	// write_user didn't get to this camera yet
+
+	pCodec = avcodec_find_decoder(codec.codec_id);
+	if(!pCodec) {
+		fprintf(stderr, "Unsupported codec!\n");
+		exit(1);
+	}
+
+	d->ctx = avcodec_alloc_context3(pCodec);
+	d->ctx->width = codec.width;
+	d->ctx->height = codec.height;
+	d->ctx->pix_fmt = codec.pix_fmt;
+	d->ctx->time_base.num = codec.time_base_num;
+	d->ctx->time_base.den = codec.time_base_den;
+	if(codec.extradata_size) {
+		d->ctx->extradata = av_mallocz(codec.extradata_size + FF_INPUT_BUFFER_PADDING_SIZE);
+		memcpy(d->ctx->extradata, codec.extradata, codec.extradata_size);
+		d->ctx->extradata_size = codec.extradata_size;
+	}
+	if(avcodec_open2(d->ctx, pCodec, NULL) < 0) {
+		fprintf(stderr, "Could not open the codec of tape %d\n", tape+1);
+		exit(1);
+	}
+
+	d->frame = av_frame_alloc();
+	d->bmp = SDL_CreateYUVOverlay(codec.width, codec.height, SDL_YV12_OVERLAY, screen);
+	d->next_seq = 0;
+	d->tape = tape;
+	return SUCCESS;
+}
+
+void show_frame(CamDecoder* d, ProfMark* pm) {
+
+	AVPicture pict;
+	SDL_Rect rect;
+
+	// the stream may not be the size write_user announced
+	d->sws_ctx = sws_getCachedContext(d->sws_ctx, d->ctx->width, d->ctx->height, d->ctx->pix_fmt,
+			d->bmp->w, d->bmp->h, PIX_FMT_YUV420P, SWS_BILINEAR, NULL, NULL, NULL);
+
+	SDL_LockYUVOverlay(d->bmp);
+
+	pict.data[0] = d->bmp->pixels[0];
+	pict.data[1] = d->bmp->pixels[2];
+	pict.data[2] = d->bmp->pixels[1];
+
+	pict.linesize[0] = d->bmp->pitches[0];
+	pict.linesize[1] = d->bmp->pitches[2];
+	pict.linesize[2] = d->bmp->pitches[1];
+
+	sws_scale(d->sws_ctx, (uint8_t const * const *)d->frame->data, d->frame->linesize, 0,
+			d->ctx->height, pict.data, pict.linesize);
+
+	SDL_UnlockYUVOverlay(d->bmp);
+	prof_lap(pm, d->tape, PROF_CONVERT);
+
+	rect.x = rect.y = 0;
+	rect.w = d->bmp->w;
+	rect.h = d->bmp->h;
+	SDL_DisplayYUVOverlay(d->bmp, &rect);
+	prof_lap(pm, d->tape, PROF_DISPLAY);
+}
+
+/*
+ * Passthrough mode - fetch the packets of the selected camera we don't
+ * have yet (after a change of tape, everything since the keyframe),
+ * decode them all and show the last frame
+ */
+void ioctl_get_packets(void* arg) {
+
+	int ret_val, n, tape, finished, got, last_motion = 0;
+	CamClient* client = (CamClient*)arg;
+	Transport* transport = cam_transport(client);
+	CamDecoder dec = { .tape = -1 };
+	SDL_Surface* screen;
+	struct packet_read req;
+	struct packet_header hdr;
+	struct frame_times times;
+	struct cam_status st;
+	AVPacket pkt;
+	char *buf;
+	uint8_t *pkt_buf;
+	uint64_t fetched, displayed, last_dump = latency_now_ns();
+	ProfMark pm;
+
+	if (cam_status(client, &st) < 0 || !st.writer) {
+		quit = 1;
+		printf("write_user app must be opened\n");
+		exit(-1);
+	}
+
+	screen = SDL_SetVideoMode(640, 360, 0, 0);
+	buf = (char*)malloc(CAM_LEN);
+	// the decoders read a little past the end of the packet
+	pkt_buf = (uint8_t*)malloc(CAM_LEN + FF_INPUT_BUFFER_PADDING_SIZE);
+
+	while(!quit) {
+		tape = transport_get_tape_number(transport);
+		if (tape != dec.tape) {
+			close_decoder(&dec);
+			if (open_decoder(transport, &dec, tape, screen) < 0) {
+				usleep(100000);
+				continue;
+			}
+		}
+
+		req.tape = tape;
+		req.from_seq = dec.next_seq;
+		req.buf_len = CAM_LEN;
+		req.timeout_ms = 100;
+		req.buf = (uintptr_t)buf;
+		prof_begin(&pm);
+		ret_val = transport_read_packets(transport, &req);
+		if (ret_val < 0) {
+			printf("ioctl_get_packets failed: %d\n", ret_val);
+			exit(-1);
+		}
+		fetched = latency_now_ns();
+		prof_lap(&pm, tape, PROF_FETCH);
+
+		got = 0;
+		for (n = 0; n < ret_val; n += sizeof(hdr) + hdr.size) {
+			memcpy(&hdr, buf + n, sizeof(hdr));
+
+			// we missed packets, the module gave us a new GOP from its keyframe
+			if (hdr.seq != dec.next_seq)
+				avcodec_flush_buffers(dec.ctx);
+			dec.next_seq = hdr.seq + 1;
+
+			memcpy(pkt_buf, buf + n + sizeof(hdr), hdr.size);
+			memset(pkt_buf + hdr.size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
+			av_init_packet(&pkt);
+			pkt.data = pkt_buf;
+			pkt.size = hdr.size;
+			pkt.pts = hdr.pts;
+			pkt.dts = hdr.dts;
+			pkt.flags = (hdr.flags & PACKET_KEY) ? AV_PKT_FLAG_KEY : 0;
+
+			avcodec_decode_video2(dec.ctx, dec.frame, &finished, &pkt);
+			if (finished) {
+				got = 1;
+				times = hdr.times;
+			}
+		}
+		prof_lap(&pm, tape, PROF_DECODE);
+		if (!got)
+			continue;
+
+		show_frame(&dec, &pm);
+		displayed = latency_now_ns();
+		latency_record(&latency, tape, &times, fetched, displayed);
+		check_status(client, &last_motion, displayed, &last_dump);
+	}
+
+	close_decoder(&dec);
+	free(pkt_buf);
 	free(buf);
 }
 
-void ioctl_ch_tape(int file_desc, int n) {
+void ioctl_ch_tape(CamClient* client, int n) {
 
-	int ret_val = ioctl(file_desc, IOCTL_CHANGE_TAPE, n);
+	int ret_val = cam_select(client, n);
 	if (ret_val < 0)  printf("ioctl_ch_tape failed: %d\n", ret_val);
 	else printf("the selected tape is now tape %d\n", n+1);
 }
@@ -131,11 +358,49 @@ void ioctl_ch_tape(int file_desc, int n) {
 /* 
  * Main - FRONTEND, Call the ioctl functions 
  */
-int main() {
+int main(int argc, char* argv[]) {
 
 	SDL_Event event;
-	int file_desc, rc, choice, selected_tape;
+	int rc, opt, choice, selected_tape;
+	char* backend = NULL;
+	CamClient* client;
+	struct cam_status st;
 	pthread_t thread;
+	int profile_period = -1, profile_hw = 0;
+
+	while((opt = getopt(argc, argv, "t:l:pP:Hr:S:")) != -1) {
+		switch(opt) {
+		case 't':
+			backend = optarg;
+			break;
+		case 'l':
+			latency_period = atoi(optarg);
+			break;
+		case 'p':
+			passthrough = 1;
+			break;
+		case 'P':
+			profile_period = atoi(optarg);
+			break;
+		case 'H':
+			profile_hw = 1;
+			break;
+		case 'r':
+			if(sscanf(optarg, "%d,%d,%d,%d", &roi.x, &roi.y, &roi.w, &roi.h) != 4)
+				goto usage;
+			break;
+		case 'S':
+			roi.scale = atoi(optarg);
+			if(roi.scale < 1 || roi.scale > ROI_MAX_SCALE)
+				goto usage;
+			break;
+		default:
+		usage:
+			fprintf(stderr, "Usage: .exe [-t chardev|shm|net[:host:port]] [-l latency_dump_seconds] [-p] [-P profile_seconds] [-H] [-r x,y,w,h] [-S scale]\n");
+			exit(1);
+		}
+	}
+	signal(SIGUSR1, on_sigusr1);
 
 	av_register_all();
 
@@ -144,20 +409,30 @@ int main() {
 		exit(1);
 	}
 
-	file_desc = open(DEVICE_FILE_NAME_R, 0);
-	if (file_desc < 0) {
-		printf("Can't open device file: %s\n", DEVICE_FILE_NAME_R);
+	client = cam_open(backend, TRANSPORT_READER);
+	if (!client)
 		exit(-1);
+	if(profile_period >= 0 || profile_hw)
+		prof_init(profile_period > 0 ? profile_period : 0, profile_hw);
+	if((roi.w && roi.h) || roi.scale > 1) {
+		if(passthrough)
+			fprintf(stderr, "the packets are decoded here, -r and -S need frames\n");
+		else if(cam_set_roi(client, &roi) < 0)
+			fprintf(stderr, "this transport can't crop, the whole frames are read\n");
 	}
 	sleep(2);	//We have to wait till write_user writes at least 1 frame from each video
-	rc = pthread_create(&thread, NULL, (void*)ioctl_get_msg, &file_desc);
+	rc = pthread_create(&thread, NULL, passthrough ? (void*)ioctl_get_packets : (void*)ioctl_get_msg, client);
 	if(rc) {
 		fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
 		exit(-1);
 	}
 
-	selected_tape = ioctl(file_desc, IOCTL_GET_TAPE_NUMBER);
-	if (!ioctl(file_desc ,IOCTL_CHECK_IF_WRITTEN,1)) {choice = 0; goto change_tape;}
+	if (cam_status(client, &st) < 0) {
+		printf("Can't get the status of the cameras\n");
+		exit(-1);
+	}
+	selected_tape = st.cur_cam;
+	if (!(st.written & (1 << 1))) {choice = 0; goto change_tape;}
 	while(SDL_WaitEvent( &event ) && !quit) {
 		switch(event.type) {
 		case SDL_KEYDOWN:
@@ -208,13 +483,16 @@ int main() {
 				change_tape:
 				if(selected_tape == choice)
 					printf("tape %d is already the selected tape\n", selected_tape+1);
-				else if(!ioctl(file_desc ,IOCTL_CHECK_IF_WRITTEN,choice)) {
+				else if(cam_status(client, &st) < 0 || !(st.written & (1 << choice))) {
 					if (choice == 0) continue;
-					printf("tape %d has not been written by write_user app\n", choice+1);
+					if (st.offline & (1 << choice))
+						printf("tape %d is offline\n", choice+1);
+					else
+						printf("tape %d has not been written by write_user app\n", choice+1);
 				}
 				else {
 					selected_tape = choice;
-					ioctl_ch_tape(file_desc, choice);
+					ioctl_ch_tape(client, choice);
 				}
 				break;
 			default: break;
@@ -223,6 +501,8 @@ int main() {
 			default: break;
 		}
 	}
-	close(file_desc);
+	if(prof_enabled)
+		prof_dump(stdout);
+	cam_close(client);
 	return 0;
 }
@@ -0,0 +1,659 @@
+/*
+ *  relay.c - fan the camera streams out to remote viewers over TCP
+ *
+ *  One reader thread takes the frames from the transport once (the char
+ *  device, or shm) and hands a reference of every frame to each viewer
+ *  that selected its camera. One epoll thread does all the sending.
+ *
+ *  Every viewer has a small bounded queue. When it is full the oldest
+ *  frame that isn't on its way is dropped, so a slow viewer only loses
+ *  frames, it never stalls the reader or the other viewers.
+ *
+ *  Frames are shared, reference counted buffers. The data is sent with
+ *  sendmsg straight from them (header and frame in one iovec), and with
+ *  -z also with MSG_ZEROCOPY, holding the reference until the kernel
+ *  reports that the send completed.
+ *
+ *  Usage: relay.out [-t chardev|shm] [-p port] [-q queue] [-z]
+ */
+
+#define _GNU_SOURCE		/* accept4 */
+
+#include "../chardev.h"
+#include "transport.h"
+#include "relay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>		/* getopt */
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+#include <linux/errqueue.h>	/* sock_extended_err */
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY 5
+#endif
+
+#define RELAY_MAX_QUEUE 16
+#define RELAY_ZC_PENDING 256
+#define RELAY_STATUS_MS 500
+#define RELAY_MAX_EVENTS 64
+
+typedef struct RelayFrame {
+
+	int                refs;
+	int                pooled;
+	struct RelayFrame *next_free;
+	struct relay_hdr   hdr;
+	char               data[];
+
+} RelayFrame;
+
+typedef struct RelayClient {
+
+	int                 fd;
+	int                 selected;			/* camera, -1 for none yet */
+
+	RelayFrame         *queue[RELAY_MAX_QUEUE];
+	int                 head, len;
+	size_t              sent;			/* bytes of queue[head] already sent */
+	int                 sending;			/* queue[head] is being sent right now */
+	int                 want_out;			/* EPOLLOUT is armed */
+
+	/* MSG_ZEROCOPY sends still holding their frame, ids in order */
+	struct { uint32_t id; RelayFrame *frame; } zc[RELAY_ZC_PENDING];
+	uint32_t            zc_next, zc_done;		/* next send id, first id not completed */
+	int                 zc_len;
+
+	char                cmd[sizeof(struct relay_cmd)];
+	size_t              cmd_len;
+
+	unsigned long       frames, dropped;
+	struct RelayClient *next;
+
+} RelayClient;
+
+static Transport *transport;
+static RelayClient *clients = NULL;
+static RelayClient *closed = NULL;	/* freed after the epoll batch that closed them */
+static pthread_mutex_t relay_lock = PTHREAD_MUTEX_INITIALIZER;
+static int epfd, wakefd, listenfd;
+static int queue_max = 2, zerocopy = 0;
+static volatile sig_atomic_t quit = 0, dump_stats = 0;
+
+/* the frame pool - frames are never unmapped, zerocopy sends may still read them */
+static RelayFrame *free_frames = NULL;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct relay_hdr status = { RELAY_MAGIC, -1, 0, 0, 0, 0 };
+
+/* epoll data of the two non client fds */
+static int listen_tag, wake_tag;
+
+static uint64_t now_ms(void) {
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static RelayFrame *frame_get(int with_data) {
+
+	RelayFrame *f = NULL;
+
+	if (with_data) {
+		pthread_mutex_lock(&pool_lock);
+		f = free_frames;
+		if (f)
+			free_frames = f->next_free;
+		pthread_mutex_unlock(&pool_lock);
+		if (!f)
+			f = malloc(sizeof(RelayFrame) + CAM_LEN + sizeof(size_t));
+	}
+	else
+		f = malloc(sizeof(RelayFrame));
+
+	if (!f) {
+		perror("frame_get");
+		exit(-1);
+	}
+	f->refs = 1;
+	f->pooled = with_data;
+	return f;
+}
+
+static void frame_put(RelayFrame *f) {
+
+	if (__atomic_sub_fetch(&f->refs, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (!f->pooled) {
+		free(f);
+		return;
+	}
+	pthread_mutex_lock(&pool_lock);
+	f->next_free = free_frames;
+	free_frames = f;
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * Put a frame on a client queue, dropping the oldest frame that is not
+ * being sent when it's full. Called with relay_lock held.
+ */
+static void client_push(RelayClient *c, RelayFrame *f) {
+
+	int i, victim;
+
+	if (c->len == queue_max) {
+		victim = (c->sending || c->sent) ? 1 : 0;
+		if (victim >= c->len)
+			return;			// a queue of 1 that is on its way - drop the new one
+		frame_put(c->queue[(c->head + victim) % RELAY_MAX_QUEUE]);
+		for (i = victim; i < c->len - 1; i++)
+			c->queue[(c->head + i) % RELAY_MAX_QUEUE] = c->queue[(c->head + i + 1) % RELAY_MAX_QUEUE];
+		c->len--;
+		c->dropped++;
+	}
+	__atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+	c->queue[(c->head + c->len) % RELAY_MAX_QUEUE] = f;
+	c->len++;
+}
+
+/*
+ * Give a frame to every client that wants camera 'tape' (-1 = everybody)
+ */
+static void broadcast(RelayFrame *f, int tape) {
+
+	uint64_t one = 1;
+	RelayClient *c;
+
+	pthread_mutex_lock(&relay_lock);
+	for (c = clients; c; c = c->next)
+		if (tape < 0 || c->selected == tape)
+			client_push(c, f);
+	pthread_mutex_unlock(&relay_lock);
+
+	if (write(wakefd, &one, sizeof(one)) < 0)
+		perror("relay wake");
+}
+
+/*
+ * written/motion/validate of the transport, a status message when changed
+ */
+static void refresh_status(void) {
+
+	int i;
+	struct relay_hdr now = status;
+	RelayFrame *f;
+
+	now.written = 0;
+	for (i = 0; i < CAM_NUM; i++)
+		if (transport_check_if_written(transport, i) > 0)
+			now.written |= 1u << i;
+	now.motion = transport_get_motion(transport);
+	now.validate = transport_get_validate(transport) > 0;
+
+	if (!memcmp(&now, &status, sizeof(now)))
+		return;
+
+	pthread_mutex_lock(&relay_lock);
+	status = now;
+	pthread_mutex_unlock(&relay_lock);
+
+	f = frame_get(0);
+	f->hdr = now;
+	broadcast(f, -1);
+	frame_put(f);
+}
+
+/*
+ * The reader thread - the only one talking to the transport
+ */
+static void *relay_read(void *arg) {
+
+	int k, len, tape, cur = -1, rr = 0;
+	uint32_t wanted;
+	uint64_t last_status = 0;
+	RelayFrame *f;
+	RelayClient *c;
+
+	while (!quit) {
+		if (now_ms() - last_status >= RELAY_STATUS_MS) {
+			refresh_status();
+			last_status = now_ms();
+		}
+
+		wanted = 0;
+		pthread_mutex_lock(&relay_lock);
+		for (c = clients; c; c = c->next)
+			if (c->selected >= 0)
+				wanted |= 1u << c->selected;
+		wanted &= status.written;	// IOCTL_READ spins on an unwritten camera
+		pthread_mutex_unlock(&relay_lock);
+
+		if (!wanted) {
+			usleep(20000);
+			continue;
+		}
+
+		// round robin over the cameras somebody is watching
+		for (k = 1; k <= CAM_NUM; k++) {
+			tape = (rr + k) % CAM_NUM;
+			if (wanted & (1u << tape))
+				break;
+		}
+		rr = tape;
+
+		if (tape != cur) {
+			if (transport_change_tape(transport, tape) < 0) {
+				fprintf(stderr, "relay: change tape %d failed\n", tape + 1);
+				usleep(20000);
+				continue;
+			}
+			cur = tape;
+		}
+
+		f = frame_get(1);
+		len = transport_read_frame(transport, f->data);
+		if (len < 0) {
+			fprintf(stderr, "relay: read_frame failed: %d\n", len);
+			frame_put(f);
+			quit = 1;
+			break;
+		}
+
+		pthread_mutex_lock(&relay_lock);
+		f->hdr = status;
+		pthread_mutex_unlock(&relay_lock);
+		f->hdr.tape = tape;
+		f->hdr.len = len;
+
+		broadcast(f, tape);
+		frame_put(f);
+	}
+	return NULL;
+}
+
+static void client_arm(RelayClient *c, int out) {
+
+	struct epoll_event ev;
+
+	if (c->want_out == out)
+		return;
+	c->want_out = out;
+	ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+	ev.data.ptr = c;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/*
+ * MSG_ZEROCOPY completions - the frames of sends [lo, hi] can be released
+ */
+static void client_zc_complete(RelayClient *c) {
+
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+	struct sock_extended_err *serr;
+
+	for (;;) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(c->fd, &msg, MSG_ERRQUEUE) < 0)
+			return;
+
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+					(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno)
+				continue;
+			// completions come in order, ee_data is the last id done
+			while (c->zc_len && (int32_t)(serr->ee_data - c->zc[c->zc_done % RELAY_ZC_PENDING].id) >= 0) {
+				frame_put(c->zc[c->zc_done % RELAY_ZC_PENDING].frame);
+				c->zc_done++;
+				c->zc_len--;
+			}
+		}
+	}
+}
+
+static void client_close(RelayClient *c) {
+
+	RelayClient **pp;
+
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+
+	pthread_mutex_lock(&relay_lock);
+	for (pp = &clients; *pp; pp = &(*pp)->next)
+		if (*pp == c) {
+			*pp = c->next;
+			break;
+		}
+	while (c->len) {
+		frame_put(c->queue[c->head]);
+		c->head = (c->head + 1) % RELAY_MAX_QUEUE;
+		c->len--;
+	}
+	pthread_mutex_unlock(&relay_lock);
+
+	while (c->zc_len) {
+		frame_put(c->zc[c->zc_done % RELAY_ZC_PENDING].frame);
+		c->zc_done++;
+		c->zc_len--;
+	}
+	printf("relay: viewer %d left (%lu frames, %lu dropped)\n", c->fd, c->frames, c->dropped);
+
+	// later events of this epoll batch may still point to it
+	c->fd = -1;
+	c->next = closed;
+	closed = c;
+}
+
+/*
+ * Send as much of the queue as the socket takes. Returns FAIL when
+ * the client is gone (and freed).
+ */
+static int client_flush(RelayClient *c) {
+
+	int flags, slot;
+	ssize_t n;
+	size_t off, total;
+	struct iovec iov[2];
+	struct msghdr msg;
+	RelayFrame *f;
+
+	for (;;) {
+		pthread_mutex_lock(&relay_lock);
+		if (!c->len) {
+			pthread_mutex_unlock(&relay_lock);
+			client_arm(c, 0);
+			return SUCCESS;
+		}
+		f = c->queue[c->head];
+		off = c->sent;
+		c->sending = 1;
+		pthread_mutex_unlock(&relay_lock);
+
+		total = sizeof(struct relay_hdr) + f->hdr.len;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		if (off < sizeof(struct relay_hdr)) {
+			iov[0].iov_base = (char *)&f->hdr + off;
+			iov[0].iov_len = sizeof(struct relay_hdr) - off;
+			iov[1].iov_base = f->data;
+			iov[1].iov_len = f->hdr.len;
+			msg.msg_iovlen = f->hdr.len ? 2 : 1;
+		}
+		else {
+			iov[0].iov_base = f->data + (off - sizeof(struct relay_hdr));
+			iov[0].iov_len = total - off;
+			msg.msg_iovlen = 1;
+		}
+
+		flags = MSG_NOSIGNAL | MSG_DONTWAIT;
+		if (zerocopy && f->hdr.len && c->zc_len < RELAY_ZC_PENDING)
+			flags |= MSG_ZEROCOPY;
+
+		n = sendmsg(c->fd, &msg, flags);
+		if (n < 0 && errno == ENOBUFS && (flags & MSG_ZEROCOPY))
+			n = sendmsg(c->fd, &msg, flags & ~MSG_ZEROCOPY);	// out of optmem, copy this one
+		else if (n >= 0 && (flags & MSG_ZEROCOPY)) {
+			// the kernel may read f->data until it tells us otherwise
+			__atomic_add_fetch(&f->refs, 1, __ATOMIC_RELAXED);
+			slot = (c->zc_done + c->zc_len) % RELAY_ZC_PENDING;
+			c->zc[slot].id = c->zc_next++;
+			c->zc[slot].frame = f;
+			c->zc_len++;
+		}
+
+		pthread_mutex_lock(&relay_lock);
+		c->sending = 0;
+		if (n > 0) {
+			c->sent += n;
+			if (c->sent == total) {
+				c->queue[c->head] = NULL;
+				c->head = (c->head + 1) % RELAY_MAX_QUEUE;
+				c->len--;
+				c->sent = 0;
+				if (f->hdr.len)
+					c->frames++;
+				pthread_mutex_unlock(&relay_lock);
+				frame_put(f);
+				continue;
+			}
+		}
+		pthread_mutex_unlock(&relay_lock);
+
+		if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			client_close(c);
+			return FAIL;
+		}
+		if (n < 0 || (size_t)n < total - off) {
+			// the socket is full, wait for EPOLLOUT
+			client_arm(c, 1);
+			return SUCCESS;
+		}
+	}
+}
+
+static int client_read(RelayClient *c) {
+
+	ssize_t n;
+	struct relay_cmd cmd;
+
+	for (;;) {
+		n = recv(c->fd, c->cmd + c->cmd_len, sizeof(c->cmd) - c->cmd_len, MSG_DONTWAIT);
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			return SUCCESS;
+		if (n <= 0)
+			return FAIL;
+		c->cmd_len += n;
+		if (c->cmd_len < sizeof(cmd))
+			continue;
+		memcpy(&cmd, c->cmd, sizeof(cmd));
+		c->cmd_len = 0;
+
+		if (cmd.op == RELAY_SELECT && cmd.arg >= 0 && cmd.arg < CAM_NUM) {
+			pthread_mutex_lock(&relay_lock);
+			c->selected = cmd.arg;
+			pthread_mutex_unlock(&relay_lock);
+		}
+	}
+}
+
+static void client_accept(void) {
+
+	int fd, one = 1;
+	struct epoll_event ev;
+	RelayClient *c;
+	RelayFrame *f;
+
+	while ((fd = accept4(listenfd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+		c = calloc(1, sizeof(RelayClient));
+		if (!c) {
+			close(fd);
+			continue;
+		}
+		c->fd = fd;
+		c->selected = -1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (zerocopy && setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) < 0) {
+			perror("SO_ZEROCOPY, copying instead");
+			zerocopy = 0;
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = c;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+
+		// hello - the current status
+		f = frame_get(0);
+		pthread_mutex_lock(&relay_lock);
+		c->next = clients;
+		clients = c;
+		f->hdr = status;
+		client_push(c, f);
+		pthread_mutex_unlock(&relay_lock);
+		frame_put(f);
+
+		printf("relay: viewer %d joined\n", fd);
+		client_flush(c);
+	}
+}
+
+static void print_stats(void) {
+
+	RelayClient *c;
+
+	pthread_mutex_lock(&relay_lock);
+	printf("%-6s %-6s %10s %10s %6s\n", "viewer", "camera", "frames", "dropped", "queued");
+	for (c = clients; c; c = c->next)
+		printf("%-6d %-6d %10lu %10lu %6d\n", c->fd, c->selected + 1, c->frames, c->dropped, c->len);
+	pthread_mutex_unlock(&relay_lock);
+	fflush(stdout);
+}
+
+static void on_signal(int sig) {
+
+	if (sig == SIGUSR1)
+		dump_stats = 1;
+	else
+		quit = 1;
+}
+
+int main(int argc, char* argv[]) {
+
+	int i, n, opt, one = 1, port = RELAY_PORT;
+	char *backend = NULL;
+	uint64_t val;
+	struct sockaddr_in6 addr;
+	struct epoll_event ev, events[RELAY_MAX_EVENTS];
+	RelayClient *c, *next;
+	pthread_t thread;
+
+	while ((opt = getopt(argc, argv, "t:p:q:z")) != -1) {
+		switch (opt) {
+		case 't': backend = optarg; break;
+		case 'p': port = atoi(optarg); break;
+		case 'q': queue_max = atoi(optarg); break;
+		case 'z': zerocopy = 1; break;
+		default:
+			fprintf(stderr, "Usage: %s [-t chardev|shm] [-p port] [-q queue] [-z]\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (queue_max < 1 || queue_max > RELAY_MAX_QUEUE) {
+		fprintf(stderr, "queue must be 1-%d frames\n", RELAY_MAX_QUEUE);
+		exit(1);
+	}
+
+	transport = transport_open(backend, TRANSPORT_READER);
+	if (!transport)
+		exit(-1);
+
+	listenfd = socket(AF_INET6, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin6_family = AF_INET6;
+	addr.sin6_addr = in6addr_any;
+	addr.sin6_port = htons(port);
+	setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (listenfd < 0 || bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listenfd, 64) < 0) {
+		perror("relay listen");
+		exit(-1);
+	}
+
+	epfd = epoll_create1(0);
+	wakefd = eventfd(0, EFD_NONBLOCK);
+	ev.events = EPOLLIN;
+	ev.data.ptr = &listen_tag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, listenfd, &ev);
+	ev.data.ptr = &wake_tag;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, wakefd, &ev);
+
+	signal(SIGPIPE, SIG_IGN);
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	signal(SIGUSR1, on_signal);
+
+	if (pthread_create(&thread, NULL, relay_read, NULL)) {
+		fprintf(stderr, "ERROR; pthread_create() failed\n");
+		exit(-1);
+	}
+	printf("relay: serving the %s transport on port %d%s\n", transport->ops->name, port,
+			zerocopy ? " (MSG_ZEROCOPY)" : "");
+
+	while (!quit) {
+		n = epoll_wait(epfd, events, RELAY_MAX_EVENTS, 200);
+		if (dump_stats) {
+			dump_stats = 0;
+			print_stats();
+		}
+
+		for (i = 0; i < n; i++) {
+			if (events[i].data.ptr == &listen_tag) {
+				client_accept();
+				continue;
+			}
+			if (events[i].data.ptr == &wake_tag) {
+				// new frames - push them to everybody not waiting for EPOLLOUT
+				while (read(wakefd, &val, sizeof(val)) > 0);
+				for (c = clients; c; c = next) {
+					next = c->next;
+					if (!c->want_out)
+						client_flush(c);
+				}
+				continue;
+			}
+
+			c = events[i].data.ptr;
+			if (c->fd < 0)
+				continue;
+			if (events[i].events & EPOLLERR)
+				client_zc_complete(c);
+			if ((events[i].events & (EPOLLIN | EPOLLHUP)) && client_read(c) < 0) {
+				client_close(c);
+				continue;
+			}
+			if (events[i].events & EPOLLOUT)
+				client_flush(c);
+		}
+
+		while (closed) {
+			c = closed;
+			closed = c->next;
+			free(c);
+		}
+	}
+
+	pthread_join(thread, NULL);
+	print_stats();
+	while (clients)
+		client_close(clients);
+	while (closed) {
+		c = closed;
+		closed = c->next;
+		free(c);
+	}
+	transport_close(transport);
+	return 0;
+}
@@ -0,0 +1,45 @@
+/*
+ *  relay.h - the wire protocol between relay.out and the net transport
+ *
+ *  The relay reads the cameras once (from any transport) and sends them
+ *  over TCP to every viewer that selected them. Everything is in host
+ *  byte order, like the frames themselves.
+ *
+ *	viewer -> relay: struct relay_cmd
+ *	relay -> viewer: struct relay_hdr, followed by hdr.len bytes of frame
+ *			 (exactly what transport_read_frame gives the reader)
+ *
+ *  A header with len 0 is a status message only. The relay sends one to
+ *  every new viewer and whenever the written/motion/validate state changes,
+ *  and every frame header carries the current state as well.
+ */
+#ifndef RELAY_H
+#define RELAY_H
+
+#include <stdint.h>
+
+#define RELAY_PORT 5555
+#define RELAY_HOST "127.0.0.1"
+#define RELAY_ENV "SMARTHOME_RELAY"	/* host:port, when -t net has no address */
+#define RELAY_MAGIC 0x534d4852		/* "SMHR" */
+
+/*
+ * viewer commands
+ */
+#define RELAY_SELECT 1			/* arg = camera to receive, 0-9 */
+
+struct relay_cmd {
+	uint32_t op;
+	int32_t  arg;
+};
+
+struct relay_hdr {
+	uint32_t magic;
+	int32_t  tape;			/* camera of the frame, -1 for status only */
+	uint32_t len;			/* frame bytes that follow */
+	uint32_t written;		/* bit n = camera n has been written */
+	uint32_t motion;		/* bit n = camera n has motion */
+	uint32_t validate;		/* write_user is running */
+};
+
+#endif
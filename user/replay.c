@@ -0,0 +1,481 @@
+/*
+ *  replay.c - reissue transport traffic recorded with $SMARTHOME_TRACE
+ *
+ *  The traces of one or more processes (e.g. a write_user and a read_user
+ *  recorded together) are merged on their clock, and every recorded thread
+ *  gets a thread of its own that makes its calls again, in order, against
+ *  a transport: at the recorded times (-x to speed them up), or with -f
+ *  back to back, as fast as the backend takes them. So two builds of the
+ *  module can be compared on exactly the same workload.
+ *
+ *  All the writes go through one writer, and every thread that reads gets
+ *  a reader of its own (the selected camera and the ROI are the reader's).
+ *  A frame or a packet is the recorded geometry or header with zeros of
+ *  the recorded size behind it, a pinned frame one of PIN_OUTSTANDING
+ *  buffers shared by the threads, free again once the module released it
+ *  (whichever thread's get_released heard of it). A read of a camera that
+ *  no replayed write will ever fill is skipped, instead of waiting for it
+ *  forever. With -f the writers may be done long before the readers, whose
+ *  reads then wait as long as the backend waits for a frame.
+ *
+ *  The report has the latency of every kind of call, replayed next to
+ *  recorded, and how late the calls were issued against the schedule.
+ *
+ *  Usage: replay.out [-t chardev|shm] [-f] [-x speed] trace...
+ */
+
+#include "../chardev.h"
+#include "transport.h"
+#include "transport_trace.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>		/* getopt */
+#include <time.h>
+#include <pthread.h>
+
+#define REPLAY_BUF (CAM_LEN + sizeof(size_t) + sizeof(int))
+
+typedef struct ReplayThread {
+
+	int                  file, thread;	/* recorded as */
+	struct trace_record *rec;
+	size_t               n, size;
+	int                  writes, reads;
+
+	Transport           *reader;
+	int                  tape;		/* the reader's camera */
+	char                *buf;
+	pthread_t            tid;
+
+	LatencyHist          replayed[TRACE_OPS], recorded[TRACE_OPS];
+	LatencyHist          behind;
+	long                 failed, skipped;
+
+} ReplayThread;
+
+static Transport *writer;
+static int fast;
+static double speed = 1;
+static uint64_t trace_start, replay_start;
+
+// cameras a replayed write filled, and the threads still writing
+static volatile uint32_t written;
+static volatile int writers_left, writers;
+
+static ReplayThread *threads;
+static int nthreads;
+
+// the buffers of the pinned frames, the cookie is the index
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+static char *pin_buf[PIN_OUTSTANDING];
+static int pin_busy[PIN_OUTSTANDING];
+
+static void pin_free(const uint64_t *cookies, int n) {
+
+	int i;
+
+	pthread_mutex_lock(&pin_lock);
+	for (i = 0; i < n; i++)
+		if (cookies[i] < PIN_OUTSTANDING)
+			pin_busy[cookies[i]] = 0;
+	pthread_mutex_unlock(&pin_lock);
+}
+
+/*
+ * A free pinned buffer, waiting a while for the module to release one,
+ * -1 if none was
+ */
+static int pin_get(void) {
+
+	uint64_t cookies[PIN_RELEASE_MAX];
+	int i, n, tries;
+
+	for (tries = 0; tries < 10; tries++) {
+		pthread_mutex_lock(&pin_lock);
+		for (i = 0; i < PIN_OUTSTANDING && pin_busy[i]; i++);
+		if (i < PIN_OUTSTANDING) {
+			if (!pin_buf[i])
+				pin_buf[i] = calloc(1, REPLAY_BUF);
+			pin_busy[i] = pin_buf[i] != NULL;
+		}
+		pthread_mutex_unlock(&pin_lock);
+		if (i < PIN_OUTSTANDING)
+			return pin_busy[i] ? i : -1;
+		n = transport_get_released(writer, cookies, PIN_RELEASE_MAX, 100);
+		if (n > 0)
+			pin_free(cookies, n);
+	}
+	return -1;
+}
+
+static ReplayThread *find_thread(int file, int thread) {
+
+	int i;
+
+	for (i = 0; i < nthreads; i++)
+		if (threads[i].file == file && threads[i].thread == thread)
+			return &threads[i];
+	threads = realloc(threads, (nthreads + 1) * sizeof(ReplayThread));
+	if (!threads) {
+		perror("realloc");
+		exit(-1);
+	}
+	memset(&threads[nthreads], 0, sizeof(ReplayThread));
+	threads[nthreads].file = file;
+	threads[nthreads].thread = thread;
+	return &threads[nthreads++];
+}
+
+static int load_trace(const char *path, int file) {
+
+	FILE *f = fopen(path, "r");
+	struct trace_header hdr;
+	struct trace_record rec;
+	ReplayThread *r;
+
+	if (!f) {
+		perror(path);
+		return FAIL;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != TRACE_MAGIC ||
+			hdr.version != TRACE_VERSION || hdr.record_size != sizeof(rec)) {
+		fprintf(stderr, "%s is not a trace\n", path);
+		fclose(f);
+		return FAIL;
+	}
+
+	// a killed process may leave half a record, it is dropped
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		if (rec.op >= TRACE_OPS)
+			continue;
+		r = find_thread(file, rec.thread);
+		if (r->n == r->size) {
+			r->size = r->size ? 2 * r->size : 1024;
+			r->rec = realloc(r->rec, r->size * sizeof(rec));
+			if (!r->rec) {
+				perror("realloc");
+				exit(-1);
+			}
+		}
+		r->rec[r->n++] = rec;
+		if (rec.role == TRANSPORT_WRITER)
+			r->writes = 1;
+		else
+			r->reads = 1;
+		if (!trace_start || rec.start_ns < trace_start)
+			trace_start = rec.start_ns;
+	}
+	fclose(f);
+	return SUCCESS;
+}
+
+/*
+ * Would the read wait for a write that doesn't come?
+ */
+static int read_hangs(ReplayThread *r) {
+
+	if (r->tape < 0 || r->tape >= CAM_NUM)
+		return 0;
+	return writers && !writers_left && !(written & (1u << r->tape));
+}
+
+static int replay_call(ReplayThread *r, const struct trace_record *rec) {
+
+	Transport *t = rec->role == TRANSPORT_WRITER ? writer : r->reader;
+	size_t off = sizeof(size_t) + sizeof(int) + sizeof(struct frame_times);
+	size_t size = rec->size;
+	struct frame_times times = {0};
+	struct packet_header hdr;
+	struct packet_read req;
+	struct cam_status status;
+	struct cam_stats stats;
+	struct cam_roi roi;
+	struct codec_params codec;
+	uint64_t cookies[PIN_RELEASE_MAX];
+	char *buf;
+	int ret, pin;
+
+	switch (rec->op) {
+	case TRACE_WRITE:
+		if (size < off)
+			size = off;
+		if (size > REPLAY_BUF)
+			size = REPLAY_BUF;
+		times.decode_ns = times.capture_ns = latency_now_ns();
+		memcpy(r->buf, &size, sizeof(size_t));
+		memcpy(r->buf + sizeof(size_t), &rec->tape, sizeof(int));
+		memcpy(r->buf + sizeof(size_t) + sizeof(int), &times, sizeof(times));
+		memcpy(r->buf + off, rec->head, size - off < TRACE_HEAD ? size - off : TRACE_HEAD);
+		ret = transport_write_frame(t, r->buf);
+		if (ret >= 0 && rec->tape >= 0 && rec->tape < CAM_NUM)
+			__sync_fetch_and_or(&written, 1u << rec->tape);
+		return ret;
+
+	case TRACE_WRITE_PACKET:
+		memset(&hdr, 0, sizeof(hdr));
+		memcpy(&hdr, rec->head, TRACE_HEAD);
+		if (hdr.size > REPLAY_BUF - sizeof(hdr))
+			hdr.size = REPLAY_BUF - sizeof(hdr);
+		hdr.times.decode_ns = hdr.times.capture_ns = latency_now_ns();
+		memcpy(r->buf, &hdr, sizeof(hdr));
+		ret = transport_write_packet(t, r->buf);
+		if (ret >= 0 && hdr.tape >= 0 && hdr.tape < CAM_NUM)
+			__sync_fetch_and_or(&written, 1u << hdr.tape);
+		return ret;
+
+	case TRACE_WRITE_PINNED:
+		pin = pin_get();
+		if (pin < 0)
+			return -ENOBUFS;
+		buf = pin_buf[pin];
+		if (size < off)
+			size = off;
+		if (size > REPLAY_BUF)
+			size = REPLAY_BUF;
+		times.decode_ns = times.capture_ns = latency_now_ns();
+		memcpy(buf, &size, sizeof(size_t));
+		memcpy(buf + sizeof(size_t), &rec->tape, sizeof(int));
+		memcpy(buf + sizeof(size_t) + sizeof(int), &times, sizeof(times));
+		memcpy(buf + off, rec->head, size - off < TRACE_HEAD ? size - off : TRACE_HEAD);
+		ret = transport_write_pinned(t, buf, pin);
+		if (ret < 0) {
+			cookies[0] = pin;
+			pin_free(cookies, 1);
+		} else if (rec->tape >= 0 && rec->tape < CAM_NUM)
+			__sync_fetch_and_or(&written, 1u << rec->tape);
+		return ret;
+
+	case TRACE_GET_RELEASED:
+		ret = transport_get_released(t, cookies, size < PIN_RELEASE_MAX ? size : PIN_RELEASE_MAX, rec->arg);
+		if (ret > 0)
+			pin_free(cookies, ret);
+		return ret;
+
+	case TRACE_READ:
+		return transport_read_frame(t, r->buf);
+
+	case TRACE_READ_PACKETS:
+		memcpy(&req, rec->head, sizeof(req));
+		if (req.buf_len > REPLAY_BUF)
+			req.buf_len = REPLAY_BUF;
+		req.buf = (uintptr_t)r->buf;
+		return transport_read_packets(t, &req);
+
+	case TRACE_CHANGE_TAPE:
+		ret = transport_change_tape(t, rec->tape);
+		if (ret >= 0)
+			r->tape = rec->tape;
+		return ret;
+
+	case TRACE_GET_TAPE:
+		return transport_get_tape_number(t);
+	case TRACE_CHECK_WRITTEN:
+		return transport_check_if_written(t, rec->tape);
+	case TRACE_GET_VALIDATE:
+		return transport_get_validate(t);
+	case TRACE_GET_MOTION:
+		return transport_get_motion(t);
+	case TRACE_GET_STATUS:
+		return transport_get_status(t, &status);
+
+	case TRACE_GET_STATS:
+		memset(&stats, 0, sizeof(stats));
+		stats.tape = rec->tape;
+		return transport_get_stats(t, &stats);
+
+	case TRACE_SET_MOTION:
+		return transport_set_motion(t, rec->tape, rec->arg);
+	case TRACE_SET_ONLINE:
+		return transport_set_online(t, rec->tape, rec->arg);
+	case TRACE_SET_POLICY:
+		return transport_set_policy(t, rec->tape, rec->arg);
+
+	case TRACE_SET_ROI:
+		memcpy(&roi, rec->head, sizeof(roi));
+		return transport_set_roi(t, &roi);
+
+	case TRACE_SET_CODEC:
+		// the head ends with the extradata size, the extradata is zeros
+		memset(&codec, 0, sizeof(codec));
+		memcpy(&codec, rec->head, TRACE_HEAD);
+		if (codec.extradata_size > CODEC_EXTRADATA_MAX)
+			codec.extradata_size = CODEC_EXTRADATA_MAX;
+		return transport_set_codec(t, &codec);
+
+	case TRACE_GET_CODEC:
+		memset(&codec, 0, sizeof(codec));
+		codec.tape = rec->tape;
+		return transport_get_codec(t, &codec);
+	}
+	return -EINVAL;
+}
+
+static void* replay_thread(void* arg) {
+
+	ReplayThread *r = arg;
+	const struct trace_record *rec;
+	uint64_t due, now, start;
+	struct timespec ts;
+	size_t i;
+	int ret;
+
+	for (i = 0; i < r->n; i++) {
+		rec = &r->rec[i];
+		if (!fast) {
+			due = replay_start + (uint64_t)((rec->start_ns - trace_start) / speed);
+			ts.tv_sec = due / 1000000000;
+			ts.tv_nsec = due % 1000000000;
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+			now = latency_now_ns();
+			hist_record(&r->behind, now > due ? now - due : 0);
+		}
+		if (rec->op == TRACE_READ && rec->role == TRANSPORT_READER && read_hangs(r)) {
+			r->skipped++;
+			continue;
+		}
+
+		start = latency_now_ns();
+		ret = replay_call(r, rec);
+		hist_record(&r->replayed[rec->op], latency_now_ns() - start);
+		hist_record(&r->recorded[rec->op], rec->dur_ns);
+		// -EAGAIN of a dropping camera depends on the timing, it isn't a failure
+		if (ret < 0 && ret != -EAGAIN && rec->ret >= 0)
+			r->failed++;
+	}
+	if (r->writes)
+		__sync_fetch_and_sub(&writers_left, 1);
+	return NULL;
+}
+
+static void dump_hist(const char *name, const LatencyHist *h) {
+
+	printf("  %-13s %8llu %10.1f %10.1f %10.1f", name, (unsigned long long)h->count,
+			hist_percentile(h, 50) / 1e3, hist_percentile(h, 99) / 1e3, h->max / 1e3);
+}
+
+int main(int argc, char* argv[]) {
+
+	int i, op, opt;
+	char *backend = NULL;
+	uint64_t span = 0, elapsed, end;
+	long calls = 0, failed = 0, skipped = 0;
+	LatencyHist *replayed, *recorded, behind;
+	ReplayThread *r;
+
+	while ((opt = getopt(argc, argv, "t:fx:")) != -1) {
+		switch (opt) {
+		case 't': backend = optarg; break;
+		case 'f': fast = 1; break;
+		case 'x': speed = atof(optarg); break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind == argc || speed <= 0) {
+usage:
+		fprintf(stderr, "Usage: %s [-t chardev|shm] [-f] [-x speed] trace...\n", argv[0]);
+		exit(1);
+	}
+	// don't record the replay itself
+	unsetenv(TRACE_ENV);
+
+	for (i = optind; i < argc; i++)
+		if (load_trace(argv[i], i - optind) < 0)
+			exit(1);
+	if (!nthreads) {
+		fprintf(stderr, "nothing to replay\n");
+		exit(1);
+	}
+
+	for (i = 0; i < nthreads; i++)
+		writers += threads[i].writes;
+	// the writer first, a shm reader needs the ring it makes
+	if (writers) {
+		writer = transport_open(backend, TRANSPORT_WRITER);
+		if (!writer)
+			exit(-1);
+	}
+	for (i = 0; i < nthreads; i++) {
+		r = &threads[i];
+		end = r->rec[r->n - 1].start_ns + r->rec[r->n - 1].dur_ns - trace_start;
+		if (end > span)
+			span = end;
+		if (r->reads) {
+			r->reader = transport_open(backend, TRANSPORT_READER);
+			if (!r->reader)
+				exit(-1);
+		}
+		r->buf = calloc(1, REPLAY_BUF);
+		if (!r->buf) {
+			perror("calloc");
+			exit(-1);
+		}
+	}
+	writers_left = writers;
+
+	replay_start = latency_now_ns();
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&threads[i].tid, NULL, replay_thread, &threads[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(-1);
+		}
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i].tid, NULL);
+	elapsed = latency_now_ns() - replay_start;
+
+	replayed = calloc(TRACE_OPS, sizeof(LatencyHist));
+	recorded = calloc(TRACE_OPS, sizeof(LatencyHist));
+	if (!replayed || !recorded) {
+		perror("calloc");
+		exit(-1);
+	}
+	memset(&behind, 0, sizeof(behind));
+	for (i = 0; i < nthreads; i++) {
+		r = &threads[i];
+		for (op = 0; op < TRACE_OPS; op++) {
+			hist_merge(&replayed[op], &r->replayed[op]);
+			hist_merge(&recorded[op], &r->recorded[op]);
+		}
+		hist_merge(&behind, &r->behind);
+		calls += r->n;
+		failed += r->failed;
+		skipped += r->skipped;
+	}
+
+	printf("replay through %s: %ld calls of %d threads from %d traces, %s\n",
+			(writer ? writer : threads[0].reader)->ops->name, calls, nthreads, argc - optind,
+			fast ? "as fast as possible" : "at the recorded times");
+	printf("  recorded %.3f s, replayed %.3f s, %ld failed, %ld reads skipped\n",
+			span / 1e9, elapsed / 1e9, failed, skipped);
+	printf("  %-13s %8s %10s %10s %10s %10s %10s %10s   (usec)\n", "call", "count",
+			"p50", "p99", "max", "rec p50", "rec p99", "rec max");
+	for (op = 0; op < TRACE_OPS; op++) {
+		if (!replayed[op].count)
+			continue;
+		dump_hist(trace_op_name(op), &replayed[op]);
+		printf(" %10.1f %10.1f %10.1f\n", hist_percentile(&recorded[op], 50) / 1e3,
+				hist_percentile(&recorded[op], 99) / 1e3, recorded[op].max / 1e3);
+	}
+	if (!fast) {
+		dump_hist("behind", &behind);
+		printf("\n");
+	}
+
+	for (i = 0; i < nthreads; i++) {
+		transport_close(threads[i].reader);
+		free(threads[i].buf);
+		free(threads[i].rec);
+	}
+	transport_close(writer);
+	for (i = 0; i < PIN_OUTSTANDING; i++)
+		free(pin_buf[i]);
+	free(threads);
+	free(replayed);
+	free(recorded);
+	return 0;
+}
@@ -0,0 +1,530 @@
+/*
+ *  scan_footage.c - find the motion in recorded videos, much faster than real time
+ *
+ *  Every file is cut at its keyframes into chunks of at least -g seconds
+ *  (a few GOPs), so every chunk can be decoded on its own. The chunks are
+ *  spread over a pool of workers, every worker takes its own chunks in
+ *  order, and when it runs out it steals from the far end of another
+ *  worker's queue - a worker goes through one file front to back, while
+ *  the thieves take the parts its owner would reach last.
+ *
+ *  The frames are scored with the motion model of write_user (motion.h,
+ *  the vectorized SAD against a background), each frame belongs to the
+ *  chunk its timestamp falls in, and a worker that goes on with the next
+ *  chunk of the same file keeps its background.
+ *
+ *  The activity index is a line per motion event:
+ *
+ *	<file> <start s> <end s> <peak score>
+ *
+ *  An event lasts as long as the frames above the threshold are less
+ *  than MOTION_HOLD_MS apart, like the motion flag of the cameras.
+ *
+ *  Usage: scan_footage.out [-j threads] [-m threshold] [-g chunk_seconds] [-o index] <video>...
+ */
+
+#include "../chardev.h"
+#include "decoder.h"
+#include "motion.h"
+#include "latency.h"
+
+#include <libswscale/swscale.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>		/* getopt, sysconf */
+#include <pthread.h>
+
+typedef struct ScanSample {
+
+	double   t;		/* seconds from the start of the file */
+	float    score;
+
+} ScanSample;
+
+typedef struct ScanFile {
+
+	const char *name;
+	double      duration;
+	int         first_chunk, chunks;
+
+} ScanFile;
+
+typedef struct ScanChunk {
+
+	int         file;
+	int64_t     seek;		/* the keyframe it starts with, stream time base */
+	int64_t     start, end;	/* the frames it scores, [start, end) */
+
+	ScanSample *samples;
+	int         n, cap;
+
+} ScanChunk;
+
+typedef struct ScanWorker {
+
+	int               id;
+	pthread_t         thread;
+
+	// the chunks of the worker, the owner takes from the head, thieves from the tail
+	pthread_mutex_t   lock;
+	int              *queue;
+	int               head, tail;
+
+	// the file being decoded
+	int               file, last_chunk;
+	AVFormatContext  *fmt;
+	AVCodecContext   *codec;
+	int               stream;
+	AVFrame          *frame;
+	struct SwsContext *sws;
+	uint8_t          *gray;
+	Motion            motion;
+
+	unsigned long     frames, stolen;
+
+} ScanWorker;
+
+double threshold = 3;
+double chunk_seconds = 2;
+int workers = 0;
+
+ScanFile *files;
+int num_files;
+ScanChunk *chunks;
+int num_chunks, cap_chunks;
+ScanWorker *pool;
+
+pthread_mutex_t chunks_lock = PTHREAD_MUTEX_INITIALIZER;
+int next_file;
+
+static ScanChunk *add_chunk(int file, int64_t seek, int64_t start, int64_t end) {
+
+	ScanChunk *c;
+
+	if (num_chunks == cap_chunks) {
+		cap_chunks = cap_chunks ? cap_chunks * 2 : 256;
+		chunks = realloc(chunks, cap_chunks * sizeof(ScanChunk));
+		if (!chunks) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+	}
+	c = &chunks[num_chunks++];
+	memset(c, 0, sizeof(ScanChunk));
+	c->file = file;
+	c->seek = seek;
+	c->start = start;
+	c->end = end;
+	return c;
+}
+
+/*
+ * Demux the file (no decoding) for its keyframes, and cut it into chunks
+ */
+static void index_file(int file) {
+
+	AVFormatContext *fmt = NULL;
+	AVPacket packet;
+	AVStream *st;
+	int i, stream = -1, keys = 0, cap = 0;
+	int64_t ts, *key = NULL, min_len, start;
+
+	if (avformat_open_input(&fmt, files[file].name, NULL, NULL) != 0 ||
+			avformat_find_stream_info(fmt, NULL) < 0) {
+		fprintf(stderr, "can't open %s\n", files[file].name);
+		avformat_close_input(&fmt);
+		return;
+	}
+	for (i = 0; i < fmt->nb_streams; i++)
+		if (fmt->streams[i]->codec->codec_type == AVMEDIA_TYPE_VIDEO) {
+			stream = i;
+			break;
+		}
+	if (stream < 0) {
+		fprintf(stderr, "%s: no video stream\n", files[file].name);
+		avformat_close_input(&fmt);
+		return;
+	}
+	st = fmt->streams[stream];
+	if (fmt->duration != AV_NOPTS_VALUE)
+		files[file].duration = fmt->duration / (double)AV_TIME_BASE;
+
+	while (av_read_frame(fmt, &packet) >= 0) {
+		ts = packet.pts != AV_NOPTS_VALUE ? packet.pts : packet.dts;
+		if (packet.stream_index == stream && (packet.flags & AV_PKT_FLAG_KEY) && ts != AV_NOPTS_VALUE) {
+			if (keys == cap) {
+				cap = cap ? cap * 2 : 64;
+				key = realloc(key, cap * sizeof(int64_t));
+			}
+			if (key)
+				key[keys++] = ts;
+		}
+		av_free_packet(&packet);
+	}
+
+	/*
+	 * A chunk from a keyframe to the first keyframe chunk_seconds later,
+	 * the first one from the start of the file, the last one to its end
+	 * (the stream goes with the context)
+	 */
+	min_len = chunk_seconds * st->time_base.den / st->time_base.num;
+	avformat_close_input(&fmt);
+	pthread_mutex_lock(&chunks_lock);
+	files[file].first_chunk = num_chunks;
+	if (!keys)
+		add_chunk(file, INT64_MIN, INT64_MIN, INT64_MAX);
+	else {
+		start = INT64_MIN;
+		ts = key[0];
+		for (i = 1; i < keys; i++)
+			if (key[i] - ts >= min_len) {
+				add_chunk(file, ts, start, key[i]);
+				start = ts = key[i];
+			}
+		add_chunk(file, ts, start, INT64_MAX);
+	}
+	files[file].chunks = num_chunks - files[file].first_chunk;
+	pthread_mutex_unlock(&chunks_lock);
+	free(key);
+}
+
+static void *index_thread(void *arg) {
+
+	int file;
+
+	for (;;) {
+		file = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED);
+		if (file >= num_files)
+			break;
+		index_file(file);
+	}
+	return NULL;
+}
+
+/*
+ * The index threads added the chunks file by file in any order, put the
+ * files back in the order they were given, every file's chunks stay in order
+ */
+static void sort_chunks(void) {
+
+	ScanChunk *sorted = malloc((num_chunks ? num_chunks : 1) * sizeof(ScanChunk));
+	int i, n = 0;
+
+	if (!sorted) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < num_files; i++) {
+		memcpy(&sorted[n], &chunks[files[i].first_chunk], files[i].chunks * sizeof(ScanChunk));
+		files[i].first_chunk = n;
+		n += files[i].chunks;
+	}
+	free(chunks);
+	chunks = sorted;
+}
+
+/*
+ * The next chunk of the worker, or one stolen from another. -1 when there
+ * is no work left anywhere (no work is ever added, so one empty pass is enough).
+ */
+static int next_chunk(ScanWorker *w) {
+
+	int i, chunk = -1;
+	ScanWorker *v;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head < w->tail)
+		chunk = w->queue[w->head++];
+	pthread_mutex_unlock(&w->lock);
+	if (chunk >= 0)
+		return chunk;
+
+	for (i = 1; i < workers && chunk < 0; i++) {
+		v = &pool[(w->id + i) % workers];
+		pthread_mutex_lock(&v->lock);
+		if (v->head < v->tail)
+			chunk = v->queue[--v->tail];
+		pthread_mutex_unlock(&v->lock);
+	}
+	if (chunk >= 0)
+		w->stolen++;
+	return chunk;
+}
+
+static void close_file(ScanWorker *w) {
+
+	if (w->file < 0)
+		return;
+	motion_free(&w->motion);
+	decoder_close(NULL, &w->fmt, w->codec);
+	av_free(w->gray);
+	w->gray = NULL;
+	w->file = -1;
+}
+
+static int open_file(ScanWorker *w, int file) {
+
+	close_file(w);
+	// the parallelism is over the chunks, one decoding thread each
+	if (decoder_open(files[file].name, NULL, NULL, &w->fmt, &w->stream, &w->codec, 1) < 0)
+		return FAIL;
+	if (motion_init(&w->motion, w->codec->width, w->codec->height, threshold, 0) < 0) {
+		decoder_close(NULL, &w->fmt, w->codec);
+		return FAIL;
+	}
+	if (!has_luma_plane(w->codec->pix_fmt)) {
+		w->gray = av_malloc((size_t)w->codec->width * w->codec->height);
+		if (!w->gray) {
+			motion_free(&w->motion);
+			decoder_close(NULL, &w->fmt, w->codec);
+			return FAIL;
+		}
+	}
+	w->file = file;
+	return SUCCESS;
+}
+
+/*
+ * Score a decoded frame into its chunk. 1 once the frame is past the chunk.
+ */
+static int score_frame(ScanWorker *w, ScanChunk *c) {
+
+	AVStream *st = w->fmt->streams[w->stream];
+	int64_t pts = w->frame->best_effort_timestamp, first;
+	uint8_t *luma = w->frame->data[0];
+	int pitch = w->frame->linesize[0];
+	ScanSample *s;
+
+	if (pts == AV_NOPTS_VALUE)
+		return 0;
+	if (pts >= c->end)
+		return 1;
+	if (pts < c->start)
+		return 0;
+
+	if (w->gray) {
+		w->sws = sws_getCachedContext(w->sws, w->codec->width, w->codec->height, w->codec->pix_fmt,
+				w->codec->width, w->codec->height, PIX_FMT_GRAY8, SWS_POINT, NULL, NULL, NULL);
+		pitch = w->codec->width;
+		sws_scale(w->sws, (uint8_t const * const *)w->frame->data, w->frame->linesize, 0,
+				w->codec->height, &w->gray, &pitch);
+		luma = w->gray;
+	}
+
+	if (c->n == c->cap) {
+		c->cap = c->cap ? c->cap * 2 : 128;
+		s = realloc(c->samples, c->cap * sizeof(ScanSample));
+		if (!s) {
+			fprintf(stderr, "out of memory\n");
+			exit(1);
+		}
+		c->samples = s;
+	}
+	first = st->start_time != AV_NOPTS_VALUE ? st->start_time : 0;
+	s = &c->samples[c->n++];
+	s->t = (pts - first) * av_q2d(st->time_base);
+	motion_update(&w->motion, luma, pitch, (uint64_t)(s->t * 1e9));
+	s->score = w->motion.score;
+	w->frames++;
+	return 0;
+}
+
+static void scan_chunk(ScanWorker *w, int chunk) {
+
+	ScanChunk *c = &chunks[chunk];
+	AVPacket packet;
+	int finished, past = 0, fresh = 0;
+
+	if (w->file != c->file) {
+		if (open_file(w, c->file) < 0)
+			return;
+		fresh = 1;
+	}
+
+	// the chunk before read a bit past its end, back to this chunk's keyframe
+	if (c->seek != INT64_MIN)
+		av_seek_frame(w->fmt, w->stream, c->seek, AVSEEK_FLAG_BACKWARD);
+	else if (!fresh)
+		av_seek_frame(w->fmt, w->stream, 0, AVSEEK_FLAG_BYTE);
+	avcodec_flush_buffers(w->codec);
+
+	// right after the chunk before it, the background goes on
+	if (fresh || w->last_chunk != chunk - 1)
+		w->motion.primed = 0;
+	w->last_chunk = chunk;
+
+	while (!past && av_read_frame(w->fmt, &packet) >= 0) {
+		if (packet.stream_index == w->stream) {
+			avcodec_decode_video2(w->codec, w->frame, &finished, &packet);
+			if (finished)
+				past = score_frame(w, c);
+		}
+		av_free_packet(&packet);
+	}
+
+	// the end of the file, drain the frames the decoder still has
+	if (!past) {
+		av_init_packet(&packet);
+		packet.data = NULL;
+		packet.size = 0;
+		do {
+			avcodec_decode_video2(w->codec, w->frame, &finished, &packet);
+		} while (finished && !score_frame(w, c));
+	}
+}
+
+static void *scan_thread(void *arg) {
+
+	ScanWorker *w = (ScanWorker *)arg;
+	int chunk;
+
+	w->file = -1;
+	w->last_chunk = -2;
+	w->frame = av_frame_alloc();
+	while ((chunk = next_chunk(w)) >= 0)
+		scan_chunk(w, chunk);
+	close_file(w);
+	sws_freeContext(w->sws);
+	av_frame_free(&w->frame);
+	return NULL;
+}
+
+/*
+ * The events of a file, from its chunks in order
+ */
+static void write_events(FILE *out, int file) {
+
+	int i, j, open = 0;
+	double start = 0, last = 0, peak = 0;
+	ScanChunk *c;
+	ScanSample *s;
+
+	for (i = 0; i < files[file].chunks; i++) {
+		c = &chunks[files[file].first_chunk + i];
+		for (j = 0; j < c->n; j++) {
+			s = &c->samples[j];
+			if (s->score < threshold)
+				continue;
+			if (open && s->t - last > MOTION_HOLD_MS / 1000.0) {
+				fprintf(out, "%s %.2f %.2f %.1f\n", files[file].name, start, last, peak);
+				open = 0;
+			}
+			if (!open) {
+				open = 1;
+				start = s->t;
+				peak = 0;
+			}
+			last = s->t;
+			if (s->score > peak)
+				peak = s->score;
+		}
+	}
+	if (open)
+		fprintf(out, "%s %.2f %.2f %.1f\n", files[file].name, start, last, peak);
+}
+
+void usage() {
+
+	fprintf(stderr, "Usage: .exe [-j threads] [-m threshold] [-g chunk_seconds] [-o index] <video>...\n");
+	exit(1);
+}
+
+int main(int argc, char* argv[]) {
+
+	int i, j, opt, per;
+	char *index = NULL;
+	FILE *out = stdout;
+	pthread_t *threads;
+	uint64_t start_ns, wall_ns;
+	unsigned long frames = 0, stolen = 0;
+	double footage = 0;
+
+	while ((opt = getopt(argc, argv, "j:m:g:o:")) != -1) {
+		switch (opt) {
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 'm':
+			threshold = atof(optarg);
+			break;
+		case 'g':
+			chunk_seconds = atof(optarg);
+			break;
+		case 'o':
+			index = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+	num_files = argc - optind;
+	if (num_files < 1 || chunk_seconds <= 0)
+		usage();
+	if (workers <= 0)
+		workers = sysconf(_SC_NPROCESSORS_ONLN) > 0 ? sysconf(_SC_NPROCESSORS_ONLN) : 1;
+
+	if (index) {
+		out = fopen(index, "w");
+		if (!out) {
+			perror(index);
+			exit(1);
+		}
+	}
+
+	av_register_all();
+	av_log_set_level(AV_LOG_ERROR);
+
+	files = calloc(num_files, sizeof(ScanFile));
+	pool = calloc(workers, sizeof(ScanWorker));
+	threads = calloc(workers, sizeof(pthread_t));
+	if (!files || !pool || !threads) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	for (i = 0; i < num_files; i++)
+		files[i].name = argv[optind + i];
+
+	start_ns = latency_now_ns();
+
+	// the keyframes of all the files, in parallel too
+	for (i = 0; i < workers; i++)
+		pthread_create(&threads[i], NULL, index_thread, NULL);
+	for (i = 0; i < workers; i++)
+		pthread_join(threads[i], NULL);
+
+	sort_chunks();
+
+	// every worker owns a contiguous run of chunks, in order
+	per = (num_chunks + workers - 1) / workers;
+	for (i = 0; i < workers; i++) {
+		pool[i].id = i;
+		pthread_mutex_init(&pool[i].lock, NULL);
+		pool[i].queue = malloc((per ? per : 1) * sizeof(int));
+		for (j = i * per; j < num_chunks && j < (i + 1) * per; j++)
+			pool[i].queue[pool[i].tail++] = j;
+	}
+	for (i = 0; i < workers; i++)
+		pthread_create(&pool[i].thread, NULL, scan_thread, &pool[i]);
+	for (i = 0; i < workers; i++) {
+		pthread_join(pool[i].thread, NULL);
+		frames += pool[i].frames;
+		stolen += pool[i].stolen;
+	}
+	wall_ns = latency_now_ns() - start_ns;
+
+	fprintf(out, "# file start end peak (threshold %.1f)\n", threshold);
+	for (i = 0; i < num_files; i++) {
+		write_events(out, i);
+		footage += files[i].duration;
+	}
+	if (index)
+		fclose(out);
+
+	fprintf(stderr, "%d files, %.0f s of footage, %d chunks, %lu frames in %.2f s with %d workers (%lu stolen chunks), %.1fx real time\n",
+			num_files, footage, num_chunks, frames, wall_ns / 1e9, workers, stolen,
+			wall_ns ? footage / (wall_ns / 1e9) : 0);
+	return 0;
+}
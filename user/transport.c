@@ -0,0 +1,73 @@
+/*
+ *  transport.c - choosing and opening a frame transport backend
+ */
+
+#include "transport.h"
+#include "transport_trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * All the backends we know, first one is the default
+ */
+static const TransportOps *backends[] = {
+	&chardev_transport_ops,
+	&shm_transport_ops,
+	&net_transport_ops,
+	NULL
+};
+
+Transport *transport_open(const char *name, int role) {
+
+	int i;
+	size_t len;
+	const char *colon;
+	const char *trace_path = getenv(TRACE_ENV);
+	Transport *t;
+
+	if (!name)
+		name = getenv(TRANSPORT_ENV);
+	if (!name || !*name)
+		name = TRANSPORT_DEFAULT;
+
+	colon = strchr(name, ':');
+	len = colon ? (size_t)(colon - name) : strlen(name);
+
+	for (i = 0; backends[i]; i++)
+		if (strlen(backends[i]->name) == len && !strncmp(backends[i]->name, name, len))
+			break;
+
+	if (!backends[i]) {
+		fprintf(stderr, "Unknown transport: %s (use chardev, shm or net)\n", name);
+		return NULL;
+	}
+
+	t = calloc(1, sizeof(Transport));
+	if (!t) {
+		perror("transport_open");
+		return NULL;
+	}
+	t->ops = backends[i];
+	t->role = role;
+	t->arg = colon ? strdup(colon + 1) : NULL;
+
+	if (t->ops->open(t) < 0) {
+		free((char *)t->arg);
+		free(t);
+		return NULL;
+	}
+	if (trace_path && *trace_path)
+		return trace_wrap(t, trace_path);
+	return t;
+}
+
+void transport_close(Transport *t) {
+
+	if (!t)
+		return;
+	t->ops->close(t);
+	free((char *)t->arg);
+	free(t);
+}
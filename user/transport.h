@@ -0,0 +1,143 @@
+/*
+ *  transport.h - the frame transport between write_user and read_user.
+ *
+ *  The user applications don't talk to the char devices directly any more,
+ *  they go through a Transport. A transport is a table of operations
+ *  (a backend) and a private state of that backend.
+ *
+ *  Backends:
+ *	chardev - the kernel module (write_char_dev / read_char_dev)
+ *	shm     - a POSIX shared memory ring with futex notification,
+ *		  no kernel module and no root needed
+ *	net     - reader only, frames from a relay.out over TCP
+ *
+ *  A backend name may carry an argument after a colon, e.g. net:host:port
+ *
+ *  With $SMARTHOME_TRACE set, every transport is wrapped in a tracing one
+ *  that records its calls for replay.out (see transport_trace.h).
+ */
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+
+/*
+ * The role of the process opening the transport
+ */
+#define TRANSPORT_WRITER 0
+#define TRANSPORT_READER 1
+
+/*
+ * Environment variable used when no backend name is given
+ */
+#define TRANSPORT_ENV "SMARTHOME_TRANSPORT"
+#define TRANSPORT_DEFAULT "chardev"
+
+typedef struct Transport Transport;
+struct codec_params;
+struct packet_read;
+struct cam_stats;
+struct cam_status;
+struct cam_roi;
+
+typedef struct TransportOps {
+
+	const char *name;
+
+	int  (*open)(Transport *t);
+	void (*close)(Transport *t);
+
+	/*
+	 * writer side - buf is a serialized frame:
+	 * [size_t size][int tape][frame...]
+	 */
+	int  (*write_frame)(Transport *t, char *buf);
+	int  (*set_motion)(Transport *t, int tape, int on);
+	int  (*set_online)(Transport *t, int tape, int on);	/* hot-plug, off forgets the camera */
+
+	/*
+	 * backpressure (POLICY_* in chardev.h) - with POLICY_DROP
+	 * write_frame returns -EAGAIN while the last frame wasn't read,
+	 * get_stats fills *st for st->tape
+	 */
+	int  (*set_policy)(Transport *t, int tape, int policy);
+	int  (*get_stats)(Transport *t, struct cam_stats *st);
+
+	/*
+	 * reader side - fills buf with the [frame...] part of the
+	 * latest frame of the selected camera
+	 */
+	int  (*read_frame)(Transport *t, char *buf);
+	int  (*set_roi)(Transport *t, const struct cam_roi *roi);	/* read_frame gives only that */
+	int  (*change_tape)(Transport *t, int n);
+	int  (*get_tape_number)(Transport *t);
+	int  (*check_if_written)(Transport *t, int n);
+	int  (*get_validate)(Transport *t);
+	int  (*get_motion)(Transport *t);	/* bitmask of cameras with motion */
+	int  (*get_status)(Transport *t, struct cam_status *st);	/* all of the above at once */
+
+	/*
+	 * encoded passthrough (chardev.h) - the writer sends the codec
+	 * once and then [packet_header][payload] per packet, the reader gets
+	 * the packets since the last keyframe. codec->tape selects the camera.
+	 * Return -errno on failure, -EOPNOTSUPP if the backend can't do it.
+	 */
+	int  (*set_codec)(Transport *t, struct codec_params *codec);
+	int  (*write_packet)(Transport *t, char *buf);
+	int  (*get_codec)(Transport *t, struct codec_params *codec);
+	int  (*read_packets)(Transport *t, struct packet_read *req);
+
+	/*
+	 * pinned frames (IOCTL_WRITE_PINNED) - the backend keeps buf, the
+	 * writer may reuse it only once get_released gave back its cookie.
+	 * get_released fills up to max cookies, waiting up to timeout_ms for
+	 * one, and returns the count. -EOPNOTSUPP if the backend can't.
+	 */
+	int  (*write_pinned)(Transport *t, char *buf, uint64_t cookie);
+	int  (*get_released)(Transport *t, uint64_t *cookies, int max, int timeout_ms);
+
+} TransportOps;
+
+struct Transport {
+
+	const TransportOps *ops;
+	int                 role;
+	const char         *arg;	/* what came after "name:", or NULL */
+	void               *priv;
+};
+
+extern const TransportOps chardev_transport_ops;
+extern const TransportOps shm_transport_ops;
+extern const TransportOps net_transport_ops;
+
+/*
+ * Open a transport by backend name (NULL = $SMARTHOME_TRANSPORT or chardev).
+ * Returns NULL on failure.
+ */
+Transport *transport_open(const char *name, int role);
+void transport_close(Transport *t);
+
+/*
+ * Thin wrappers, so the callers don't have to go through ops
+ */
+static inline int transport_write_frame(Transport *t, char *buf) { return t->ops->write_frame(t, buf); }
+static inline int transport_set_motion(Transport *t, int tape, int on) { return t->ops->set_motion(t, tape, on); }
+static inline int transport_set_online(Transport *t, int tape, int on) { return t->ops->set_online(t, tape, on); }
+static inline int transport_set_policy(Transport *t, int tape, int policy) { return t->ops->set_policy(t, tape, policy); }
+static inline int transport_get_stats(Transport *t, struct cam_stats *st) { return t->ops->get_stats(t, st); }
+static inline int transport_read_frame(Transport *t, char *buf) { return t->ops->read_frame(t, buf); }
+static inline int transport_set_roi(Transport *t, const struct cam_roi *roi) { return t->ops->set_roi(t, roi); }
+static inline int transport_change_tape(Transport *t, int n) { return t->ops->change_tape(t, n); }
+static inline int transport_get_tape_number(Transport *t) { return t->ops->get_tape_number(t); }
+static inline int transport_check_if_written(Transport *t, int n) { return t->ops->check_if_written(t, n); }
+static inline int transport_get_validate(Transport *t) { return t->ops->get_validate(t); }
+static inline int transport_get_motion(Transport *t) { return t->ops->get_motion(t); }
+static inline int transport_get_status(Transport *t, struct cam_status *st) { return t->ops->get_status(t, st); }
+static inline int transport_set_codec(Transport *t, struct codec_params *c) { return t->ops->set_codec(t, c); }
+static inline int transport_write_packet(Transport *t, char *buf) { return t->ops->write_packet(t, buf); }
+static inline int transport_get_codec(Transport *t, struct codec_params *c) { return t->ops->get_codec(t, c); }
+static inline int transport_read_packets(Transport *t, struct packet_read *req) { return t->ops->read_packets(t, req); }
+static inline int transport_write_pinned(Transport *t, char *buf, uint64_t cookie) { return t->ops->write_pinned(t, buf, cookie); }
+static inline int transport_get_released(Transport *t, uint64_t *cookies, int max, int timeout_ms) { return t->ops->get_released(t, cookies, max, timeout_ms); }
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ *  transport_chardev.c - the kernel module backend of the frame transport
+ *
+ *  Writer talks to /dev/write_char_dev, reader to /dev/read_char_dev,
+ *  exactly as write_user and read_user used to do by themselves.
+ *  chardev:<n> uses instance n of the module (/dev/write_char_dev<n>
+ *  and /dev/read_char_dev<n>), instance 0 has the plain names.
+ */
+
+#include "../chardev.h"
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>		/* open */
+#include <unistd.h>		/* close */
+#include <sys/ioctl.h>		/* ioctl */
+
+typedef struct ChardevState {
+
+	int             file_desc;
+
+} ChardevState;
+
+static int chardev_open(Transport *t) {
+
+	int instance = t->arg ? atoi(t->arg) : 0;
+	char dev[64];
+	ChardevState *s;
+
+	if (instance < 0 || instance >= MAX_INSTANCES) {
+		printf("No such instance: %d (0-%d)\n", instance, MAX_INSTANCES - 1);
+		return FAIL;
+	}
+	snprintf(dev, sizeof(dev), "%s", t->role == TRANSPORT_WRITER ? DEVICE_FILE_NAME_W : DEVICE_FILE_NAME_R);
+	if (instance)
+		snprintf(dev + strlen(dev), sizeof(dev) - strlen(dev), "%d", instance);
+
+	s = calloc(1, sizeof(ChardevState));
+	if (!s) {
+		perror("chardev_open");
+		return FAIL;
+	}
+
+	s->file_desc = open(dev, 0);
+	if (s->file_desc < 0) {
+		printf("Can't open device file: %s\n", dev);
+		free(s);
+		return FAIL;
+	}
+
+	t->priv = s;
+	return SUCCESS;
+}
+
+static void chardev_close(Transport *t) {
+
+	ChardevState *s = t->priv;
+
+	close(s->file_desc);
+	free(s);
+}
+
+static int chardev_write_frame(Transport *t, char *buf) {
+
+	int ret_val;
+	ChardevState *s = t->priv;
+
+	// every camera has its own size in the module, the threads don't need a lock
+	ret_val = ioctl(s->file_desc, IOCTL_WRITE, buf);
+	return ret_val < 0 ? -errno : ret_val;
+}
+
+static int chardev_set_motion(Transport *t, int tape, int on) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, on ? IOCTL_SET_MOTION : IOCTL_CLEAR_MOTION, tape) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_set_online(Transport *t, int tape, int on) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, on ? IOCTL_CAM_ONLINE : IOCTL_CAM_OFFLINE, tape) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_set_policy(Transport *t, int tape, int policy) {
+
+	struct cam_policy p = { tape, policy };
+	ChardevState *s = t->priv;
+
+	return ioctl(s->file_desc, IOCTL_SET_POLICY, &p) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_get_stats(Transport *t, struct cam_stats *st) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_CAM_STATS, st) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_read_frame(Transport *t, char *buf) {
+
+	int ret_val;
+	ChardevState *s = t->priv;
+	/*
+	 * Warning - this is dangerous because we don't tell
+	 * the kernel how far it's allowed to write, so it
+	 * might overflow the buffer. In a real production
+	 * program, we would have used two ioctls - one to tell
+	 * the kernel the buffer length and another to give
+	 * it the buffer to fill
+	 */
+	ret_val = ioctl(s->file_desc, IOCTL_READ, buf);
+	return ret_val < 0 ? -errno : ret_val;
+}
+
+static int chardev_set_roi(Transport *t, const struct cam_roi *roi) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_SET_ROI, roi) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_change_tape(Transport *t, int n) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_CHANGE_TAPE, n);
+}
+
+static int chardev_get_tape_number(Transport *t) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_TAPE_NUMBER);
+}
+
+static int chardev_check_if_written(Transport *t, int n) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_CHECK_IF_WRITTEN, n);
+}
+
+static int chardev_get_validate(Transport *t) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_VALIDATE);
+}
+
+static int chardev_get_motion(Transport *t) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_MOTION);
+}
+
+static int chardev_get_status(Transport *t, struct cam_status *st) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_STATUS, st) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_set_codec(Transport *t, struct codec_params *codec) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_SET_CODEC, codec) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_write_packet(Transport *t, char *buf) {
+
+	int ret_val;
+	ChardevState *s = t->priv;
+
+	ret_val = ioctl(s->file_desc, IOCTL_WRITE_PACKET, buf);
+	return ret_val < 0 ? -errno : ret_val;
+}
+
+static int chardev_get_codec(Transport *t, struct codec_params *codec) {
+
+	ChardevState *s = t->priv;
+	return ioctl(s->file_desc, IOCTL_GET_CODEC, codec) < 0 ? -errno : SUCCESS;
+}
+
+static int chardev_read_packets(Transport *t, struct packet_read *req) {
+
+	int ret_val;
+	ChardevState *s = t->priv;
+
+	ret_val = ioctl(s->file_desc, IOCTL_READ_PACKETS, req);
+	return ret_val < 0 ? -errno : ret_val;
+}
+
+static int chardev_write_pinned(Transport *t, char *buf, uint64_t cookie) {
+
+	int ret_val;
+	struct pinned_frame req = { (uintptr_t)buf, cookie };
+	ChardevState *s = t->priv;
+
+	ret_val = ioctl(s->file_desc, IOCTL_WRITE_PINNED, &req);
+	return ret_val < 0 ? -errno : ret_val;
+}
+
+static int chardev_get_released(Transport *t, uint64_t *cookies, int max, int timeout_ms) {
+
+	int ret_val;
+	struct pinned_release rel;
+	ChardevState *s = t->priv;
+
+	rel.timeout_ms = timeout_ms;
+	rel.count = max < PIN_RELEASE_MAX ? max : PIN_RELEASE_MAX;
+	ret_val = ioctl(s->file_desc, IOCTL_GET_RELEASED, &rel);
+	if (ret_val < 0)
+		return -errno;
+	memcpy(cookies, rel.cookies, ret_val * sizeof(uint64_t));
+	return ret_val;
+}
+
+const TransportOps chardev_transport_ops = {
+
+	.name             = "chardev",
+	.open             = chardev_open,
+	.close            = chardev_close,
+	.write_frame      = chardev_write_frame,
+	.set_motion       = chardev_set_motion,
+	.set_online       = chardev_set_online,
+	.set_policy       = chardev_set_policy,
+	.get_stats        = chardev_get_stats,
+	.read_frame       = chardev_read_frame,
+	.set_roi          = chardev_set_roi,
+	.change_tape      = chardev_change_tape,
+	.get_tape_number  = chardev_get_tape_number,
+	.check_if_written = chardev_check_if_written,
+	.get_validate     = chardev_get_validate,
+	.get_motion       = chardev_get_motion,
+	.get_status       = chardev_get_status,
+	.set_codec        = chardev_set_codec,
+	.write_packet     = chardev_write_packet,
+	.get_codec        = chardev_get_codec,
+	.read_packets     = chardev_read_packets,
+	.write_pinned     = chardev_write_pinned,
+	.get_released     = chardev_get_released,
+};
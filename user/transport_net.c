@@ -0,0 +1,365 @@
+/*
+ *  transport_net.c - the network backend of the frame transport
+ *
+ *  Reader only: connects to a relay.out (net:host:port, or $SMARTHOME_RELAY,
+ *  or 127.0.0.1:5555) and receives the frames of the selected camera.
+ *  The written/motion/validate state comes with every message from the
+ *  relay and is cached here, so the status calls never touch the network.
+ *
+ *  A receive thread keeps reading the socket into a spare buffer and
+ *  swaps it with the ready one, so the status is always fresh and
+ *  read_frame gets the latest frame, like from the kernel module.
+ */
+
+#include "../chardev.h"
+#include "transport.h"
+#include "relay.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>	/* TCP_NODELAY */
+
+typedef struct NetState {
+
+	int             fd;
+	int             cur_cam;
+	uint32_t        written, motion, validate;
+
+	pthread_t       rx;
+	pthread_mutex_t lock;
+	pthread_cond_t  cond;
+	char           *ready, *spare;
+	size_t          ready_len;
+	unsigned long   ready_seq, last_seq;	/* frames received / returned */
+	int             dead;			/* the relay is gone */
+
+} NetState;
+
+static int recv_all(int fd, void *buf, size_t len) {
+
+	ssize_t n;
+	char *p = buf;
+
+	while (len) {
+		n = recv(fd, p, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FAIL;
+		p += n;
+		len -= n;
+	}
+	return SUCCESS;
+}
+
+static int send_cmd(NetState *s, uint32_t op, int32_t arg) {
+
+	struct relay_cmd cmd = { op, arg };
+	return send(s->fd, &cmd, sizeof(cmd), MSG_NOSIGNAL) == sizeof(cmd) ? SUCCESS : FAIL;
+}
+
+/*
+ * read one message header from the relay and take its status
+ */
+static int recv_hdr(NetState *s, struct relay_hdr *hdr) {
+
+	if (recv_all(s->fd, hdr, sizeof(*hdr)) < 0 || hdr->magic != RELAY_MAGIC)
+		return FAIL;
+	__atomic_store_n(&s->written, hdr->written, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->motion, hdr->motion, __ATOMIC_RELAXED);
+	__atomic_store_n(&s->validate, hdr->validate, __ATOMIC_RELAXED);
+	return SUCCESS;
+}
+
+static void *net_receive(void *arg) {
+
+	char *tmp;
+	struct relay_hdr hdr;
+	NetState *s = arg;
+
+	for (;;) {
+		if (recv_hdr(s, &hdr) < 0 || hdr.len > CAM_LEN + sizeof(size_t) ||
+				recv_all(s->fd, s->spare, hdr.len) < 0)
+			break;
+		// status messages, and frames of the camera we just left
+		if (!hdr.len || hdr.tape != __atomic_load_n(&s->cur_cam, __ATOMIC_RELAXED))
+			continue;
+
+		pthread_mutex_lock(&s->lock);
+		tmp = s->ready;
+		s->ready = s->spare;
+		s->spare = tmp;
+		s->ready_len = hdr.len;
+		s->ready_seq++;
+		pthread_cond_broadcast(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	s->dead = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+static int net_open(Transport *t) {
+
+	int one = 1;
+	char addr[256], def_port[16], *port;
+	struct addrinfo hints, *res, *ai;
+	struct relay_hdr hdr;
+	NetState *s;
+
+	if (t->role != TRANSPORT_READER) {
+		printf("The net transport can only read, write to the relay's transport\n");
+		return FAIL;
+	}
+
+	// host:port, host, or nothing
+	snprintf(addr, sizeof(addr), "%s", t->arg ? t->arg : getenv(RELAY_ENV) ? getenv(RELAY_ENV) : RELAY_HOST);
+	port = strrchr(addr, ':');
+	if (port)
+		*port++ = '\0';
+	snprintf(def_port, sizeof(def_port), "%d", RELAY_PORT);
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(addr, port ? port : def_port, &hints, &res)) {
+		printf("Can't resolve relay address: %s\n", addr);
+		return FAIL;
+	}
+
+	s = calloc(1, sizeof(NetState));
+	if (s) {
+		s->ready = malloc(CAM_LEN + sizeof(size_t));
+		s->spare = malloc(CAM_LEN + sizeof(size_t));
+	}
+	if (!s || !s->ready || !s->spare) {
+		perror("net_open");
+		if (s) {
+			free(s->ready);
+			free(s->spare);
+		}
+		free(s);
+		freeaddrinfo(res);
+		return FAIL;
+	}
+
+	s->fd = -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		s->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (s->fd < 0)
+			continue;
+		if (!connect(s->fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(s->fd);
+		s->fd = -1;
+	}
+	freeaddrinfo(res);
+
+	if (s->fd < 0) {
+		printf("Can't connect to the relay at %s:%s\n", addr, port ? port : def_port);
+		goto fail;
+	}
+	setsockopt(s->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	// the relay greets us with its status, the module starts on camera 1
+	s->cur_cam = 1;
+	if (recv_hdr(s, &hdr) < 0 || send_cmd(s, RELAY_SELECT, s->cur_cam) < 0) {
+		printf("The relay didn't answer\n");
+		close(s->fd);
+		goto fail;
+	}
+
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_cond_init(&s->cond, NULL);
+	if (pthread_create(&s->rx, NULL, net_receive, s)) {
+		close(s->fd);
+		goto fail;
+	}
+
+	t->priv = s;
+	return SUCCESS;
+
+fail:
+	free(s->ready);
+	free(s->spare);
+	free(s);
+	return FAIL;
+}
+
+static void net_close(Transport *t) {
+
+	NetState *s = t->priv;
+
+	// wakes the receive thread up with an error
+	shutdown(s->fd, SHUT_RDWR);
+	pthread_join(s->rx, NULL);
+	close(s->fd);
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	free(s->ready);
+	free(s->spare);
+	free(s);
+}
+
+static int net_write_frame(Transport *t, char *buf) {
+	return -EOPNOTSUPP;
+}
+
+static int net_set_motion(Transport *t, int tape, int on) {
+	return -EOPNOTSUPP;
+}
+
+static int net_set_online(Transport *t, int tape, int on) {
+	return -EOPNOTSUPP;
+}
+
+static int net_set_policy(Transport *t, int tape, int policy) {
+	return -EOPNOTSUPP;
+}
+
+static int net_get_stats(Transport *t, struct cam_stats *st) {
+	return -EOPNOTSUPP;
+}
+
+static int net_set_roi(Transport *t, const struct cam_roi *roi) {
+	return -EOPNOTSUPP;
+}
+
+static int net_read_frame(Transport *t, char *buf) {
+
+	int len;
+	NetState *s = t->priv;
+
+	pthread_mutex_lock(&s->lock);
+	while (s->ready_seq == s->last_seq && !s->dead)
+		pthread_cond_wait(&s->cond, &s->lock);
+	if (s->dead) {
+		pthread_mutex_unlock(&s->lock);
+		return -EPIPE;
+	}
+	len = s->ready_len;
+	memcpy(buf, s->ready, len);
+	s->last_seq = s->ready_seq;
+	pthread_mutex_unlock(&s->lock);
+
+	return len;
+}
+
+static int net_change_tape(Transport *t, int n) {
+
+	NetState *s = t->priv;
+
+	if (n < 0 || n >= CAM_NUM)
+		return -EINVAL;
+	pthread_mutex_lock(&s->lock);
+	__atomic_store_n(&s->cur_cam, n, __ATOMIC_RELAXED);
+	s->last_seq = s->ready_seq;	// whatever is ready is of the old camera
+	pthread_mutex_unlock(&s->lock);
+	return send_cmd(s, RELAY_SELECT, n);
+}
+
+static int net_get_tape_number(Transport *t) {
+
+	NetState *s = t->priv;
+	return __atomic_load_n(&s->cur_cam, __ATOMIC_RELAXED);
+}
+
+static int net_check_if_written(Transport *t, int n) {
+
+	NetState *s = t->priv;
+
+	if (n < 0 || n >= CAM_NUM)
+		return 0;
+	return !!(__atomic_load_n(&s->written, __ATOMIC_RELAXED) & (1u << n));
+}
+
+static int net_get_validate(Transport *t) {
+
+	NetState *s = t->priv;
+	return __atomic_load_n(&s->validate, __ATOMIC_RELAXED);
+}
+
+static int net_get_motion(Transport *t) {
+
+	NetState *s = t->priv;
+	return __atomic_load_n(&s->motion, __ATOMIC_RELAXED);
+}
+
+/*
+ * the relay doesn't tell what the module's reader didn't take yet
+ */
+static int net_get_status(Transport *t, struct cam_status *st) {
+
+	NetState *s = t->priv;
+
+	memset(st, 0, sizeof(*st));
+	st->cams = CAM_NUM;
+	st->cur_cam = __atomic_load_n(&s->cur_cam, __ATOMIC_RELAXED);
+	st->writer = __atomic_load_n(&s->validate, __ATOMIC_RELAXED);
+	st->written = __atomic_load_n(&s->written, __ATOMIC_RELAXED);
+	st->motion = __atomic_load_n(&s->motion, __ATOMIC_RELAXED);
+	return SUCCESS;
+}
+
+/*
+ * the relay forwards decoded frames only
+ */
+static int net_set_codec(Transport *t, struct codec_params *codec) {
+	return -EOPNOTSUPP;
+}
+
+static int net_write_packet(Transport *t, char *buf) {
+	return -EOPNOTSUPP;
+}
+
+static int net_get_codec(Transport *t, struct codec_params *codec) {
+	return -EOPNOTSUPP;
+}
+
+static int net_read_packets(Transport *t, struct packet_read *req) {
+	return -EOPNOTSUPP;
+}
+
+static int net_write_pinned(Transport *t, char *buf, uint64_t cookie) {
+	return -EOPNOTSUPP;
+}
+
+static int net_get_released(Transport *t, uint64_t *cookies, int max, int timeout_ms) {
+	return -EOPNOTSUPP;
+}
+
+const TransportOps net_transport_ops = {
+
+	.name             = "net",
+	.open             = net_open,
+	.close            = net_close,
+	.write_frame      = net_write_frame,
+	.set_motion       = net_set_motion,
+	.set_online       = net_set_online,
+	.set_policy       = net_set_policy,
+	.get_stats        = net_get_stats,
+	.read_frame       = net_read_frame,
+	.set_roi          = net_set_roi,
+	.change_tape      = net_change_tape,
+	.get_tape_number  = net_get_tape_number,
+	.check_if_written = net_check_if_written,
+	.get_validate     = net_get_validate,
+	.get_motion       = net_get_motion,
+	.get_status       = net_get_status,
+	.set_codec        = net_set_codec,
+	.write_packet     = net_write_packet,
+	.get_codec        = net_get_codec,
+	.read_packets     = net_read_packets,
+	.write_pinned     = net_write_pinned,
+	.get_released     = net_get_released,
+};
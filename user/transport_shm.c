@@ -0,0 +1,726 @@
+/*
+ *  transport_shm.c - the shared memory backend of the frame transport
+ *
+ *  Same semantics as the kernel module (latest frame per camera, one
+ *  selected camera, written flags, writer validation), but everything
+ *  lives in a POSIX shared memory object, so no insmod/mknod/root needed.
+ *
+ *  Every camera is a small ring of SHM_SLOTS frames. The writer fills the
+ *  next slot and then publishes it by bumping 'head', which is also the
+ *  futex word the reader sleeps on. The reader copies the newest slot and
+ *  checks 'head' again - if the writer could have lapped it, it copies again.
+ *
+ *  In passthrough mode the slots of a camera are one log of the packets
+ *  since the last keyframe, like the GOP in the module. 'gop_last' is the
+ *  futex word there, and 'gop_gen' changes whenever the log starts over.
+ *
+ *  Backpressure works like in the module: 'consumed' is the head of the
+ *  newest frame a reader took, a POLICY_BLOCK writer sleeps on it while
+ *  consumed != head and some reader has the ring open.
+ */
+
+#include "../chardev.h"
+#include "transport.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>		/* offsetof */
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>		/* O_* */
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>		/* shm_open, mmap */
+#include <sys/file.h>		/* flock */
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SHM_NAME "/smarthome_cams"
+#define SHM_NAME_ENV "SMARTHOME_SHM"
+#define SHM_MAGIC 0x534d4843	/* "SMHC" */
+#define SHM_SLOTS 3
+
+/*
+ * how long the reader sleeps for a new frame before it returns
+ * the latest one anyway (like the kernel, which never blocks on it)
+ */
+#define SHM_WAIT_NS 100000000
+
+typedef struct ShmCam {
+
+	uint32_t head;			/* frames published, futex word */
+	int      written;
+	int      offline;		/* no source, writes fail with -ENODEV */
+	uint32_t consumed;		/* head of the last frame read, futex word */
+	int      policy;
+	uint64_t frames_written, frames_read, frames_dropped;
+	size_t   size[SHM_SLOTS];
+	char     slot[SHM_SLOTS][CAM_LEN];
+
+	uint32_t gop_gen, gop_first, gop_last;
+	size_t   gop_len;
+	int      need_key, has_codec;
+	struct codec_params codec;
+
+} ShmCam;
+
+#define SHM_GOP_LEN (SHM_SLOTS * CAM_LEN)
+
+typedef struct ShmRing {
+
+	uint32_t magic;
+	int      write_user;
+	int      cur_cam;
+	int      readers;		/* readers with the ring open */
+	uint32_t motion;		/* bit n = camera n has motion */
+	ShmCam   cams[CAM_NUM];
+
+} ShmRing;
+
+typedef struct ShmState {
+
+	int       fd;
+	ShmRing  *ring;
+	uint32_t  last_seen[CAM_NUM];	/* reader: head of the last frame we returned */
+	struct cam_roi roi;		/* reader: only this is copied, when roi_on */
+	int       roi_on;
+
+} ShmState;
+
+/*
+ * Where the size and pitches are in a slot's frame (camclient.h, without
+ * the size and tape)
+ */
+#define FRAME_W_OFF (sizeof(struct frame_times) + sizeof(uint32_t))
+#define FRAME_H_OFF (FRAME_W_OFF + sizeof(int))
+#define FRAME_PITCHES_OFF (FRAME_H_OFF + 2 * sizeof(int))
+#define FRAME_PIXELS_OFF (FRAME_PITCHES_OFF + 3 * sizeof(uint16_t))
+
+static int futex_wait(uint32_t *addr, uint32_t val, long ns) {
+
+	struct timespec to = { ns / 1000000000, ns % 1000000000 };
+	return syscall(SYS_futex, addr, FUTEX_WAIT, val, &to, NULL, 0);
+}
+
+static int futex_wake(uint32_t *addr) {
+
+	return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static const char *shm_name(void) {
+
+	const char *name = getenv(SHM_NAME_ENV);
+	return name && *name ? name : SHM_NAME;
+}
+
+static int shm_open_transport(Transport *t) {
+
+	int i;
+	ShmState *s = calloc(1, sizeof(ShmState));
+
+	if (!s) {
+		perror("shm_open_transport");
+		return FAIL;
+	}
+
+	if (t->role == TRANSPORT_WRITER) {
+		s->fd = shm_open(shm_name(), O_RDWR | O_CREAT, 0666);
+		if (s->fd < 0 || ftruncate(s->fd, sizeof(ShmRing)) < 0) {
+			printf("Can't create shared memory: %s\n", shm_name());
+			goto fail;
+		}
+		// only one writer at a time, like Device_Open in the module
+		if (flock(s->fd, LOCK_EX | LOCK_NB) < 0) {
+			printf("%s is already used by another write_user\n", shm_name());
+			goto fail;
+		}
+	}
+	else {
+		s->fd = shm_open(shm_name(), O_RDWR, 0);
+		if (s->fd < 0) {
+			printf("Can't open shared memory: %s (is write_user running?)\n", shm_name());
+			goto fail;
+		}
+	}
+
+	s->ring = mmap(NULL, sizeof(ShmRing), PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+	if (s->ring == MAP_FAILED) {
+		perror("mmap");
+		goto fail;
+	}
+
+	if (t->role == TRANSPORT_WRITER) {
+		// a fresh object, or one left behind by a writer that crashed
+		for (i = 0; i < CAM_NUM; i++) {
+			s->ring->cams[i].written = 0;
+			s->ring->cams[i].offline = 0;
+			s->ring->cams[i].gop_len = 0;
+			s->ring->cams[i].gop_gen++;
+			s->ring->cams[i].need_key = 0;
+			s->ring->cams[i].has_codec = 0;
+			s->ring->cams[i].consumed = s->ring->cams[i].head;
+			s->ring->cams[i].policy = POLICY_OVERWRITE;
+			s->ring->cams[i].frames_written = 0;
+			s->ring->cams[i].frames_read = 0;
+			s->ring->cams[i].frames_dropped = 0;
+		}
+		s->ring->cur_cam = 1;
+		s->ring->motion = 0;
+		s->ring->magic = SHM_MAGIC;
+		__atomic_store_n(&s->ring->write_user, 1, __ATOMIC_RELEASE);
+	}
+	else if (s->ring->magic != SHM_MAGIC) {
+		printf("%s is not a smart home camera ring\n", shm_name());
+		munmap(s->ring, sizeof(ShmRing));
+		goto fail;
+	}
+	else
+		__atomic_fetch_add(&s->ring->readers, 1, __ATOMIC_RELEASE);
+
+	t->priv = s;
+	return SUCCESS;
+
+fail:
+	if (s->fd >= 0)
+		close(s->fd);
+	free(s);
+	return FAIL;
+}
+
+static void shm_close_transport(Transport *t) {
+
+	int i;
+	ShmState *s = t->priv;
+
+	if (t->role == TRANSPORT_WRITER) {
+		// same as write_release in cam_chardev.c
+		__atomic_store_n(&s->ring->write_user, 0, __ATOMIC_RELEASE);
+		s->ring->cur_cam = 1;
+		__atomic_store_n(&s->ring->motion, 0, __ATOMIC_RELEASE);
+		for (i = 0; i < CAM_NUM; i++) {
+			s->ring->cams[i].written = 0;
+			__atomic_store_n(&s->ring->cams[i].has_codec, 0, __ATOMIC_RELEASE);
+			futex_wake(&s->ring->cams[i].head);
+			futex_wake(&s->ring->cams[i].gop_last);
+		}
+	}
+	else {
+		// blocked writers go back to overwriting when nobody reads
+		__atomic_fetch_sub(&s->ring->readers, 1, __ATOMIC_RELEASE);
+		for (i = 0; i < CAM_NUM; i++)
+			futex_wake(&s->ring->cams[i].consumed);
+	}
+	munmap(s->ring, sizeof(ShmRing));
+	close(s->fd);
+	free(s);
+}
+
+static int shm_write_frame(Transport *t, char *buf) {
+
+	int tape;
+	size_t size, len;
+	uint32_t head, consumed;
+	uint64_t now;
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	memcpy(&size, buf, sizeof(size_t));
+	memcpy(&tape, buf + sizeof(size_t), sizeof(int));
+	if (tape < 0 || tape >= CAM_NUM || size < sizeof(size_t) + sizeof(int))
+		return -EINVAL;
+
+	len = size - sizeof(size_t) - sizeof(int);
+	if (len > CAM_LEN)
+		len = CAM_LEN;
+
+	// every camera has exactly one writer thread, no lock needed
+	cam = &s->ring->cams[tape];
+	if (__atomic_load_n(&cam->offline, __ATOMIC_ACQUIRE))
+		return -ENODEV;
+	head = cam->head;
+
+	// backpressure, the same as device_write in cam_chardev.c
+	while ((consumed = __atomic_load_n(&cam->consumed, __ATOMIC_ACQUIRE)) != head) {
+		if (cam->policy == POLICY_DROP) {
+			__atomic_fetch_add(&cam->frames_dropped, 1, __ATOMIC_RELAXED);
+			return -EAGAIN;
+		}
+		if (cam->policy != POLICY_BLOCK || !__atomic_load_n(&s->ring->readers, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_add(&cam->frames_dropped, 1, __ATOMIC_RELAXED);
+			break;
+		}
+		futex_wait(&cam->consumed, consumed, SHM_WAIT_NS);
+	}
+	memcpy(cam->slot[head % SHM_SLOTS], buf + sizeof(size_t) + sizeof(int), len);
+	cam->size[head % SHM_SLOTS] = len;
+
+	// like the module, stamp when the frame landed in its camera
+	if (len >= sizeof(struct frame_times)) {
+		now = latency_now_ns();
+		memcpy(cam->slot[head % SHM_SLOTS] + offsetof(struct frame_times, enqueue_ns), &now, sizeof(now));
+	}
+	__atomic_fetch_add(&cam->frames_written, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&cam->head, head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->written, 1, __ATOMIC_RELEASE);
+	futex_wake(&cam->head);
+
+	return len;
+}
+
+static int shm_set_motion(Transport *t, int tape, int on) {
+
+	ShmState *s = t->priv;
+
+	if (tape < 0 || tape >= CAM_NUM)
+		return -EINVAL;
+	if (on)
+		__atomic_fetch_or(&s->ring->motion, 1u << tape, __ATOMIC_RELEASE);
+	else
+		__atomic_fetch_and(&s->ring->motion, ~(1u << tape), __ATOMIC_RELEASE);
+	return SUCCESS;
+}
+
+/*
+ * Like IOCTL_CAM_OFFLINE - the camera forgets its frame and its GOP
+ */
+static int shm_set_online(Transport *t, int tape, int on) {
+
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	if (tape < 0 || tape >= CAM_NUM)
+		return -EINVAL;
+	cam = &s->ring->cams[tape];
+	if (on) {
+		__atomic_store_n(&cam->offline, 0, __ATOMIC_RELEASE);
+		return SUCCESS;
+	}
+
+	__atomic_store_n(&cam->offline, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->written, 0, __ATOMIC_RELEASE);
+	__atomic_fetch_and(&s->ring->motion, ~(1u << tape), __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->has_codec, 0, __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->gop_len, 0, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&cam->gop_gen, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&cam->consumed, __atomic_load_n(&cam->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	futex_wake(&cam->consumed);
+	futex_wake(&cam->gop_last);
+	return SUCCESS;
+}
+
+static int shm_set_policy(Transport *t, int tape, int policy) {
+
+	ShmState *s = t->priv;
+
+	if (tape < 0 || tape >= CAM_NUM || policy < POLICY_OVERWRITE || policy > POLICY_DROP)
+		return -EINVAL;
+	__atomic_store_n(&s->ring->cams[tape].policy, policy, __ATOMIC_RELEASE);
+	futex_wake(&s->ring->cams[tape].consumed);
+	return SUCCESS;
+}
+
+static int shm_get_stats(Transport *t, struct cam_stats *st) {
+
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	if (st->tape < 0 || st->tape >= CAM_NUM)
+		return -EINVAL;
+	cam = &s->ring->cams[st->tape];
+	st->policy = __atomic_load_n(&cam->policy, __ATOMIC_ACQUIRE);
+	st->pending = __atomic_load_n(&cam->consumed, __ATOMIC_ACQUIRE) != __atomic_load_n(&cam->head, __ATOMIC_ACQUIRE);
+	st->written = __atomic_load_n(&cam->frames_written, __ATOMIC_RELAXED);
+	st->read = __atomic_load_n(&cam->frames_read, __ATOMIC_RELAXED);
+	st->dropped = __atomic_load_n(&cam->frames_dropped, __ATOMIC_RELAXED);
+	// the ring is mapped for good, nothing is ever reclaimed or pinned
+	st->resident = 1;
+	st->reclaimed = st->reallocs = 0;
+	st->pinned = st->copied = 0;
+	// and placed wherever the first toucher was
+	st->node = -1;
+	st->contiguous = 0;
+	st->cross_node = 0;
+	return SUCCESS;
+}
+
+/*
+ * w x h pixels of a plane, every scale-th of src's rows and columns
+ */
+static void copy_plane(char *dst, size_t dst_pitch, const char *src, size_t src_pitch, int w, int h, int scale) {
+
+	int row, col;
+
+	for (row = 0; row < h; row++, dst += dst_pitch, src += src_pitch * scale) {
+		if (scale == 1)
+			memcpy(dst, src, w);
+		else
+			for (col = 0; col < w; col++)
+				dst[col] = src[col * scale];
+	}
+}
+
+/*
+ * Copy the frame of a slot cropped to the region of interest, the way the
+ * module does (see IOCTL_SET_ROI). Returns the size of the cropped frame,
+ * or 0 if it isn't a frame we can crop.
+ */
+static size_t shm_crop(const struct cam_roi *roi, char *dst, const char *frame, size_t len) {
+
+	int w, h, x = 0, y = 0, rw, rh, ow, oh, cw, ch, scale;
+	uint16_t pitches[3], out_pitches[3];
+	size_t plane, chroma, v_off, u_off;
+
+	if (len < FRAME_PIXELS_OFF)
+		return 0;
+	memcpy(&w, frame + FRAME_W_OFF, sizeof(int));
+	memcpy(&h, frame + FRAME_H_OFF, sizeof(int));
+	memcpy(pitches, frame + FRAME_PITCHES_OFF, sizeof(pitches));
+	if (w <= 0 || h <= 0 || pitches[0] != w || pitches[1] < (w + 1) / 2 || pitches[2] < (w + 1) / 2)
+		return 0;
+	v_off = FRAME_PIXELS_OFF + (size_t)w * h;
+	u_off = v_off + (size_t)pitches[1] * ((h + 1) / 2);
+	if (u_off + (size_t)pitches[2] * ((h + 1) / 2) > len)
+		return 0;
+
+	// clipped, from an even corner
+	rw = w;
+	rh = h;
+	scale = roi->scale > 1 ? roi->scale : 1;
+	if (roi->w > 0 && roi->h > 0) {
+		x = (roi->x < w ? roi->x : w - 1) & ~1;
+		y = (roi->y < h ? roi->y : h - 1) & ~1;
+		rw = roi->w < w - x ? roi->w : w - x;
+		rh = roi->h < h - y ? roi->h : h - y;
+	}
+	ow = rw / scale > 1 ? rw / scale : 1;
+	oh = rh / scale > 1 ? rh / scale : 1;
+	cw = (ow + 1) / 2;
+	ch = (oh + 1) / 2;
+	plane = (size_t)ow * oh;
+	chroma = (size_t)cw * ch;
+
+	memcpy(dst, frame, FRAME_PITCHES_OFF);
+	memcpy(dst + FRAME_W_OFF, &ow, sizeof(int));
+	memcpy(dst + FRAME_H_OFF, &oh, sizeof(int));
+	out_pitches[0] = ow;
+	out_pitches[1] = out_pitches[2] = cw;
+	memcpy(dst + FRAME_PITCHES_OFF, out_pitches, sizeof(out_pitches));
+
+	copy_plane(dst + FRAME_PIXELS_OFF, ow,
+			frame + FRAME_PIXELS_OFF + (size_t)y * pitches[0] + x, pitches[0], ow, oh, scale);
+	copy_plane(dst + FRAME_PIXELS_OFF + plane, cw,
+			frame + v_off + (size_t)(y / 2) * pitches[1] + x / 2, pitches[1], cw, ch, scale);
+	copy_plane(dst + FRAME_PIXELS_OFF + plane + chroma, cw,
+			frame + u_off + (size_t)(y / 2) * pitches[2] + x / 2, pitches[2], cw, ch, scale);
+	return FRAME_PIXELS_OFF + plane + 2 * chroma;
+}
+
+static int shm_read_frame(Transport *t, char *buf) {
+
+	int n;
+	size_t len, cropped;
+	uint32_t head, again, consumed;
+	uint64_t now;
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	for (;;) {
+		// the selected camera may change while we sleep
+		n = __atomic_load_n(&s->ring->cur_cam, __ATOMIC_ACQUIRE);
+		cam = &s->ring->cams[n];
+		head = __atomic_load_n(&cam->head, __ATOMIC_ACQUIRE);
+
+		if (!__atomic_load_n(&cam->written, __ATOMIC_ACQUIRE) || head == s->last_seen[n]) {
+			// nothing new - sleep on the futex instead of spinning like IOCTL_READ
+			if (futex_wait(&cam->head, head, SHM_WAIT_NS) < 0 && errno == ETIMEDOUT
+					&& cam->written && head)
+				s->last_seen[n] = head - 1;	// stale, but return it like the kernel
+			continue;
+		}
+
+		now = latency_now_ns();
+		len = cam->size[(head - 1) % SHM_SLOTS];
+		cropped = s->roi_on ? shm_crop(&s->roi, buf, cam->slot[(head - 1) % SHM_SLOTS], len) : 0;
+		if (cropped)
+			len = cropped;
+		else
+			memcpy(buf, cam->slot[(head - 1) % SHM_SLOTS], len);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		again = __atomic_load_n(&cam->head, __ATOMIC_RELAXED);
+		if (again - head < SHM_SLOTS - 1)
+			break;
+		// the writer may have lapped us while copying, take the newer one
+	}
+
+	s->last_seen[n] = head;
+
+	// consumed only moves forward, with many readers the first one counts
+	consumed = __atomic_load_n(&cam->consumed, __ATOMIC_ACQUIRE);
+	while ((int32_t)(head - consumed) > 0)
+		if (__atomic_compare_exchange_n(&cam->consumed, &consumed, head, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_fetch_add(&cam->frames_read, 1, __ATOMIC_RELAXED);
+			futex_wake(&cam->consumed);
+			break;
+		}
+
+	if (len >= sizeof(struct frame_times))
+		memcpy(buf + offsetof(struct frame_times, dequeue_ns), &now, sizeof(now));
+	return len;
+}
+
+static int shm_set_roi(Transport *t, const struct cam_roi *roi) {
+
+	ShmState *s = t->priv;
+
+	if (roi->x < 0 || roi->y < 0 || roi->w < 0 || roi->h < 0 || roi->scale > ROI_MAX_SCALE)
+		return -EINVAL;
+	s->roi = *roi;
+	s->roi_on = (roi->w && roi->h) || roi->scale > 1;
+	return SUCCESS;
+}
+
+static int shm_change_tape(Transport *t, int n) {
+
+	ShmState *s = t->priv;
+
+	if (n < 0 || n >= CAM_NUM)
+		return -EINVAL;
+	__atomic_store_n(&s->ring->cur_cam, n, __ATOMIC_RELEASE);
+	return SUCCESS;
+}
+
+static int shm_get_tape_number(Transport *t) {
+
+	ShmState *s = t->priv;
+	return __atomic_load_n(&s->ring->cur_cam, __ATOMIC_ACQUIRE);
+}
+
+static int shm_check_if_written(Transport *t, int n) {
+
+	ShmState *s = t->priv;
+
+	if (n < 0 || n >= CAM_NUM)
+		return 0;
+	return __atomic_load_n(&s->ring->cams[n].written, __ATOMIC_ACQUIRE);
+}
+
+static int shm_get_validate(Transport *t) {
+
+	ShmState *s = t->priv;
+	return __atomic_load_n(&s->ring->write_user, __ATOMIC_ACQUIRE);
+}
+
+static int shm_get_motion(Transport *t) {
+
+	ShmState *s = t->priv;
+	return __atomic_load_n(&s->ring->motion, __ATOMIC_ACQUIRE);
+}
+
+static int shm_get_status(Transport *t, struct cam_status *st) {
+
+	int i;
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	memset(st, 0, sizeof(*st));
+	st->cams = CAM_NUM;
+	st->cur_cam = __atomic_load_n(&s->ring->cur_cam, __ATOMIC_ACQUIRE);
+	st->writer = __atomic_load_n(&s->ring->write_user, __ATOMIC_ACQUIRE);
+	st->motion = __atomic_load_n(&s->ring->motion, __ATOMIC_ACQUIRE);
+	for (i = 0; i < CAM_NUM; i++) {
+		cam = &s->ring->cams[i];
+		if (__atomic_load_n(&cam->written, __ATOMIC_ACQUIRE))
+			st->written |= 1u << i;
+		if (__atomic_load_n(&cam->consumed, __ATOMIC_ACQUIRE) != __atomic_load_n(&cam->head, __ATOMIC_ACQUIRE))
+			st->pending |= 1u << i;
+		if (__atomic_load_n(&cam->offline, __ATOMIC_ACQUIRE))
+			st->offline |= 1u << i;
+	}
+	return SUCCESS;
+}
+
+static int shm_set_codec(Transport *t, struct codec_params *codec) {
+
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	if (codec->tape < 0 || codec->tape >= CAM_NUM || codec->extradata_size > CODEC_EXTRADATA_MAX)
+		return -EINVAL;
+	cam = &s->ring->cams[codec->tape];
+	if (__atomic_load_n(&cam->offline, __ATOMIC_ACQUIRE))
+		return -ENODEV;
+	__atomic_store_n(&cam->has_codec, 0, __ATOMIC_RELEASE);
+	cam->codec = *codec;
+	__atomic_store_n(&cam->has_codec, 1, __ATOMIC_RELEASE);
+	return SUCCESS;
+}
+
+/*
+ * same rules as write_packet in cam_chardev.c
+ */
+static int shm_write_packet(Transport *t, char *buf) {
+
+	struct packet_header hdr;
+	size_t total;
+	char *dst;
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (hdr.tape < 0 || hdr.tape >= CAM_NUM)
+		return -EINVAL;
+	total = sizeof(hdr) + hdr.size;
+	cam = &s->ring->cams[hdr.tape];
+	if (__atomic_load_n(&cam->offline, __ATOMIC_ACQUIRE))
+		return -ENODEV;
+
+	if (hdr.flags & PACKET_KEY) {
+		// bump gen before overwriting the log, readers of the old GOP retry
+		__atomic_store_n(&cam->gop_len, 0, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&cam->gop_gen, 1, __ATOMIC_SEQ_CST);
+		cam->need_key = 0;
+	}
+	else if (cam->need_key)
+		return 0;
+
+	if (total > SHM_GOP_LEN - cam->gop_len) {
+		cam->need_key = 1;
+		return 0;
+	}
+
+	dst = cam->slot[0] + cam->gop_len;
+	hdr.seq = cam->gop_last + 1;
+	hdr.times.enqueue_ns = latency_now_ns();
+	memcpy(dst, &hdr, sizeof(hdr));
+	memcpy(dst + sizeof(hdr), buf + sizeof(hdr), hdr.size);
+
+	if (hdr.flags & PACKET_KEY)
+		__atomic_store_n(&cam->gop_first, hdr.seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&cam->gop_len, cam->gop_len + total, __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->gop_last, hdr.seq, __ATOMIC_RELEASE);
+	__atomic_store_n(&cam->written, 1, __ATOMIC_RELEASE);
+	futex_wake(&cam->gop_last);
+
+	return total;
+}
+
+static int shm_get_codec(Transport *t, struct codec_params *codec) {
+
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	if (codec->tape < 0 || codec->tape >= CAM_NUM)
+		return -EINVAL;
+	cam = &s->ring->cams[codec->tape];
+	if (!__atomic_load_n(&cam->has_codec, __ATOMIC_ACQUIRE))
+		return -ENODATA;
+	*codec = cam->codec;
+	return SUCCESS;
+}
+
+static int shm_read_packets(Transport *t, struct packet_read *req) {
+
+	struct packet_header hdr;
+	size_t len, off, end, n;
+	uint32_t gen, last;
+	uint64_t now, deadline;
+	char *log, *buf = (char *)(uintptr_t)req->buf;
+	ShmCam *cam;
+	ShmState *s = t->priv;
+
+	if (req->tape < 0 || req->tape >= CAM_NUM)
+		return -EINVAL;
+	cam = &s->ring->cams[req->tape];
+	log = cam->slot[0];
+
+	// sleep until there is a packet we don't have, or the timeout
+	deadline = latency_now_ns() + req->timeout_ms * 1000000ULL;
+	for (;;) {
+		last = __atomic_load_n(&cam->gop_last, __ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&cam->gop_len, __ATOMIC_ACQUIRE) &&
+				(!req->from_seq || (int32_t)(last - req->from_seq) >= 0))
+			break;
+		now = latency_now_ns();
+		if (now >= deadline)
+			return 0;
+		futex_wait(&cam->gop_last, last, deadline - now);
+	}
+
+	for (;;) {
+		gen = __atomic_load_n(&cam->gop_gen, __ATOMIC_ACQUIRE);
+		len = __atomic_load_n(&cam->gop_len, __ATOMIC_ACQUIRE);
+
+		off = 0;
+		while (req->from_seq && off + sizeof(hdr) <= len) {
+			memcpy(&hdr, log + off, sizeof(hdr));
+			if ((int32_t)(hdr.seq - req->from_seq) >= 0)
+				break;
+			off += sizeof(hdr) + hdr.size;
+		}
+
+		end = off;
+		while (end + sizeof(hdr) <= len) {
+			memcpy(&hdr, log + end, sizeof(hdr));
+			n = sizeof(hdr) + hdr.size;
+			if (n > len - end || end - off + n > req->buf_len)
+				break;
+			end += n;
+		}
+		memcpy(buf, log + off, end - off);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&cam->gop_gen, __ATOMIC_RELAXED) == gen)
+			break;
+	}
+
+	if (end == off)
+		return off < len ? -EMSGSIZE : 0;
+
+	now = latency_now_ns();
+	for (n = 0; n < end - off; n += sizeof(hdr) + hdr.size) {
+		memcpy(&hdr, buf + n, sizeof(hdr));
+		memcpy(buf + n + offsetof(struct packet_header, times.dequeue_ns), &now, sizeof(now));
+	}
+	return end - off;
+}
+
+/*
+ * the writer copies into the ring itself, there is nothing to pin
+ */
+static int shm_write_pinned(Transport *t, char *buf, uint64_t cookie) {
+	return -EOPNOTSUPP;
+}
+
+static int shm_get_released(Transport *t, uint64_t *cookies, int max, int timeout_ms) {
+	return -EOPNOTSUPP;
+}
+
+const TransportOps shm_transport_ops = {
+
+	.name             = "shm",
+	.open             = shm_open_transport,
+	.close            = shm_close_transport,
+	.write_frame      = shm_write_frame,
+	.set_motion       = shm_set_motion,
+	.set_online       = shm_set_online,
+	.set_policy       = shm_set_policy,
+	.get_stats        = shm_get_stats,
+	.read_frame       = shm_read_frame,
+	.set_roi          = shm_set_roi,
+	.change_tape      = shm_change_tape,
+	.get_tape_number  = shm_get_tape_number,
+	.check_if_written = shm_check_if_written,
+	.get_validate     = shm_get_validate,
+	.get_motion       = shm_get_motion,
+	.get_status       = shm_get_status,
+	.set_codec        = shm_set_codec,
+	.write_packet     = shm_write_packet,
+	.get_codec        = shm_get_codec,
+	.read_packets     = shm_read_packets,
+	.write_pinned     = shm_write_pinned,
+	.get_released     = shm_get_released,
+};
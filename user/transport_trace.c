@@ -0,0 +1,353 @@
+/*
+ *  transport_trace.c - recording the transport traffic (see transport_trace.h)
+ */
+
+#include "transport_trace.h"
+#include "../chardev.h"
+#include "latency.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define TRACE_FLUSH_NS 1000000000ULL	/* a killed process loses at most this */
+
+static const char *op_names[TRACE_OPS] = {
+	"write", "read", "change_tape", "get_tape", "check_written", "get_validate",
+	"get_motion", "get_status", "get_stats", "set_motion", "set_online",
+	"set_policy", "set_roi", "set_codec", "write_packet", "get_codec", "read_packets",
+	"write_pinned", "get_released"
+};
+
+/*
+ * The trace file, one per process, shared by all its transports
+ */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file;
+static uint64_t trace_flushed;
+static int trace_threads;
+static __thread int trace_thread = -1;
+
+typedef struct TraceState {
+
+	TransportOps  ops;	/* ours, with the name of the backend */
+	Transport    *inner;
+
+} TraceState;
+
+#define INNER(t) (((TraceState *)(t)->priv)->inner)
+
+const char *trace_op_name(int op) {
+
+	return op >= 0 && op < TRACE_OPS ? op_names[op] : "?";
+}
+
+static void trace_flush(void) {
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file)
+		fflush(trace_file);
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static int trace_file_open(const char *path) {
+
+	struct trace_header hdr;
+	int ret = SUCCESS;
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file)
+		goto out;
+	trace_file = fopen(path, "w");
+	if (!trace_file) {
+		perror(path);
+		ret = FAIL;
+		goto out;
+	}
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TRACE_MAGIC;
+	hdr.version = TRACE_VERSION;
+	hdr.start_ns = trace_flushed = latency_now_ns();
+	hdr.record_size = sizeof(struct trace_record);
+	fwrite(&hdr, sizeof(hdr), 1, trace_file);
+	// write_user and read_user exit without closing their transports
+	atexit(trace_flush);
+out:
+	pthread_mutex_unlock(&trace_lock);
+	return ret;
+}
+
+/*
+ * Append the record of a call that started at 'start'
+ */
+static int trace(Transport *t, int op, uint64_t start, int tape, int arg,
+		int ret, size_t size, const void *head, size_t head_len) {
+
+	struct trace_record rec;
+	uint64_t now = latency_now_ns();
+
+	memset(&rec, 0, sizeof(rec));
+	rec.start_ns = start;
+	rec.dur_ns = now - start;
+	rec.op = op;
+	rec.role = t->role;
+	rec.tape = tape;
+	rec.arg = arg;
+	rec.ret = ret;
+	rec.size = size;
+	if (head)
+		memcpy(rec.head, head, head_len < TRACE_HEAD ? head_len : TRACE_HEAD);
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_thread < 0)
+		trace_thread = trace_threads++;
+	rec.thread = trace_thread;
+	fwrite(&rec, sizeof(rec), 1, trace_file);
+	if (now - trace_flushed > TRACE_FLUSH_NS) {
+		fflush(trace_file);
+		trace_flushed = now;
+	}
+	pthread_mutex_unlock(&trace_lock);
+	return ret;
+}
+
+static int trace_open(Transport *t) {
+
+	return SUCCESS;
+}
+
+static void trace_close(Transport *t) {
+
+	TraceState *st = t->priv;
+
+	transport_close(st->inner);
+	free(st);
+	trace_flush();
+}
+
+static int trace_write_frame(Transport *t, char *buf) {
+
+	uint64_t start = latency_now_ns();
+	size_t size, off = sizeof(size_t) + sizeof(int) + sizeof(struct frame_times);
+	int tape, ret = transport_write_frame(INNER(t), buf);
+
+	// the geometry after the times, so the replayed frame has the same shape
+	memcpy(&size, buf, sizeof(size_t));
+	memcpy(&tape, buf + sizeof(size_t), sizeof(int));
+	return trace(t, TRACE_WRITE, start, tape, 0, ret, size,
+			buf + off, size > off ? size - off : 0);
+}
+
+static int trace_set_motion(Transport *t, int tape, int on) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_SET_MOTION, start, tape, on,
+			transport_set_motion(INNER(t), tape, on), 0, NULL, 0);
+}
+
+static int trace_set_online(Transport *t, int tape, int on) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_SET_ONLINE, start, tape, on,
+			transport_set_online(INNER(t), tape, on), 0, NULL, 0);
+}
+
+static int trace_set_policy(Transport *t, int tape, int policy) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_SET_POLICY, start, tape, policy,
+			transport_set_policy(INNER(t), tape, policy), 0, NULL, 0);
+}
+
+static int trace_get_stats(Transport *t, struct cam_stats *st) {
+
+	uint64_t start = latency_now_ns();
+	int tape = st->tape;
+
+	return trace(t, TRACE_GET_STATS, start, tape, 0,
+			transport_get_stats(INNER(t), st), sizeof(*st), NULL, 0);
+}
+
+static int trace_read_frame(Transport *t, char *buf) {
+
+	uint64_t start = latency_now_ns();
+	int ret = transport_read_frame(INNER(t), buf);
+
+	// net returns the bytes read, the others 0, the geometry tells the rest
+	if (ret < 0)
+		return trace(t, TRACE_READ, start, -1, 0, ret, 0, NULL, 0);
+	return trace(t, TRACE_READ, start, -1, 0, ret, ret,
+			buf + sizeof(struct frame_times), TRACE_HEAD);
+}
+
+static int trace_set_roi(Transport *t, const struct cam_roi *roi) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_SET_ROI, start, -1, 0,
+			transport_set_roi(INNER(t), roi), 0, roi, roi ? sizeof(*roi) : 0);
+}
+
+static int trace_change_tape(Transport *t, int n) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_CHANGE_TAPE, start, n, 0,
+			transport_change_tape(INNER(t), n), 0, NULL, 0);
+}
+
+static int trace_get_tape_number(Transport *t) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_GET_TAPE, start, -1, 0,
+			transport_get_tape_number(INNER(t)), 0, NULL, 0);
+}
+
+static int trace_check_if_written(Transport *t, int n) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_CHECK_WRITTEN, start, n, 0,
+			transport_check_if_written(INNER(t), n), 0, NULL, 0);
+}
+
+static int trace_get_validate(Transport *t) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_GET_VALIDATE, start, -1, 0,
+			transport_get_validate(INNER(t)), 0, NULL, 0);
+}
+
+static int trace_get_motion(Transport *t) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_GET_MOTION, start, -1, 0,
+			transport_get_motion(INNER(t)), 0, NULL, 0);
+}
+
+static int trace_get_status(Transport *t, struct cam_status *st) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_GET_STATUS, start, -1, 0,
+			transport_get_status(INNER(t), st), sizeof(*st), NULL, 0);
+}
+
+static int trace_set_codec(Transport *t, struct codec_params *codec) {
+
+	uint64_t start = latency_now_ns();
+	int ret = transport_set_codec(INNER(t), codec);
+
+	// the head is everything but the extradata
+	return trace(t, TRACE_SET_CODEC, start, codec->tape, 0, ret,
+			sizeof(*codec) - CODEC_EXTRADATA_MAX + codec->extradata_size,
+			codec, sizeof(*codec));
+}
+
+static int trace_write_packet(Transport *t, char *buf) {
+
+	uint64_t start = latency_now_ns();
+	struct packet_header hdr;
+	int ret = transport_write_packet(INNER(t), buf);
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	return trace(t, TRACE_WRITE_PACKET, start, hdr.tape, hdr.flags, ret,
+			sizeof(hdr) + hdr.size, &hdr, sizeof(hdr));
+}
+
+static int trace_get_codec(Transport *t, struct codec_params *codec) {
+
+	uint64_t start = latency_now_ns();
+	int tape = codec->tape;
+
+	return trace(t, TRACE_GET_CODEC, start, tape, 0,
+			transport_get_codec(INNER(t), codec), sizeof(*codec), NULL, 0);
+}
+
+static int trace_read_packets(Transport *t, struct packet_read *req) {
+
+	uint64_t start = latency_now_ns();
+	struct packet_read asked = *req;
+	int ret = transport_read_packets(INNER(t), req);
+
+	return trace(t, TRACE_READ_PACKETS, start, asked.tape, 0, ret,
+			ret > 0 ? ret : 0, &asked, sizeof(asked));
+}
+
+static int trace_write_pinned(Transport *t, char *buf, uint64_t cookie) {
+
+	uint64_t start = latency_now_ns();
+	size_t size, off = sizeof(size_t) + sizeof(int) + sizeof(struct frame_times);
+	int tape, ret = transport_write_pinned(INNER(t), buf, cookie);
+
+	// the buffer is the backend's now, but its header doesn't change
+	memcpy(&size, buf, sizeof(size_t));
+	memcpy(&tape, buf + sizeof(size_t), sizeof(int));
+	return trace(t, TRACE_WRITE_PINNED, start, tape, 0, ret, size,
+			buf + off, size > off ? size - off : 0);
+}
+
+static int trace_get_released(Transport *t, uint64_t *cookies, int max, int timeout_ms) {
+
+	uint64_t start = latency_now_ns();
+
+	return trace(t, TRACE_GET_RELEASED, start, -1, timeout_ms,
+			transport_get_released(INNER(t), cookies, max, timeout_ms), max, NULL, 0);
+}
+
+static const TransportOps trace_transport_ops = {
+	.name             = "trace",
+	.open             = trace_open,
+	.close            = trace_close,
+	.write_frame      = trace_write_frame,
+	.set_motion       = trace_set_motion,
+	.set_online       = trace_set_online,
+	.set_policy       = trace_set_policy,
+	.get_stats        = trace_get_stats,
+	.read_frame       = trace_read_frame,
+	.set_roi          = trace_set_roi,
+	.change_tape      = trace_change_tape,
+	.get_tape_number  = trace_get_tape_number,
+	.check_if_written = trace_check_if_written,
+	.get_validate     = trace_get_validate,
+	.get_motion       = trace_get_motion,
+	.get_status       = trace_get_status,
+	.set_codec        = trace_set_codec,
+	.write_packet     = trace_write_packet,
+	.get_codec        = trace_get_codec,
+	.read_packets     = trace_read_packets,
+	.write_pinned     = trace_write_pinned,
+	.get_released     = trace_get_released,
+};
+
+Transport *trace_wrap(Transport *inner, const char *path) {
+
+	Transport *t;
+	TraceState *st;
+
+	if (trace_file_open(path) < 0)
+		return inner;
+	t = calloc(1, sizeof(Transport));
+	st = calloc(1, sizeof(TraceState));
+	if (!t || !st) {
+		perror("trace_wrap");
+		free(t);
+		free(st);
+		return inner;
+	}
+	// the callers see the backend's name, as if we weren't there
+	st->ops = trace_transport_ops;
+	st->ops.name = inner->ops->name;
+	st->inner = inner;
+	t->ops = &st->ops;
+	t->role = inner->role;
+	t->priv = st;
+	return t;
+}
@@ -0,0 +1,88 @@
+/*
+ *  transport_trace.h - recording the transport traffic for replay.out
+ *
+ *  With $SMARTHOME_TRACE set to a file name, transport_open wraps every
+ *  transport of the process in a tracing one: each call (write, read,
+ *  change tape, the status queries, ...) is passed on to the backend and
+ *  appended to the file as a trace_record, with when it was made, how long
+ *  it took, its payload size and what it returned.
+ *
+ *  The times are CLOCK_MONOTONIC, so the traces of a write_user and a
+ *  read_user recorded at the same time on the same machine can be replayed
+ *  together. The payload itself isn't recorded, only the TRACE_HEAD bytes
+ *  that describe it (the frame geometry, the packet header, the ROI, ...),
+ *  so a replayed frame is a frame of the same size and shape.
+ *
+ *  The records of a thread are in the order it made the calls.
+ */
+#ifndef TRANSPORT_TRACE_H
+#define TRANSPORT_TRACE_H
+
+#include "transport.h"
+
+#include <stdint.h>
+
+#define TRACE_ENV "SMARTHOME_TRACE"
+
+#define TRACE_MAGIC 0x52544853		/* "SHTR" */
+#define TRACE_VERSION 1
+#define TRACE_HEAD 32
+
+enum {
+	TRACE_WRITE,		/* write_frame */
+	TRACE_READ,		/* read_frame */
+	TRACE_CHANGE_TAPE,
+	TRACE_GET_TAPE,
+	TRACE_CHECK_WRITTEN,
+	TRACE_GET_VALIDATE,
+	TRACE_GET_MOTION,
+	TRACE_GET_STATUS,
+	TRACE_GET_STATS,
+	TRACE_SET_MOTION,
+	TRACE_SET_ONLINE,
+	TRACE_SET_POLICY,
+	TRACE_SET_ROI,
+	TRACE_SET_CODEC,
+	TRACE_WRITE_PACKET,
+	TRACE_GET_CODEC,
+	TRACE_READ_PACKETS,
+	TRACE_WRITE_PINNED,
+	TRACE_GET_RELEASED,
+	TRACE_OPS
+};
+
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t start_ns;	/* when the first transport was opened */
+	uint32_t record_size;
+	uint32_t pad;
+};
+
+struct trace_record {
+	uint64_t start_ns;	/* CLOCK_MONOTONIC when the call was made */
+	uint64_t dur_ns;
+	uint8_t  op;		/* TRACE_* */
+	uint8_t  role;		/* TRANSPORT_WRITER or TRANSPORT_READER */
+	uint16_t thread;	/* threads of the process, in the order of their first call */
+	int32_t  tape;		/* the camera, -1 if the call has none */
+	int32_t  arg;		/* on, policy */
+	int32_t  ret;
+	uint32_t size;		/* payload bytes */
+	uint32_t pad;
+	uint8_t  head[TRACE_HEAD];
+};
+
+/*
+ * The op's name, for the reports
+ */
+const char *trace_op_name(int op);
+
+/*
+ * Wrap t in a tracing transport writing to the file 'path' (shared by all
+ * the transports of the process). Returns t itself if the file can't be
+ * opened.
+ */
+Transport *trace_wrap(Transport *t, const char *path);
+
+#endif
@@ -17,308 +17,1055 @@
 #undef main /* Prevents SDL from overriding main() */
 #endif
 
-#include "user_chardev.h"
+#include "../chardev.h"
+#include "transport.h"
+#include "camclient.h"
+#include "latency.h"
+#include "motion.h"
+#include "frame_cache.h"
+#include "cpu_budget.h"
+#include "decoder.h"
+#include "prof.h"
+#include "live_input.h"
 
 #include <stdio.h>
-#include <fcntl.h>		/* open */
-#include <unistd.h>		/* exit */
-#include <sys/ioctl.h>		/* ioctl */
+#include <unistd.h>		/* getopt */
+#include <errno.h>
+#include <limits.h>		/* PATH_MAX */
 #include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
 
-pthread_mutex_t lock;
+/*
+ * motion gating (-m threshold, -k keepalive ms), off when threshold is 0
+ */
+double motion_threshold = 0;
+int keepalive_ms = 1000;
+
+/*
+ * encoded passthrough (-p) - send the packets, don't decode at all
+ */
+int passthrough = 0;
+
+/*
+ * loop the videos (-l), and keep their converted frames in cache_dir (-C)
+ * so only the first pass decodes
+ */
+int loop_videos = 0;
+char* cache_dir = NULL;
+
+/*
+ * what the module does with a frame the reader didn't take yet (-b)
+ */
+int backpressure = POLICY_OVERWRITE;
+
+/*
+ * the CPU budget of all the cameras (-B percent of one CPU), 0 = no budget.
+ * With a budget the frames are decoded at their real rate.
+ */
+int cpu_percent = 0;
+CpuBudget budget;
+
+/*
+ * the sources are mapped and read ahead in windows of this many MB (-R),
+ * 0 = libavformat reads them
+ */
+int readahead_mb = 8;
+
+/*
+ * how far a live camera's frames may fall behind before they are shed (-J ms),
+ * the default of every camera, 'jitter' changes it per camera
+ */
+int jitter_ms = 200;
+
+/*
+ * hand the frames in pinned (-Z), the module copies only the ones read
+ */
+int pinned_frames = 0;
+
+static const enum AVDiscard skip_discard[SKIP_NUM] = { AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_NONKEY };
 
 typedef struct VideoState {
 
 	AVFormatContext   *pFormatCtx;
 	int               i, videoStream;
 	AVCodecContext    *pCodecCtx;
-	AVCodec           *pCodec;
 	AVFrame           *pFrame;
 	AVPacket          packet;
 	int               frameFinished;
-
-	AVDictionary      *optionsDict;
 	struct SwsContext *sws_ctx;
 
-	SDL_Overlay       *bmp;
-	SDL_Surface       *screen;
+	CamClient		*client;
+	Transport		*transport;
+	int 			tape, quit;
 
-	int 			file_desc, tape, quit;
+	Motion			motion;
+	int			motion_gating;
+	int			luma_from_decoder;	// score pFrame->data[0] before sws_scale
 
-} VideoState;
+	char			*filename;
+	FrameCache		cache;
+	FileIO			io;
+	LiveInput		live;
+	int			live_src;	// a network camera, not a file
 
+	unsigned long		skipped;	// not even converted, the camera was still full
+	uint64_t		io_bytes, io_wait_ns;	// of the sources before, under lock
 
-size_t size_of_Overlay(SDL_Overlay *bmp) {
-	/*
-	 * typedef struct  {
-	 *	
-	 *	Uint32 format;
-	 *	int w, h;
-	 * 	int planes;
-	 * 	Uint16 *pitches;
-	 *	Uint8  **pixels;
-	 *	Uint32 hw_overlay:1; <- doesn't being accounted
-	 *	
-	 *  } SDL_Overlay;
-	 * one more int for camera number */
-	return sizeof(int)*4 + sizeof(Uint32) + sizeof(Uint16)*3 + sizeof(Uint8)*bmp->h*bmp->w*3 + sizeof(size_t) /*size of overlay*/;
-}
+	// the camera's worker thread, it plays one source after the other
+	pthread_t		thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		cond;
+	char			*next_file;	// from argv or the control socket
+	int			playing;
+	unsigned long		sources;
 
-void overlay_to_buf(SDL_Overlay* bmp, char* buf, int tape) {
+} VideoState;
 
-	if(!bmp || !buf) {
-		perror("overlay_to_buf");
-		return exit(-1);
-	}
+/*
+ * One per camera, for the whole run
+ */
+VideoState* is_arr[CAM_NUM] = {NULL};
 
-	size_t size = size_of_Overlay(bmp);
-	memcpy(buf, &size, sizeof(size_t));
-	buf += sizeof(size_t);
 
-	memcpy(buf, &tape, sizeof(int));
-	buf += sizeof(int);
+/*
+ * Score the frame for motion, let the readers know when motion
+ * starts or stops, and tell if the frame should be submitted
+ */
+int motion_gate(VideoState* is, uint8_t* luma, int pitch, uint64_t now) {
 
-	memcpy(buf, &bmp->format, sizeof(Uint32));
-	buf += sizeof(Uint32);
+	int submit = motion_update(&is->motion, luma, pitch, now);
 
-	memcpy(buf, &bmp->w, sizeof(int));
-	buf += sizeof(int);
+	if(is->motion.changed)
+		transport_set_motion(is->transport, is->tape, is->motion.active);
+	return submit;
+}
 
-	memcpy(buf, &bmp->h, sizeof(int));
-	buf += sizeof(int);
+/*
+ * Open a source on the camera of 'is', FAIL if it can't be played
+ */
+int open_video(VideoState* is, char* filename) {
 
-	memcpy(buf, &bmp->planes, sizeof(int));
-	buf += sizeof(int);
+	AVDictionary* opts = NULL;
+	int ret;
 
-	memcpy(buf, &bmp->pitches[0], sizeof(Uint16));
-	buf += sizeof(Uint16);
+	is->filename = filename;
+	is->motion_gating = 0;
 
-	memcpy(buf, &bmp->pitches[1], sizeof(Uint16));
-	buf += sizeof(Uint16);
+	// a network camera is read with low latency settings, and can be interrupted
+	is->live_src = live_is_url(filename);
+	if(is->live_src) {
+		is->pFormatCtx = live_alloc_context(&is->live, &is->quit);
+		opts = live_options(&is->live);
+	}
 
-	memcpy(buf, &bmp->pitches[2], sizeof(Uint16));
-	buf += sizeof(Uint16);
+	is->io.readahead = is->live_src ? 0 : (size_t)readahead_mb << 20;
+	ret = decoder_open(filename, &is->io, opts, &is->pFormatCtx, &is->videoStream, &is->pCodecCtx, 1);
+	av_dict_free(&opts);
+	if(ret < 0) {
+		fprintf(stderr, "tape %d: can't play %s\n", is->tape+1, filename);
+		return FAIL;
+	}
+	if(is->live_src)
+		live_connected(&is->live, latency_now_ns());
 
-	memcpy(buf, bmp->pixels[0], sizeof(Uint8)*bmp->h*bmp->w);	
-	buf += sizeof(Uint8)*bmp->h*bmp->w;
+	// Allocate video frame
+	is->pFrame=av_frame_alloc();
 
-	memcpy(buf, bmp->pixels[1], sizeof(Uint8)*bmp->h*bmp->w);	
-	buf += sizeof(Uint8)*bmp->h*bmp->w;
+	if(motion_threshold > 0) {
+		if(motion_init(&is->motion, is->pCodecCtx->width, is->pCodecCtx->height, motion_threshold, keepalive_ms) < 0) {
+			fprintf(stderr, "Could not allocate the motion model\n");
+			exit(1);
+		}
+		is->motion_gating = 1;
+		is->luma_from_decoder = has_luma_plane(is->pCodecCtx->pix_fmt);
+	}
 
-	//original is -90
-	memcpy(buf, bmp->pixels[2], sizeof(Uint8)*(bmp->h-200)*bmp->w);
+	is->sws_ctx = sws_getCachedContext
+			(
+					is->sws_ctx,
+					is->pCodecCtx->width,
+					is->pCodecCtx->height,
+					is->pCodecCtx->pix_fmt,
+					is->pCodecCtx->width,
+					is->pCodecCtx->height,
+					PIX_FMT_YUV420P,
+					SWS_BILINEAR, NULL, NULL, NULL
+			);
+	return SUCCESS;
 }
 
+/*
+ * Free what open_video made, the camera (and its scaler) stays for the next source
+ */
+void close_video(VideoState* is) {
 
-void init_video(VideoState** is, char* filename, int file_desc) {
-
-	int i;
-
-	*is = av_mallocz(sizeof(VideoState));
+	if(is->motion_gating)
+		motion_free(&is->motion);
+	is->motion_gating = 0;
 
-	(*is)->quit = 0;
+	// Free the YUV frame
+	av_frame_free(&is->pFrame);
 
-	(*is)->file_desc = file_desc;
-	// Register all formats and codecs
-	av_register_all();
+	decoder_close(&is->io, &is->pFormatCtx, is->pCodecCtx);
 
-	if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
-		fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
-		exit(1);
-	}
-	// Open video file
-	if(avformat_open_input(&((*is)->pFormatCtx), filename, NULL, NULL)!=0)
-		exit(1); // Couldn't open file
+	pthread_mutex_lock(&is->lock);
+	is->io_bytes += is->io.bytes;
+	is->io_wait_ns += is->io.wait_ns;
+	__atomic_store_n(&is->io.bytes, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&is->io.wait_ns, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&is->lock);
+}
 
-	// Retrieve stream information
-	if(avformat_find_stream_info((*is)->pFormatCtx, NULL)<0)
-		exit(1); // Couldn't find stream information
+/* 
+ * Functions for the transport calls 
+ */
 
-	// Find the first video stream
-	(*is)->videoStream=-1;
-	for(i=0; i<(*is)->pFormatCtx->nb_streams; i++)
-		if((*is)->pFormatCtx->streams[i]->codec->codec_type==AVMEDIA_TYPE_VIDEO) {
-			(*is)->videoStream=i;
-			break;
-		}
-	if((*is)->videoStream==-1)
-		exit(1); // Didn't find a video stream
+/*
+ * Hands a frame to the transport, a frame dropped by the POLICY_DROP
+ * backpressure, or sent while the camera is being removed, is just skipped
+ */
+void submit_frame(VideoState* is, CamFrame* f) {
 
-	// Get a pointer to the codec context for the video stream
-	(*is)->pCodecCtx=(*is)->pFormatCtx->streams[(*is)->videoStream]->codec;
+	int ret_val;
 
-	// Find the decoder for the video stream
-	(*is)->pCodec=avcodec_find_decoder((*is)->pCodecCtx->codec_id);
-	if((*is)->pCodec==NULL) {
-		fprintf(stderr, "Unsupported codec!\n");
-		exit(1); // Codec not found
+	ret_val = cam_commit(is->client, f);
+	if (ret_val < 0 && ret_val != -EAGAIN && ret_val != -ENODEV) {
+		printf("ioctl_set_msg failed: %d\n", ret_val);
+		exit(-1);
 	}
+}
 
-	// Open codec
-	if(avcodec_open2((*is)->pCodecCtx, (*is)->pCodec, &((*is)->optionsDict))<0)
-		exit(1); // Could not open codec
+/*
+ * With POLICY_DROP a frame is wasted work while the last one wasn't read
+ */
+int camera_busy(VideoState* is) {
 
-	// Allocate video frame
-	(*is)->pFrame=av_frame_alloc();
+	struct cam_stats st;
 
-	// Make a screen to put our video
-#ifndef __DARWIN__
-	(*is)->screen = SDL_SetVideoMode(200, 200, 0, 0);
-#else
-	(*is)->screen = SDL_SetVideoMode(200, 200, 24, 0);
-#endif
-	if(!(*is)->screen) {
-		fprintf(stderr, "SDL: could not set video mode - exiting\n");
-		exit(1);
-	}
+	if (backpressure != POLICY_DROP)
+		return 0;
+	st.tape = is->tape;
+	if (transport_get_stats(is->transport, &st) < 0)
+		return 0;
+	return st.pending;
+}
 
-	// Allocate a place to put our YUV image on that screen
-	(*is)->bmp = SDL_CreateYUVOverlay((*is)->pCodecCtx->width, (*is)->pCodecCtx->height, SDL_YV12_OVERLAY, (*is)->screen);
+/*
+ * The next packet of the source - a live one gets LIVE_READ_TIMEOUT_MS
+ */
+int read_packet(VideoState* is) {
 
-	(*is)->sws_ctx = sws_getContext
-			(
-					(*is)->pCodecCtx->width,
-					(*is)->pCodecCtx->height,
-					(*is)->pCodecCtx->pix_fmt,
-					(*is)->pCodecCtx->width,
-					(*is)->pCodecCtx->height,
-					PIX_FMT_YUV420P,
-					SWS_BILINEAR, NULL, NULL, NULL
-			);
+	if(is->live_src)
+		live_arm(&is->live);
+	return av_read_frame(is->pFormatCtx, &is->packet);
 }
 
-/* 
- * Functions for the ioctl calls 
+/*
+ * Wait until a live camera would have sent the packet, returns when that is
  */
+uint64_t pace_packet(AVPacket* packet, AVStream* st, int64_t* first_ts, uint64_t* start) {
 
-void ioctl_set_msg(void* arg) {
+	int64_t    ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+	AVRational ns = {1, 1000000000};
+	uint64_t   due, now = latency_now_ns();
 
-	int 		  ret_val;
-	VideoState**  is  = (VideoState**)arg;
+	if(ts == AV_NOPTS_VALUE)
+		return now;
+	if(*first_ts == AV_NOPTS_VALUE) {
+		*first_ts = ts;
+		*start = now;
+	}
+	due = *start + av_rescale_q(ts - *first_ts, st->time_base, ns);
+	if(due > now)
+		usleep((due - now) / 1000);
+	return due;
+}
 
-	// will hold the serialized overlay data
-	char          *buf = NULL;
+/*
+ * Passes over a cached video - the converted frames go to the transport
+ * straight from the cache mapping, paced by their timestamps
+ */
+void serve_cached(VideoState* is) {
+
+	uint32_t           i;
+	uint64_t           start, pts, now, cpu;
+	CamFrame           f;
+	ProfMark           pm;
+
+	do {
+		start = latency_now_ns();
+		for(i = 0; i < frame_cache_frames(&is->cache) && !is->quit; i++) {
+			// the mapping is private, commit patches the frame in place
+			if(cam_parse(&f, frame_cache_frame(&is->cache, i, &pts), is->cache.hdr.frame_size) < 0)
+				continue;
+			now = latency_now_ns();
+			if(start + pts > now)
+				usleep((start + pts - now) / 1000);
+			if(cpu_percent) {
+				budget_decoded(&budget, is->tape, 0, 1);
+				if(!budget_admit(&budget, is->tape, start + pts, latency_now_ns()))
+					continue;
+			}
 
-	buf = (char*)malloc(size_of_Overlay((*is)->bmp));
+			// nothing to decode, the frame is "captured" right now
+			memset(&f.times, 0, sizeof(struct frame_times));
+			f.times.decode_ns = f.times.capture_ns = latency_now_ns();
+			if(is->motion_gating && !motion_gate(is, f.pixels[0], f.pitches[0], f.times.capture_ns))
+				continue;
+
+			f.tape = is->tape;
+			cpu = budget_cpu_ns();
+			prof_begin(&pm);
+			submit_frame(is, &f);
+			prof_lap(&pm, is->tape, PROF_SUBMIT);
+			if(cpu_percent)
+				budget_converted(&budget, is->tape, budget_cpu_ns() - cpu);
+		}
+	} while(loop_videos && !is->quit);
+}
 
-	// Read frames
-	while(av_read_frame((*is)->pFormatCtx, &(*is)->packet)>=0 && !(*is)->quit) {
+void ioctl_set_msg(void* arg) {
 
-		// Is this a packet from the video stream?
-		if((*is)->packet.stream_index==(*is)->videoStream) {
+	int 		  ret_val, submit, late, caching = 0;
+	VideoState**  is  = (VideoState**)arg;
+	struct frame_times times = {0};
+	AVStream*     st = (*is)->pFormatCtx->streams[(*is)->videoStream];
+	AVRational    ns = {1, 1000000000};
+	int64_t       pts, first_pts = AV_NOPTS_VALUE, first_ts;
+	uint64_t      pts_ns = 0, due = 0, pace_start = 0, cpu = 0;
+	int           w = (*is)->pCodecCtx->width, h = (*is)->pCodecCtx->height;
+
+	// the frame being converted, straight into a buffer of the client's pool
+	CamFrame      *f;
+	ProfMark      pm;
+
+	// the module would cut every frame short, and the reader drop it
+	if(cam_frame_size(w, h) > CAM_FRAME_TIMES_OFF + CAM_LEN) {
+		fprintf(stderr, "tape %d: %dx%d frames take %zu bytes, a camera holds %d - not sent\n",
+				(*is)->tape+1, w, h, cam_frame_size(w, h) - CAM_FRAME_TIMES_OFF, CAM_LEN);
+		return;
+	}
 
-			// Decode video frame
-			avcodec_decode_video2((*is)->pCodecCtx, (*is)->pFrame, &(*is)->frameFinished, &(*is)->packet);
+	// a live camera is never the same twice
+	if(cache_dir && !(*is)->live_src) {
+		ret_val = frame_cache_open(&(*is)->cache, cache_dir, (*is)->filename, w, h, cam_frame_size(w, h));
+		if(ret_val == 1) {
+			printf("tape %d is served from %s\n", (*is)->tape+1, (*is)->cache.path);
+			serve_cached(*is);
+			goto done;
+		}
+		if(ret_val == 0)
+			caching = 1;
+		else
+			fprintf(stderr, "tape %d: can't cache in %s, decoding every pass\n", (*is)->tape+1, cache_dir);
+	}
 
-			// Did we get a video frame?
-			if((*is)->frameFinished) {
+	for(;;) {
+		first_ts = AV_NOPTS_VALUE;
+		prof_begin(&pm);
+		// Read frames
+		while(read_packet(*is)>=0 && !(*is)->quit) {
+			prof_lap(&pm, (*is)->tape, PROF_DEMUX);
+
+			// Is this a packet from the video stream?
+			if((*is)->packet.stream_index==(*is)->videoStream) {
+
+				/*
+				 * a live camera that fell behind (a backlog after a hiccup)
+				 * decodes only what the next frames need, and sends nothing
+				 * until it has caught up
+				 */
+				late = 0;
+				if((*is)->live_src) {
+					late = live_late(&(*is)->live, (*is)->packet.dts != AV_NOPTS_VALUE ? (*is)->packet.dts : (*is)->packet.pts,
+							st->time_base, latency_now_ns());
+					(*is)->pCodecCtx->skip_frame = late ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+				}
 
-				SDL_LockYUVOverlay((*is)->bmp);
+				// with a budget, decode like a live camera and skip what the plan says
+				if(cpu_percent) {
+					// the network paces a live camera
+					due = (*is)->live_src ? latency_now_ns() : pace_packet(&(*is)->packet, st, &first_ts, &pace_start);
+					if(!caching && !late)
+						(*is)->pCodecCtx->skip_frame = skip_discard[budget_skip(&budget, (*is)->tape)];
+					cpu = budget_cpu_ns();
+					prof_begin(&pm);	// not the waiting
+				}
 
-				AVPicture pict;
-				pict.data[0] = (*is)->bmp->pixels[0];
-				pict.data[1] = (*is)->bmp->pixels[2];
-				pict.data[2] = (*is)->bmp->pixels[1];
+				// Decode video frame
+				times.decode_ns = latency_now_ns();
+				avcodec_decode_video2((*is)->pCodecCtx, (*is)->pFrame, &(*is)->frameFinished, &(*is)->packet);
+				prof_lap(&pm, (*is)->tape, PROF_DECODE);
+				if(cpu_percent)
+					budget_decoded(&budget, (*is)->tape, budget_cpu_ns() - cpu, (*is)->frameFinished);
+
+				// Did we get a video frame?
+				if((*is)->frameFinished) {
+
+					times.capture_ns = latency_now_ns();
+
+					/*
+					 * an idle camera is only submitted every keepalive, and if the
+					 * decoder gives us luma we don't even convert the dropped frames
+					 * (unless they go to the cache)
+					 */
+					submit = !late;
+					// over its share of the CPU the camera loses frames, not time
+					if(cpu_percent && !caching && !budget_admit(&budget, (*is)->tape, due, times.capture_ns))
+						submit = 0;
+					if(submit && (*is)->motion_gating && (*is)->luma_from_decoder && !caching)
+						submit = motion_gate(*is, (*is)->pFrame->data[0], (*is)->pFrame->linesize[0], times.capture_ns);
+					// the reader is behind, the module would drop it anyway
+					if(submit && !caching && camera_busy(*is)) {
+						(*is)->skipped++;
+						submit = 0;
+					}
+					prof_lap(&pm, (*is)->tape, PROF_MOTION);
+					if(!submit) {
+						av_free_packet(&(*is)->packet);
+						continue;
+					}
+
+					cpu = budget_cpu_ns();
+					f = cam_acquire((*is)->client, (*is)->tape, w, h);
+					if(!f) {
+						fprintf(stderr, "tape %d: no frame of %dx%d: %s\n", (*is)->tape+1, w, h, strerror(errno));
+						exit(-1);
+					}
+					f->times = times;
+
+					AVPicture pict;
+					pict.data[0] = f->pixels[0];
+					pict.data[1] = f->pixels[2];
+					pict.data[2] = f->pixels[1];
+
+					pict.linesize[0] = f->pitches[0];
+					pict.linesize[1] = f->pitches[2];
+					pict.linesize[2] = f->pitches[1];
+
+					// Convert the image into YUV format that SDL uses, right into the frame
+					sws_scale
+					(
+							(*is)->sws_ctx,
+							(uint8_t const * const *)(*is)->pFrame->data,
+							(*is)->pFrame->linesize, 0,
+							(*is)->pCodecCtx->height,
+							pict.data,
+							pict.linesize
+					);
+					prof_lap(&pm, (*is)->tape, PROF_CONVERT);
+					if((*is)->motion_gating && (!(*is)->luma_from_decoder || caching)) {
+						submit = motion_gate(*is, f->pixels[0], f->pitches[0], times.capture_ns);
+						prof_lap(&pm, (*is)->tape, PROF_MOTION);
+					}
+
+					if(caching) {
+						pts = (*is)->pFrame->best_effort_timestamp;
+						if(pts != AV_NOPTS_VALUE) {
+							if(first_pts == AV_NOPTS_VALUE)
+								first_pts = pts;
+							pts_ns = av_rescale_q(pts - first_pts, st->time_base, ns);
+						}
+						else
+							pts_ns += 40000000;	// no timestamps, say 25 fps
+						if(frame_cache_append(&(*is)->cache, f->buf, pts_ns) < 0) {
+							fprintf(stderr, "tape %d: writing the cache failed, decoding every pass\n", (*is)->tape+1);
+							frame_cache_close(&(*is)->cache);
+							caching = 0;
+						}
+						prof_lap(&pm, (*is)->tape, PROF_CACHE);
+					}
+
+					if(submit)
+						submit_frame(*is, f);
+					else
+						cam_release(f);
+					prof_lap(&pm, (*is)->tape, PROF_SUBMIT);
+					if(cpu_percent)
+						budget_converted(&budget, (*is)->tape, budget_cpu_ns() - cpu);
+				}
+			}
+			av_free_packet(&(*is)->packet);
+		}
 
-				pict.linesize[0] = (*is)->bmp->pitches[0];
-				pict.linesize[1] = (*is)->bmp->pitches[2];
-				pict.linesize[2] = (*is)->bmp->pitches[1];
+		// the first pass is over, the next ones come from the cache
+		if(caching) {
+			caching = 0;
+			if(!(*is)->quit && frame_cache_finish(&(*is)->cache) == SUCCESS) {
+				if(loop_videos)
+					serve_cached(*is);
+				break;
+			}
+			fprintf(stderr, "tape %d: couldn't finish the cache\n", (*is)->tape+1);
+		}
 
-				// Convert the image into YUV format that SDL uses
-				sws_scale
-				(
-						(*is)->sws_ctx,
-						(uint8_t const * const *)(*is)->pFrame->data,
-						(*is)->pFrame->linesize, 0,
-						(*is)->pCodecCtx->height,
-						pict.data,
-						pict.linesize
-				);
-				overlay_to_buf((*is)->bmp, buf, (*is)->tape);
+		// a live camera that ends was lost, the worker reconnects
+		if(!loop_videos || (*is)->quit || (*is)->live_src)
+			break;
 
-				SDL_UnlockYUVOverlay((*is)->bmp);
+		// no cache, start over and decode it again
+		av_seek_frame((*is)->pFormatCtx, (*is)->videoStream, 0, AVSEEK_FLAG_BACKWARD);
+		avcodec_flush_buffers((*is)->pCodecCtx);
+	}
 
-				pthread_mutex_lock(&lock);
+done:
+	if(cache_dir)
+		frame_cache_close(&(*is)->cache);
+}
 
-				ret_val = ioctl((*is)->file_desc, IOCTL_WRITE, buf);
 
-				pthread_mutex_unlock(&lock);
+/*
+ * Passthrough mode - send the demuxed packets as they are, paced by their
+ * timestamps like a live camera. The module keeps every camera's packets
+ * since the last keyframe, and read_user decodes only the camera it shows.
+ */
+void ioctl_set_packets(void* arg) {
+
+	int                  ret_val;
+	int64_t              first_ts = AV_NOPTS_VALUE;
+	uint64_t             start = 0;
+	VideoState**         is = (VideoState**)arg;
+	AVStream*            st = (*is)->pFormatCtx->streams[(*is)->videoStream];
+	AVCodecContext*      c = (*is)->pCodecCtx;
+	struct codec_params  codec;
+	struct packet_header hdr;
+	char                 *buf;
+	ProfMark             pm;
+
+	memset(&codec, 0, sizeof(codec));
+	codec.tape = (*is)->tape;
+	codec.codec_id = c->codec_id;
+	codec.width = c->width;
+	codec.height = c->height;
+	codec.pix_fmt = c->pix_fmt;
+	codec.time_base_num = st->time_base.num;
+	codec.time_base_den = st->time_base.den;
+	if(c->extradata_size > CODEC_EXTRADATA_MAX) {
+		fprintf(stderr, "tape %d: codec extradata too big for passthrough\n", (*is)->tape+1);
+		exit(1);
+	}
+	codec.extradata_size = c->extradata_size;
+	if(c->extradata_size)
+		memcpy(codec.extradata, c->extradata, c->extradata_size);
+
+	ret_val = transport_set_codec((*is)->transport, &codec);
+	if (ret_val == -ENODEV)
+		return;		// the camera was removed already
+	if (ret_val < 0) {
+		printf("ioctl_set_codec failed: %d\n", ret_val);
+		exit(-1);
+	}
 
-				if (ret_val < 0) {
-					printf("ioctl_set_msg failed: %d\n", ret_val);
+	buf = (char*)malloc(CAM_LEN);
+
+	for(;;) {
+		first_ts = AV_NOPTS_VALUE;
+		prof_begin(&pm);
+		while(read_packet(*is)>=0 && !(*is)->quit) {
+			prof_lap(&pm, (*is)->tape, PROF_DEMUX);
+
+			if((*is)->packet.stream_index==(*is)->videoStream && (*is)->packet.size <= CAM_LEN - sizeof(hdr)) {
+
+				/*
+				 * wait until the camera would have sent it - a live one
+				 * sends it itself, and a backlog goes through as it is,
+				 * the reader decodes only from the newest keyframe
+				 */
+				if(!(*is)->live_src)
+					pace_packet(&(*is)->packet, st, &first_ts, &start);
+				prof_begin(&pm);
+
+				memset(&hdr, 0, sizeof(hdr));
+				hdr.size = (*is)->packet.size;
+				hdr.tape = (*is)->tape;
+				hdr.flags = ((*is)->packet.flags & AV_PKT_FLAG_KEY) ? PACKET_KEY : 0;
+				hdr.pts = (*is)->packet.pts;
+				hdr.dts = (*is)->packet.dts;
+				// nothing is decoded here, the decode stage is empty
+				hdr.times.decode_ns = hdr.times.capture_ns = latency_now_ns();
+
+				memcpy(buf, &hdr, sizeof(hdr));
+				memcpy(buf + sizeof(hdr), (*is)->packet.data, (*is)->packet.size);
+
+				// 0 means the GOP didn't fit and the module dropped the packet
+				ret_val = transport_write_packet((*is)->transport, buf);
+				if (ret_val < 0 && ret_val != -ENODEV) {
+					printf("ioctl_set_packet failed: %d\n", ret_val);
 					exit(-1);
 				}
+				prof_lap(&pm, (*is)->tape, PROF_SUBMIT);
 			}
+			av_free_packet(&(*is)->packet);
 		}
-		av_free_packet(&(*is)->packet);
+
+		if(!loop_videos || (*is)->quit || (*is)->live_src)
+			break;
+		av_seek_frame((*is)->pFormatCtx, (*is)->videoStream, 0, AVSEEK_FLAG_BACKWARD);
 	}
 
-	// Free allocated buff
 	free(buf);
+}
 
-	// Free the YUV frame
-	av_free((*is)->pFrame);
 
-	// Close the codec
-	avcodec_close((*is)->pCodecCtx);
+/*
+ * ================= hot-plug - the camera workers =================
+ *
+ * Every camera has a worker thread for the whole run. It waits for a
+ * source, plays it, frees it and waits for the next one, so adding or
+ * replacing a source costs no thread and no buffers (the frames come
+ * from the client's pool) and touches no other camera.
+ */
+/*
+ * Play one source on the camera until it ends, it is removed or (a live
+ * camera) the connection is lost
+ */
+void play_source(VideoState* is, char* filename) {
+
+	int ok;
+
+	if(open_video(is, filename) == SUCCESS) {
+		// back online, unless it was removed in the meantime
+		pthread_mutex_lock(&is->lock);
+		ok = !is->quit;
+		if(ok)
+			transport_set_online(is->transport, is->tape, 1);
+		pthread_mutex_unlock(&is->lock);
+
+		// the packets keep their GOP log, the policy is only for frames
+		if(ok && backpressure != POLICY_OVERWRITE && !passthrough &&
+				transport_set_policy(is->transport, is->tape, backpressure) < 0)
+			fprintf(stderr, "tape %d: this transport has no backpressure, frames are overwritten\n", is->tape+1);
+
+		if(ok) {
+			printf("tape number %d is written to kernel (%s)\n", is->tape+1, filename);
+			is->sources++;
+			if(cpu_percent)
+				budget_reset(&budget, is->tape);
+			if(passthrough)
+				ioctl_set_packets(&is);
+			else
+				ioctl_set_msg(&is);
+		}
+		close_video(is);
+	}
+}
+
+/*
+ * A live camera was lost - offline until it's back, and wait the backoff.
+ * Returns 0 if the camera was removed or replaced meanwhile.
+ */
+int wait_reconnect(VideoState* is, const char* filename) {
 
-	// Close the video file
-	avformat_close_input(&(*is)->pFormatCtx);	
+	struct timespec until;
+	int ms, again;
+
+	pthread_mutex_lock(&is->lock);
+	ms = live_lost(&is->live, latency_now_ns());
+	if(!is->quit) {
+		transport_set_online(is->transport, is->tape, 0);
+		fprintf(stderr, "tape %d: lost %s, reconnecting in %d ms\n", is->tape+1, filename, ms);
+	}
+	clock_gettime(CLOCK_REALTIME, &until);
+	until.tv_sec += ms / 1000;
+	until.tv_nsec += (ms % 1000) * 1000000L;
+	if(until.tv_nsec >= 1000000000L) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000L;
+	}
+	// stop_camera and start_camera wake us up
+	while(!is->quit && !is->next_file)
+		if(pthread_cond_timedwait(&is->cond, &is->lock, &until) == ETIMEDOUT)
+			break;
+	again = !is->quit && !is->next_file;
+	pthread_mutex_unlock(&is->lock);
+	return again;
 }
 
+void* camera_worker(void* arg) {
+
+	VideoState* is = (VideoState*)arg;
+	char* filename;
+
+	for(;;) {
+		pthread_mutex_lock(&is->lock);
+		while(!is->next_file)
+			pthread_cond_wait(&is->cond, &is->lock);
+		filename = is->next_file;
+		is->next_file = NULL;
+		is->quit = 0;
+		is->playing = 1;
+		is->live.backoff_ms = 0;
+		pthread_mutex_unlock(&is->lock);
+
+		// a live camera keeps coming back, without touching the others
+		do
+			play_source(is, filename);
+		while(live_is_url(filename) && wait_reconnect(is, filename));
+
+		pthread_mutex_lock(&is->lock);
+		is->filename = NULL;
+		is->playing = 0;
+		pthread_cond_broadcast(&is->cond);
+		pthread_mutex_unlock(&is->lock);
+		free(filename);
+	}
+	return NULL;
+}
 
-void ioctl_ch_tape(int file_desc, int n) {
+void start_camera(VideoState* is, const char* filename) {
 
-	int ret_val = ioctl(file_desc, IOCTL_CHANGE_TAPE, n);
+	pthread_mutex_lock(&is->lock);
+	free(is->next_file);
+	is->next_file = strdup(filename);
+	pthread_cond_broadcast(&is->cond);
+	pthread_mutex_unlock(&is->lock);
+}
 
-	if (ret_val < 0) 
-		printf("ioctl_ch_tape failed: %d\n", ret_val);
+/*
+ * Stop the source of a camera and take the camera offline, that also
+ * wakes a writer blocked on the reader. Returns when the worker is idle.
+ */
+void stop_camera(VideoState* is) {
+
+	pthread_mutex_lock(&is->lock);
+	free(is->next_file);
+	is->next_file = NULL;
+	is->quit = 1;
+	transport_set_online(is->transport, is->tape, 0);
+	while(is->playing)
+		pthread_cond_wait(&is->cond, &is->lock);
+	pthread_mutex_unlock(&is->lock);
+}
+
+/*
+ * Plans the CPU budget (-B) every BUDGET_PERIOD_MS, from what the reader
+ * shows, the motion and the cameras that play
+ */
+void* budget_thread(void* arg) {
+
+	CamClient* client = (CamClient*)arg;
+	struct cam_status st;
+	uint32_t playing;
+	int i;
+
+	for(;;) {
+		usleep(BUDGET_PERIOD_MS * 1000);
+		if(cam_status(client, &st) < 0)
+			memset(&st, 0, sizeof(st));
+		playing = 0;
+		for(i = 0; i < CAM_NUM; i++) {
+			pthread_mutex_lock(&is_arr[i]->lock);
+			if(is_arr[i]->playing)
+				playing |= 1 << i;
+			pthread_mutex_unlock(&is_arr[i]->lock);
+		}
+		budget_plan(&budget, st.cur_cam, st.motion, playing, latency_now_ns());
+	}
+	return NULL;
+}
+
+/*
+ * One line of the control socket, one line of answer:
+ *	add <video>		play it on the first free camera
+ *	replace <n> <video>	play it on camera n instead of what it plays
+ *	remove <n>		stop camera n and take it offline
+ *	list			a line per camera, then "ok"
+ *	budget			the CPU budget of every camera, then "ok"
+ *	jitter <n> <ms>		the jitter budget of live camera n
+ * Cameras are numbered from 1, like the tapes.
+ */
+void control_command(char* line, FILE* out) {
+
+	int i, n, ms;
+	char file[PATH_MAX];
+
+	line[strcspn(line, "\r\n")] = 0;
+
+	if(sscanf(line, "add %4095[^\n]", file) == 1) {
+		for(i = 0; i < CAM_NUM; i++) {
+			pthread_mutex_lock(&is_arr[i]->lock);
+			n = !is_arr[i]->playing && !is_arr[i]->next_file;
+			pthread_mutex_unlock(&is_arr[i]->lock);
+			if(n)
+				break;
+		}
+		if(i == CAM_NUM) {
+			fprintf(out, "error all cameras are playing\n");
+			return;
+		}
+		start_camera(is_arr[i], file);
+		fprintf(out, "ok %d\n", i+1);
+	}
+	else if(sscanf(line, "replace %d %4095[^\n]", &n, file) == 2 && n >= 1 && n <= CAM_NUM) {
+		stop_camera(is_arr[n-1]);
+		start_camera(is_arr[n-1], file);
+		fprintf(out, "ok %d\n", n);
+	}
+	else if(sscanf(line, "remove %d", &n) == 1 && n >= 1 && n <= CAM_NUM) {
+		stop_camera(is_arr[n-1]);
+		fprintf(out, "ok %d\n", n);
+	}
+	else if(sscanf(line, "jitter %d %d", &n, &ms) == 2 && n >= 1 && n <= CAM_NUM && ms > 0) {
+		// the next reconnect also reorders within it
+		pthread_mutex_lock(&is_arr[n-1]->lock);
+		is_arr[n-1]->live.jitter_ms = ms;
+		pthread_mutex_unlock(&is_arr[n-1]->lock);
+		fprintf(out, "ok %d\n", n);
+	}
+	else if(!strcmp(line, "budget")) {
+		budget_dump(&budget, out);
+		fprintf(out, "ok\n");
+	}
+	else if(!strcmp(line, "list")) {
+		for(i = 0; i < CAM_NUM; i++) {
+			pthread_mutex_lock(&is_arr[i]->lock);
+			if(is_arr[i]->playing && is_arr[i]->filename && is_arr[i]->live_src)
+				fprintf(out, "%d %s live jitter %d ms late %lu reconnects %lu\n", i+1, is_arr[i]->filename,
+						is_arr[i]->live.jitter_ms, is_arr[i]->live.late, is_arr[i]->live.reconnects);
+			else if(is_arr[i]->playing && is_arr[i]->filename)
+				fprintf(out, "%d %s io %.1f MB wait %.1f ms\n", i+1, is_arr[i]->filename,
+						__atomic_load_n(&is_arr[i]->io.bytes, __ATOMIC_RELAXED) / 1048576.0,
+						__atomic_load_n(&is_arr[i]->io.wait_ns, __ATOMIC_RELAXED) / 1e6);
+			pthread_mutex_unlock(&is_arr[i]->lock);
+		}
+		fprintf(out, "ok\n");
+	}
 	else
-		printf("the selected tape is now tape %d\n", n);
+		fprintf(out, "error add <video> | replace <n> <video> | remove <n> | list | budget | jitter <n> <ms>\n");
+}
+
+/*
+ * The control socket (-s path), one client at a time
+ */
+void* control_thread(void* arg) {
+
+	char* path = (char*)arg;
+	char line[PATH_MAX + 32];
+	int listen_fd, fd;
+	struct sockaddr_un addr;
+	struct stat st;
+	FILE *in, *out;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+	// only a socket left by a previous run is replaced
+	if(!lstat(path, &st)) {
+		if(!S_ISSOCK(st.st_mode)) {
+			fprintf(stderr, "control socket: %s exists and is not a socket\n", path);
+			exit(1);
+		}
+		unlink(path);
+	}
+
+	// it adds, replaces and removes cameras, so for our user only.
+	// Linux makes the path with the mode of the socket
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listen_fd < 0 || fchmod(listen_fd, 0600) < 0 || bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_fd, 4) < 0) {
+		perror("control socket");
+		exit(1);
+	}
+
+	for(;;) {
+		fd = accept(listen_fd, NULL, NULL);
+		if(fd < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("control socket");
+			break;
+		}
+		in = fdopen(fd, "r");
+		out = fdopen(dup(fd), "w");
+		if(!in || !out) {
+			if(in) fclose(in); else close(fd);
+			if(out) fclose(out);
+			continue;
+		}
+		while(fgets(line, sizeof(line), in)) {
+			control_command(line, out);
+			fflush(out);
+		}
+		fclose(in);
+		fclose(out);
+	}
+	close(listen_fd);
+	return NULL;
 }
 
 
+void usage() {
+
+	fprintf(stderr, "Usage: .exe [-t chardev|shm] [-m motion_threshold] [-k keepalive_ms] [-p] [-l] [-C cache_dir] [-b overwrite|block|drop] [-s control_socket] [-B cpu_percent] [-P profile_seconds] [-H] [-R readahead_mb] [-J jitter_ms] [-Z] <video1|url> <video2|url>... <video10|url>\n");
+	exit(1);
+}
+
 /* 
  * Main - BACKEND, init videos and write serialized frames to kernel 
  */
 int main(int argc, char* argv[]) {
 
 	SDL_Event event;
-	pthread_t thread;				// no used tapes at the beginning (0 = not used, 1 = used)
-	int file_desc, rc, i, quit = 0, num_of_videos;
-	VideoState* is_arr[10] = {NULL};
+	pthread_t thread;
+	int rc, i, opt, quit = 0, num_of_videos;
+	struct cam_stats st;
+	char* backend = NULL;
+	char* control_path = NULL;
+	int profile_period = -1, profile_hw = 0;
+	CamClient* client;
+	Transport* transport;
+
+	while((opt = getopt(argc, argv, "t:m:k:plC:b:s:B:P:HR:J:Z")) != -1) {
+		switch(opt) {
+		case 't':
+			backend = optarg;
+			break;
+		case 'm':
+			motion_threshold = atof(optarg);
+			break;
+		case 'k':
+			keepalive_ms = atoi(optarg);
+			break;
+		case 'p':
+			passthrough = 1;
+			break;
+		case 'l':
+			loop_videos = 1;
+			break;
+		case 'C':
+			cache_dir = optarg;
+			break;
+		case 'b':
+			if (!strcmp(optarg, "overwrite"))
+				backpressure = POLICY_OVERWRITE;
+			else if (!strcmp(optarg, "block"))
+				backpressure = POLICY_BLOCK;
+			else if (!strcmp(optarg, "drop"))
+				backpressure = POLICY_DROP;
+			else
+				usage();
+			break;
+		case 's':
+			control_path = optarg;
+			break;
+		case 'B':
+			cpu_percent = atoi(optarg);
+			if(cpu_percent <= 0)
+				usage();
+			break;
+		case 'P':
+			profile_period = atoi(optarg);
+			break;
+		case 'H':
+			profile_hw = 1;
+			break;
+		case 'R':
+			readahead_mb = atoi(optarg);
+			if(readahead_mb < 0)
+				usage();
+			break;
+		case 'J':
+			jitter_ms = atoi(optarg);
+			if(jitter_ms <= 0)
+				usage();
+			break;
+		case 'Z':
+			pinned_frames = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	if(passthrough && cache_dir) {
+		fprintf(stderr, "nothing is decoded in passthrough mode, -C is ignored\n");
+		cache_dir = NULL;
+	}
+	if(passthrough && motion_threshold > 0) {
+		fprintf(stderr, "motion gating needs decoded frames, it is off in passthrough mode\n");
+		motion_threshold = 0;
+	}
 
-	if(argc == 1 || argc > 11) {
-		fprintf(stderr, "Usage: .exe <video1> <video2>... <video10>\n");
+	// with a control socket the cameras may all come later
+	num_of_videos = argc-optind;
+	if(num_of_videos > CAM_NUM || (num_of_videos < 1 && !control_path))
+		usage();
+
+	// Register all formats and codecs, and the network protocols of live cameras
+	av_register_all();
+	avformat_network_init();
+
+	if(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER)) {
+		fprintf(stderr, "Could not initialize SDL - %s\n", SDL_GetError());
 		exit(1);
 	}
-	num_of_videos = argc-1;
-	file_desc = open(DEVICE_FILE_NAME_W, 0);
-	if (file_desc < 0) {
-		printf("Can't open device file: %s\n", DEVICE_FILE_NAME_W);
+
+	// Make a screen, for the keyboard
+#ifndef __DARWIN__
+	if(!SDL_SetVideoMode(200, 200, 0, 0)) {
+#else
+	if(!SDL_SetVideoMode(200, 200, 24, 0)) {
+#endif
+		fprintf(stderr, "SDL: could not set video mode - exiting\n");
+		exit(1);
+	}
+
+	client = cam_open(backend, TRANSPORT_WRITER);
+	if (!client)
 		exit(-1);
+	transport = cam_transport(client);
+	if(pinned_frames && !passthrough && cam_set_pinned(client, 1) < 0)
+		fprintf(stderr, "the %s transport can't pin frames, they are copied\n", transport->ops->name);
+
+	// -H alone profiles too, dumped on SIGUSR2 only
+	if(profile_period >= 0 || profile_hw)
+		prof_init(profile_period > 0 ? profile_period : 0, profile_hw);
+
+	// the packets aren't decoded, there's nothing to budget; the workers read both
+	if(passthrough)
+		cpu_percent = 0;
+	if(cpu_percent)
+		budget_init(&budget, cpu_percent);
+
+	for(i = 0; i < CAM_NUM; i++) {
+		/*
+		 * the tape of the camera,
+		 * it is serialized to every frame to let the kernel know
+		 */
+		is_arr[i] = av_mallocz(sizeof(VideoState));
+		is_arr[i]->tape = i;
+		is_arr[i]->client = client;
+		is_arr[i]->transport = transport;
+		is_arr[i]->live.jitter_ms = jitter_ms;
+		pthread_mutex_init(&is_arr[i]->lock, NULL);
+		pthread_cond_init(&is_arr[i]->cond, NULL);
+		rc = pthread_create(&is_arr[i]->thread, NULL, camera_worker, is_arr[i]);
+		if(rc) {
+			fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
 	}
 
 	for(i = 0; i < num_of_videos; i++)
-		init_video(&is_arr[i], argv[i+1], file_desc);
+		start_camera(is_arr[i], argv[optind+i]);
 
-	if(pthread_mutex_init(&lock, NULL) != 0) {
-		printf("\n mutex init failed\n");
-		exit(-1);
+	if(cpu_percent) {
+		rc = pthread_create(&thread, NULL, budget_thread, client);
+		if(rc) {
+			fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
 	}
 
-	for(i = 0; i < num_of_videos; i++) {
-			/*
-			 * set the tape to the current tape,
-			 * we need to serialize it to the buffer after, to let the kernel know
-			 */
-			is_arr[i]->tape = i;
-			rc = pthread_create(&thread, NULL, (void*)ioctl_set_msg, &is_arr[i]);
-			if(rc) {
-				fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
-				exit(-1);
-			}
-			printf("tape number %d is written to kernel\n",i+1);
+	if(control_path) {
+		rc = pthread_create(&thread, NULL, control_thread, control_path);
+		if(rc) {
+			fprintf(stderr,"ERROR; return code from pthread_create() is %d\n", rc);
+			exit(-1);
+		}
+		printf("control socket: %s\n", control_path);
 	}
 
 	while(SDL_WaitEvent( &event ) && !quit) {
@@ -326,7 +1073,7 @@ int main(int argc, char* argv[]) {
 		case SDL_KEYDOWN:
 			switch(event.key.keysym.sym) {
 			case SDLK_q:
-				for (i = 0; i < num_of_videos; i++) is_arr[i]->quit = 1;
+				for (i = 0; i < CAM_NUM; i++) is_arr[i]->quit = 1;
 				quit = 1;
 				break;
 			default: break;
@@ -335,7 +1082,45 @@ int main(int argc, char* argv[]) {
 			default: break;
 		}
 	}
-	pthread_mutex_destroy(&lock);
-	close(file_desc);
+	for(i = 0; i < CAM_NUM && !passthrough; i++) {
+		if(!is_arr[i]->sources)
+			continue;
+		st.tape = i;
+		if(transport_get_stats(transport, &st) != SUCCESS)
+			continue;
+		printf("tape %d: %llu written, %llu read, %llu dropped, %lu skipped\n", i+1,
+				(unsigned long long)st.written, (unsigned long long)st.read,
+				(unsigned long long)st.dropped, is_arr[i]->skipped);
+		if(st.reclaimed)
+			printf("tape %d: %.1f MB reclaimed under memory pressure, reallocated %llu times\n", i+1,
+					st.reclaimed / 1048576.0, (unsigned long long)st.reallocs);
+		if(st.pinned)
+			printf("tape %d: %llu frames pinned, %.1f MB copied by the module\n", i+1,
+					(unsigned long long)st.pinned, st.copied / 1048576.0);
+		if(st.node >= 0)
+			printf("tape %d: buffer on node %d%s, %llu copies across nodes\n", i+1, st.node,
+					st.contiguous ? " (contiguous)" : "", (unsigned long long)st.cross_node);
+	}
+	for(i = 0; i < CAM_NUM && readahead_mb; i++) {
+		if(!is_arr[i]->sources)
+			continue;
+		pthread_mutex_lock(&is_arr[i]->lock);
+		printf("tape %d: %.1f MB read, %.1f ms of I/O wait\n", i+1,
+				(is_arr[i]->io_bytes + __atomic_load_n(&is_arr[i]->io.bytes, __ATOMIC_RELAXED)) / 1048576.0,
+				(is_arr[i]->io_wait_ns + __atomic_load_n(&is_arr[i]->io.wait_ns, __ATOMIC_RELAXED)) / 1e6);
+		pthread_mutex_unlock(&is_arr[i]->lock);
+	}
+	for(i = 0; i < CAM_NUM; i++)
+		if(is_arr[i]->live.late || is_arr[i]->live.reconnects)
+			printf("tape %d: %lu packets behind the jitter budget (not sent), %lu reconnects\n", i+1,
+					is_arr[i]->live.late, is_arr[i]->live.reconnects);
+
+	if(cpu_percent)
+		budget_dump(&budget, stdout);
+	if(prof_enabled)
+		prof_dump(stdout);
+	if(control_path)
+		unlink(control_path);
+	cam_close(client);
 	return 0;
 }